@@ -30,21 +30,32 @@ zstream_usage(void)
 	    "usage: zstream command args ...\n"
 	    "Available commands are:\n"
 	    "\n"
-	    "\tzstream dump [-vCd] FILE\n"
-	    "\t... | zstream dump [-vCd]\n"
+	    "\tzstream dump [-vCdS] FILE\n"
+	    "\t... | zstream dump [-vCdS]\n"
 	    "\n"
-	    "\tzstream decompress [-v] [OBJECT,OFFSET[,TYPE]] ...\n"
+	    "\tzstream decompress [-Sv] [OBJECT,OFFSET[,TYPE]] ...\n"
 	    "\n"
-	    "\tzstream drop_record [-v] [OBJECT,OFFSET] ...\n"
+	    "\tzstream drop_record [-Sv] [OBJECT,OFFSET] ...\n"
 	    "\n"
-	    "\tzstream raw [-v] [-b blocks] [-g guid] IMAGE|DEVICE FILE\n"
-	    "\t... | zstream raw [-v] [-b blocks] [-g guid] IMAGE|DEVICE\n"
+	    "\tzstream raw [-Sv] [-b blocks] [-g guid] [-q depth]\n"
+	    "\t    IMAGE|DEVICE FILE\n"
+	    "\t... | zstream raw [-Sv] [-b blocks] [-g guid] [-q depth]\n"
+	    "\t    IMAGE|DEVICE\n"
 	    "\n"
-	    "\tzstream recompress [-t num_threads] [-l level] TYPE\n"
+	    "\tzstream recompress [-Svw] [-t num_threads] [-l level] "
+	    "[-g min_gain] TYPE[,TYPE]...\n"
 	    "\n"
 	    "\tzstream token resume_token\n"
 	    "\n"
-	    "\tzstream redup [-v] FILE | ...\n");
+	    "\tzstream redup [-Sv] FILE | ...\n"
+	    "\n"
+	    "\tzstream stats [-CS] [-c TYPE] ... [-s sample_rate] "
+	    "[-t num_threads] [FILE]\n"
+	    "\n"
+	    "\tzstream transform [-rSvw] [-t num_threads] [-K keyfile] "
+	    "[-c TYPE [-l level]]\n"
+	    "\t    [-d OBJECT,OFFSET[,TYPE]] ... [-x OBJECT,OFFSET] ... "
+	    "[FILE]\n");
 	exit(1);
 }
 
@@ -93,6 +104,10 @@ main(int argc, char *argv[])
 		return (zstream_do_token(argc - 1, argv + 1));
 	} else if (strcmp(subcommand, "redup") == 0) {
 		return (zstream_do_redup(argc - 1, argv + 1));
+	} else if (strcmp(subcommand, "stats") == 0) {
+		return (zstream_do_stats(argc - 1, argv + 1));
+	} else if (strcmp(subcommand, "transform") == 0) {
+		return (zstream_do_transform(argc - 1, argv + 1));
 	} else if (strcmp(subcommand, "selftest") == 0) {
 		/* Undocumented; used by the ZFS test suite */
 		return (zstream_do_selftest(argc - 1, argv + 1));
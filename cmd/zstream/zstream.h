@@ -37,6 +37,8 @@ extern int zstream_do_drop_record(int argc, char *argv[]);
 extern int zstream_do_recompress(int argc, char *argv[]);
 extern int zstream_do_token(int, char *[]);
 extern int zstream_do_raw(int, char *[]);
+extern int zstream_do_stats(int, char *[]);
+extern int zstream_do_transform(int, char *[]);
 extern int zstream_do_selftest(int, char *[]);
 extern void zstream_usage(void) __attribute__((noreturn));
 
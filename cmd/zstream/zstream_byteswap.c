@@ -187,6 +187,7 @@ serial_byteswap(byteswap_stage_t stage)
 	*bsc = stage;
 	chain_step_t step = {
 		.cs_type = CS_SERIAL,
+		.cs_name = "byteswap",
 		.cs_in_size = sizeof (drr_packet_t),
 		.cs_out_size = sizeof (drr_packet_t),
 		.cs_context = bsc,
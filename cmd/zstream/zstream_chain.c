@@ -20,15 +20,18 @@
 #include <pthread.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/abd.h>
 #include <sys/param.h>
 #include <sys/stdtypes.h>
+#include <sys/time.h>
 #include <sys/zio.h>
 #include <sys/zstd/zstd.h>
 #include <sys/zfs_refcount.h>
 #include <zfs_fletcher.h>
 
 #include "zstream_chain.h"
+#include "zstream_pipestats.h"
 #include "zstream_queue.h"
 #include "zstream_util.h"
 
@@ -50,6 +53,7 @@ typedef struct {
  */
 typedef struct {
 	chain_step_t	*wc_steps;
+	step_stats_t	*wc_stats;	/* Parallel to wc_steps, or NULL */
 	int		wc_num_steps;
 	size_t		wc_buffer_size;
 	zstream_queue_t	*wc_in_queue;
@@ -87,6 +91,27 @@ libraries_fini(void)
 	zfs_refcount_fini();
 }
 
+/*
+ * Run a serial step, collecting statistics if stats is not NULL. Items are
+ * counted as they enter a step, except at the source of the chain.
+ */
+static disposition_t
+run_serial_step(chain_step_t *step, step_stats_t *stats, void *buffer)
+{
+	if (stats == NULL)
+		return (step->cs_serial.process(buffer, step->cs_context));
+
+	if (step->cs_in_size > 0)
+		pipestats_count(stats, buffer);
+	hrtime_t start = gethrtime();
+	disposition_t dispo = step->cs_serial.process(buffer,
+	    step->cs_context);
+	stats->ps_busy_ns += gethrtime() - start;
+	if (step->cs_in_size == 0 && dispo == D_OK)
+		pipestats_count(stats, buffer);
+	return (dispo);
+}
+
 /*
  * Body function for worker threads
  */
@@ -100,14 +125,16 @@ zstream_chain_worker(void *ctxt_in)
 	while (!done) {
 		for (int i = 0; i < ctxt->wc_num_steps; i++) {
 			chain_step_t *step = &ctxt->wc_steps[i];
+			step_stats_t *stats = ctxt->wc_stats ?
+			    &ctxt->wc_stats[i] : NULL;
 			if (step->cs_type == CS_SERIAL) {
 				if (done) {
 					(void) step->cs_serial.process(NULL,
 					    step->cs_context);
 				} else {
 					disposition_t dispo =
-					    step->cs_serial.process(buffer,
-					    step->cs_context);
+					    run_serial_step(step, stats,
+					    buffer);
 					if (dispo == D_EOF) {
 						done = B_TRUE;
 					} else if (dispo == D_DROP) {
@@ -120,6 +147,8 @@ zstream_chain_worker(void *ctxt_in)
 			} else if (done) {
 				zstream_queue_fini(ctxt->wc_out_queue);
 			} else {
+				if (stats != NULL)
+					pipestats_count(stats, buffer);
 				zstream_enqueue(ctxt->wc_out_queue, buffer);
 			}
 		}
@@ -205,8 +234,17 @@ zstream_chain_exec(zstream_chain_t chain, chain_attrs_t *attrs)
 	int num_workers = stats.ct_num_queues + 1;
 	worker_context_t contexts[num_workers];
 	pthread_t worker_threads[num_workers];
+	step_stats_t *step_stats = NULL;
 	zstream_queue_t *queue;
 
+	chain_attrs_t backup_attrs = {0};
+	chain_attrs = attrs ? attrs : &backup_attrs;
+
+	if (OPTION_ENABLED(CA_PIPELINE_STATS)) {
+		step_stats = safe_calloc(stats.ct_num_steps *
+		    sizeof (step_stats_t));
+	}
+
 	/*
 	 * Create parallel queues and worker thread contexts
 	 *
@@ -220,6 +258,7 @@ zstream_chain_exec(zstream_chain_t chain, chain_attrs_t *attrs)
 
 	worker_context_t context = {
 	    .wc_steps = chain,
+	    .wc_stats = step_stats,
 	    .wc_num_steps = 0,
 	    .wc_buffer_size = stats.ct_item_size,
 	    .wc_in_queue = NULL
@@ -236,13 +275,16 @@ zstream_chain_exec(zstream_chain_t chain, chain_attrs_t *attrs)
 				.qp_item_size	 = stats.ct_item_size,
 				.qp_batch_budget = cs->cs_parallel.batch_budget,
 				.qp_queue_length = cs->cs_parallel.queue_length,
-				.qp_context	 = cs->cs_context
+				.qp_context	 = cs->cs_context,
+				.qp_stats	 = step_stats ?
+				    &step_stats[i].ps_queue : NULL
 			};
 			queue = zstream_queue_create(&queue_params);
 			contexts[worker].wc_out_queue = queue;
 			worker++;
 			worker_context_t next_context = {
 			    .wc_steps = cs,
+			    .wc_stats = step_stats ? &step_stats[i] : NULL,
 			    .wc_num_steps = 1,
 			    .wc_buffer_size = stats.ct_item_size,
 			    .wc_in_queue = queue
@@ -253,11 +295,11 @@ zstream_chain_exec(zstream_chain_t chain, chain_attrs_t *attrs)
 
 	contexts[worker].wc_out_queue = NULL;
 
-	chain_attrs_t backup_attrs = {0};
-	chain_attrs = attrs ? attrs : &backup_attrs;
-
 	libraries_init();
 
+	if (step_stats != NULL)
+		pipestats_start(chain, stats.ct_num_steps, step_stats);
+
 	/* Spawn threads */
 	for (int i = 0; i < num_workers; i++) {
 		char name[32];
@@ -272,6 +314,11 @@ zstream_chain_exec(zstream_chain_t chain, chain_attrs_t *attrs)
 		VERIFY3S(ret, ==, 0);
 	}
 
+	if (step_stats != NULL) {
+		pipestats_finish();
+		free(step_stats);
+	}
+
 	libraries_fini();
 }
 
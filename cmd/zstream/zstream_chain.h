@@ -93,6 +93,10 @@ extern "C" {
  * **CHAIN ATTRIBUTES** - A global set of flags available to all steps. The
  * chain is also responsible for tracking general statistics such as the
  * number of records of each type that have been processed.
+ *
+ * If CA_PIPELINE_STATS is set, the chain also measures the throughput of
+ * each step and reports it when execution is complete. Steps are
+ * identified in the report by cs_name. See zstream_pipestats.h.
  */
 
 #define	CA_BYTESWAPPED			(1ULL << 0)	/* ca_attrs */
@@ -113,6 +117,8 @@ extern "C" {
 #define	CA_BIG_ENDIAN_OUT		(1ULL << 11)
 #define	CA_LITTLE_ENDIAN_OUT		(1ULL << 12)
 #define	CA_OPPOSITE_ENDIAN_OUT		(1ULL << 13)
+#define	CA_PIPELINE_STATS		(1ULL << 14)
+#define	CA_PIPELINE_STATS_JSON		(1ULL << 15)
 
 #define	OPTION_ENABLED(option) (!!(chain_attrs->ca_command_opts & (option)))
 #define	STREAM_HAS_FEATURE(feat) (!!(chain_attrs->ca_feature_flags & (feat)))
@@ -150,6 +156,7 @@ zc_serial_process_f(void *item, void *context);
 typedef struct chain_step
 {
 	step_type_t	cs_type;
+	const char	*cs_name;	/* For statistics reports */
 	size_t		cs_in_size;
 	size_t		cs_out_size;
 	void		*cs_context;
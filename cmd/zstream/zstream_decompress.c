@@ -36,6 +36,12 @@
 
 #define	KEYSIZE 64
 
+/*
+ * The hsearch(3) table is process-wide and may be shared with other
+ * record-selection steps (see zstream transform), so keys are prefixed.
+ */
+#define	KEY_FORMAT "decompress:%llu,%llu"
+
 static disposition_t
 chain_decompress_named_writes(void *item_in, void *context)
 {
@@ -55,7 +61,7 @@ chain_decompress_named_writes(void *item_in, void *context)
 		return (D_OK);
 	}
 
-	snprintf(key, KEYSIZE, "%llu,%llu",
+	snprintf(key, KEYSIZE, KEY_FORMAT,
 	    (u_longlong_t)drrw->drr_object, (u_longlong_t)drrw->drr_offset);
 	ENTRY e = { .key = key };
 	ENTRY *p = hsearch(e, FIND);
@@ -117,11 +123,12 @@ chain_decompress_named_writes(void *item_in, void *context)
 	return (D_OK);
 }
 
-static chain_step_t
+chain_step_t
 serial_decompress_named_writes(void)
 {
 	chain_step_t step = {
 		.cs_type = CS_SERIAL,
+		.cs_name = "decompress_named_writes",
 		.cs_in_size = sizeof (drr_packet_t),
 		.cs_out_size = sizeof (drr_packet_t),
 		.cs_context = NULL,
@@ -132,17 +139,77 @@ serial_decompress_named_writes(void)
 	return (step);
 }
 
+/*
+ * Register an OBJECT,OFFSET[,TYPE] specification for decompression. The
+ * caller must have created the hsearch(3) table with room for every entry.
+ */
+void
+decompress_record_add(char *spec)
+{
+	uint64_t object, offset;
+	char *obj_str;
+	char *offset_str;
+	char *key;
+	char *end;
+	enum zio_compress type = ZIO_COMPRESS_INHERIT;
+
+	obj_str = strsep(&spec, ",");
+	if (spec == NULL)
+		zstream_usage();
+	errno = 0;
+	object = strtoull(obj_str, &end, 0);
+	if (errno || *end != '\0')
+		errx(1, "invalid value for object");
+	offset_str = strsep(&spec, ",");
+	offset = strtoull(offset_str, &end, 0);
+	if (errno || *end != '\0')
+		errx(1, "invalid value for offset");
+	if (spec) {
+		if (0 == strcmp("off", spec))
+			type = ZIO_COMPRESS_OFF;
+		else if (0 == strcmp("lz4", spec))
+			type = ZIO_COMPRESS_LZ4;
+		else if (0 == strcmp("lzjb", spec))
+			type = ZIO_COMPRESS_LZJB;
+		else if (0 == strcmp("gzip", spec))
+			type = ZIO_COMPRESS_GZIP_1;
+		else if (0 == strcmp("zle", spec))
+			type = ZIO_COMPRESS_ZLE;
+		else if (0 == strcmp("zstd", spec))
+			type = ZIO_COMPRESS_ZSTD;
+		else {
+			errx(2, "invalid compression type %s. "
+			    "Supported types are off, lz4, lzjb, gzip, "
+			    "zle, and zstd", spec);
+		}
+	}
+
+	int n_chars = asprintf(&key, KEY_FORMAT, (u_longlong_t)object,
+	    (u_longlong_t)offset);
+	if (n_chars < 0)
+		err(1, "asprintf");
+	ENTRY e = { .key = key };
+	ENTRY *p;
+	p = hsearch(e, ENTER);
+	if (p == NULL)
+		errx(1, "hsearch failed");
+	p->data = (void *)(intptr_t)type;
+}
+
 int
 zstream_do_decompress(int argc, char *argv[])
 {
 	chain_attrs_t attrs = {0};
 	int c;
 
-	while ((c = getopt(argc, argv, "v")) != -1) {
+	while ((c = getopt(argc, argv, "Sv")) != -1) {
 		switch (c) {
 		case 'v':
 			ENABLE_OPTION(&attrs, CA_VERBOSE);
 			break;
+		case 'S':
+			pipestats_option(&attrs);
+			break;
 		case '?':
 			fprintf(stderr, "invalid option '%c'\n", optopt);
 			zstream_usage();
@@ -157,56 +224,8 @@ zstream_do_decompress(int argc, char *argv[])
 	if (hcreate(argc) == 0)
 		errx(1, "hcreate failed");
 
-	for (int i = 0; i < argc; i++) {
-		uint64_t object, offset;
-		char *obj_str;
-		char *offset_str;
-		char *key;
-		char *end;
-		enum zio_compress type = ZIO_COMPRESS_INHERIT;
-
-		obj_str = strsep(&argv[i], ",");
-		if (argv[i] == NULL)
-			zstream_usage();
-		errno = 0;
-		object = strtoull(obj_str, &end, 0);
-		if (errno || *end != '\0')
-			errx(1, "invalid value for object");
-		offset_str = strsep(&argv[i], ",");
-		offset = strtoull(offset_str, &end, 0);
-		if (errno || *end != '\0')
-			errx(1, "invalid value for offset");
-		if (argv[i]) {
-			if (0 == strcmp("off", argv[i]))
-				type = ZIO_COMPRESS_OFF;
-			else if (0 == strcmp("lz4", argv[i]))
-				type = ZIO_COMPRESS_LZ4;
-			else if (0 == strcmp("lzjb", argv[i]))
-				type = ZIO_COMPRESS_LZJB;
-			else if (0 == strcmp("gzip", argv[i]))
-				type = ZIO_COMPRESS_GZIP_1;
-			else if (0 == strcmp("zle", argv[i]))
-				type = ZIO_COMPRESS_ZLE;
-			else if (0 == strcmp("zstd", argv[i]))
-				type = ZIO_COMPRESS_ZSTD;
-			else {
-				errx(2, "invalid compression type %s. "
-				    "Supported types are off, lz4, lzjb, gzip, "
-				    "zle, and zstd", argv[i]);
-			}
-		}
-
-		int n_chars = asprintf(&key, "%llu,%llu", (u_longlong_t)object,
-		    (u_longlong_t)offset);
-		if (n_chars < 0)
-			err(1, "asprintf");
-		ENTRY e = { .key = key };
-		ENTRY *p;
-		p = hsearch(e, ENTER);
-		if (p == NULL)
-			errx(1, "hsearch failed");
-		p->data = (void *)(intptr_t)type;
-	}
+	for (int i = 0; i < argc; i++)
+		decompress_record_add(argv[i]);
 
 	ENABLE_OPTION(&attrs, CA_FORBID_DEDUP);
 
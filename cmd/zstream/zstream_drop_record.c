@@ -31,6 +31,12 @@
 
 #define	KEYSIZE 64
 
+/*
+ * The hsearch(3) table is process-wide and may be shared with other
+ * record-selection steps (see zstream transform), so keys are prefixed.
+ */
+#define	KEY_FORMAT "drop:%llu,%llu"
+
 static disposition_t
 chain_drop_records(void *item_in, void *context)
 {
@@ -60,7 +66,7 @@ chain_drop_records(void *item_in, void *context)
 		return (D_OK);
 	}
 
-	snprintf(key, KEYSIZE, "%llu,%llu", object, offset);
+	snprintf(key, KEYSIZE, KEY_FORMAT, object, offset);
 	if (hsearch(e, FIND) != NULL) {
 		if (OPTION_ENABLED(CA_VERBOSE)) {
 			warnx("dropping %s record for object %llu "
@@ -88,11 +94,12 @@ chain_drop_records(void *item_in, void *context)
 	return (D_OK);
 }
 
-static chain_step_t
+chain_step_t
 serial_drop_records(void)
 {
 	chain_step_t step = {
 		.cs_type = CS_SERIAL,
+		.cs_name = "drop_records",
 		.cs_in_size = sizeof (drr_packet_t),
 		.cs_out_size = sizeof (drr_packet_t),
 		.cs_context = NULL,
@@ -103,17 +110,57 @@ serial_drop_records(void)
 	return (step);
 }
 
+/*
+ * Register an OBJECT,OFFSET specification for dropping. The caller must
+ * have created the hsearch(3) table with room for every entry.
+ */
+void
+drop_record_add(char *spec)
+{
+	uint64_t object, offset;
+	char *obj_str;
+	char *offset_str;
+	char *key;
+	char *end;
+
+	obj_str = strsep(&spec, ",");
+	if (spec == NULL)
+		zstream_usage();
+	errno = 0;
+	object = strtoull(obj_str, &end, 0);
+	if (errno || *end != '\0')
+		errx(1, "invalid value for object");
+	offset_str = strsep(&spec, ",");
+	offset = strtoull(offset_str, &end, 0);
+	if (errno || *end != '\0')
+		errx(1, "invalid value for offset");
+
+	if (asprintf(&key, KEY_FORMAT, (u_longlong_t)object,
+	    (u_longlong_t)offset) < 0) {
+		err(1, "asprintf");
+	}
+	ENTRY e = {.key = key};
+	ENTRY *p;
+	p = hsearch(e, ENTER);
+	if (p == NULL)
+		errx(1, "hsearch");
+	p->data = (void *)(intptr_t)B_TRUE;
+}
+
 int
 zstream_do_drop_record(int argc, char *argv[])
 {
 	int c;
 	chain_attrs_t attrs = {0};
 
-	while ((c = getopt(argc, argv, "v")) != -1) {
+	while ((c = getopt(argc, argv, "Sv")) != -1) {
 		switch (c) {
 		case 'v':
 			ENABLE_OPTION(&attrs, CA_VERBOSE);
 			break;
+		case 'S':
+			pipestats_option(&attrs);
+			break;
 		case '?':
 			warnx("invalid option '%c'\n", optopt);
 			zstream_usage();
@@ -128,37 +175,8 @@ zstream_do_drop_record(int argc, char *argv[])
 	if (hcreate(argc) == 0)
 		errx(1, "hcreate failed");
 
-	for (int i = 0; i < argc; i++) {
-
-		uint64_t object, offset;
-		char *obj_str;
-		char *offset_str;
-		char *key;
-		char *end;
-
-		obj_str = strsep(&argv[i], ",");
-		if (argv[i] == NULL)
-			zstream_usage();
-		errno = 0;
-		object = strtoull(obj_str, &end, 0);
-		if (errno || *end != '\0')
-			errx(1, "invalid value for object");
-		offset_str = strsep(&argv[i], ",");
-		offset = strtoull(offset_str, &end, 0);
-		if (errno || *end != '\0')
-			errx(1, "invalid value for offset");
-
-		if (asprintf(&key, "%llu,%llu", (u_longlong_t)object,
-		    (u_longlong_t)offset) < 0) {
-			err(1, "asprintf");
-		}
-		ENTRY e = {.key = key};
-		ENTRY *p;
-		p = hsearch(e, ENTER);
-		if (p == NULL)
-			errx(1, "hsearch");
-		p->data = (void *)(intptr_t)B_TRUE;
-	}
+	for (int i = 0; i < argc; i++)
+		drop_record_add(argv[i]);
 
 	ENABLE_OPTION(&attrs, CA_FORBID_DEDUP);
 
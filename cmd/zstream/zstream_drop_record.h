@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * https://opensource.org/license/CDDL-1.0.
+ */
+
+/*
+ * Copyright (c) 2026 by Garth Snyder. All rights reserved.
+ */
+
+#ifndef _ZSTREAM_DROP_RECORD_H
+#define	_ZSTREAM_DROP_RECORD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "zstream_io.h"
+
+/*
+ * Drop WRITE and WRITE_EMBEDDED records named by OBJECT,OFFSET strings.
+ * Specifications are kept in the process-wide hsearch(3) table, which the
+ * caller must create with hcreate() before adding any.
+ */
+void
+drop_record_add(char *spec);
+
+chain_step_t
+serial_drop_records(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _ZSTREAM_DROP_RECORD_H */
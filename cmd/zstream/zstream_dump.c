@@ -484,6 +484,7 @@ serial_dump_records(void)
 
 	chain_step_t step = {
 		.cs_type = CS_SERIAL,
+		.cs_name = "dump_records",
 		.cs_in_size = sizeof (drr_packet_t),
 		.cs_out_size = sizeof (drr_packet_t),
 		.cs_context = NULL,
@@ -503,7 +504,7 @@ zstream_do_dump(int argc, char *argv[])
 
 	ENABLE_OPTION(&attrs, CA_DUMP_BEGIN_AND_END);
 
-	while ((c = getopt(argc, argv, ":vCd")) != -1) {
+	while ((c = getopt(argc, argv, ":vCdS")) != -1) {
 		switch (c) {
 		case 'C':
 			ENABLE_OPTION(&attrs, CA_IGNORE_CKSUMS);
@@ -522,6 +523,9 @@ zstream_do_dump(int argc, char *argv[])
 			ENABLE_OPTION(&attrs, CA_DUMP_CHECKSUMS);
 			ENABLE_OPTION(&attrs, CA_DUMP_DATA);
 			break;
+		case 'S':
+			pipestats_option(&attrs);
+			break;
 		case ':':
 			warnx("missing argument for '%c' option\n", optopt);
 			zstream_usage();
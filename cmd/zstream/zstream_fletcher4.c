@@ -111,9 +111,15 @@ fletcher4_incremental_combine(zio_cksum_t *zcp, const uint64_t size,
 }
 
 /*
- * This is the parallel portion of checksum calculation. We calculate only
- * the checksum blocks for payloads. The records themselves are summed in
- * the serial step.
+ * This is the parallel portion of checksum calculation. We calculate the
+ * checksum blocks for payloads and for the portion of the record header
+ * that precedes drr_checksum. The serial step need only fold these into
+ * the stream checksum.
+ *
+ * Records without payloads have a cost of zero and are never dispatched
+ * here, so the serial step sums their headers directly. DRR_END headers
+ * are also left to the serial step because inscription modifies
+ * drr_end.drr_checksum, which lies within the summed region.
  *
  * Because MAX_FLETCHER_BLOCK is 8MB, the great majority of payloads need
  * only a single checksum calculation. The drr_fletcher4_t struct has both a
@@ -135,6 +141,15 @@ chain_calc_fletcher4(queue_item_t *item_in, void *context)
 	int num_overflow = DIV_ROUND_UP(remaining, MAX_FLETCHER_BLOCK) - 1;
 	zio_cksum_t *fragment = &item->dp_fletcher4_payload;
 	boolean_t swap = ATTR_IS_SET(CA_BYTESWAPPED);
+	dmu_replay_record_t *drr = &item->dp_base.dp_drr;
+	uint32_t drr_type = swap ? BSWAP_32(drr->drr_type) : drr->drr_type;
+
+	item->dp_fletcher4_flags = 0;
+	if (drr_type != DRR_END) {
+		fletcher_4(swap, drr, CK_OFFSET, &item->dp_fletcher4_header);
+		item->dp_fletcher4_flags = F4_HEADER_VALID |
+		    (swap ? F4_HEADER_SWAPPED : 0);
+	}
 
 	fletcher_4(swap, data, write_size, fragment);
 	if (num_overflow) {
@@ -177,6 +192,21 @@ assemble_payload_cksum(drr_fletcher4_t *item, zio_cksum_t *stream_ck)
 	}
 }
 
+/*
+ * Is there a usable header checksum from the parallel step? Items that
+ * bypassed the parallel step have no payload, and their flags were never
+ * set.
+ */
+static inline boolean_t
+header_precalculated(drr_fletcher4_t *item, boolean_t swap)
+{
+	if (item->dp_base.dp_payload_size == 0)
+		return (B_FALSE);
+	if (!(item->dp_fletcher4_flags & F4_HEADER_VALID))
+		return (B_FALSE);
+	return (!!(item->dp_fletcher4_flags & F4_HEADER_SWAPPED) == swap);
+}
+
 /*
  * This function implements the serial portions of both validation and
  * inscription, based on the fc_operation field of the context struct.
@@ -250,7 +280,12 @@ chain_fletcher4(queue_item_t *item_in, void *context_in)
 				ZIO_CHECKSUM_BSWAP(end_cksum);
 		}
 	}
-	fletcher_4_incremental(swap, drr, ck_offset, stream_cksum);
+	if (header_precalculated(item, swap)) {
+		fletcher4_incremental_combine(stream_cksum, ck_offset,
+		    &item->dp_fletcher4_header);
+	} else {
+		fletcher_4_incremental(swap, drr, ck_offset, stream_cksum);
+	}
 	if (drr_type != DRR_BEGIN && !IS_CONCLUSION(drr, drr_type)) {
 		if (context->fc_operation == F4_VALIDATE) {
 			off_t stream_offset =
@@ -285,6 +320,7 @@ parallel_calc_fletcher4(int queue_length)
 {
 	chain_step_t step = {
 	    .cs_type = CS_PARALLEL,
+	    .cs_name = "calc_fletcher4",
 	    .cs_in_size = sizeof (drr_packet_t),
 	    .cs_out_size = sizeof (drr_fletcher4_t),
 	    .cs_parallel = {
@@ -308,6 +344,8 @@ fletcher4_serial_step(fletcher4_op_t operation)
 
 	chain_step_t step = {
 	    .cs_type = CS_SERIAL,
+	    .cs_name = (operation == F4_SET) ? "add_fletcher4" :
+	    "validate_fletcher4",
 	    .cs_in_size = sizeof (drr_fletcher4_t),
 	    .cs_out_size = sizeof (drr_packet_t),
 	    .cs_context = context,
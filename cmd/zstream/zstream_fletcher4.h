@@ -33,7 +33,10 @@ extern "C" {
  * Checksums are calculated for the entire stream between a DRR_BEGIN record
  * and its corresponding DRR_END, so the final checksum assembly must be
  * performed as a serial step. However, we can pre-calculate the checksums
- * for individual payloads in parallel.
+ * for individual payloads and record headers in parallel, leaving only
+ * constant-time combine operations for the serial step. The parallel
+ * calculations use whichever SIMD implementation fletcher_4_init() found
+ * to be fastest.
  *
  * The normal sequence is a parallel_calc_fletcher4() step followed by a
  * serial_validate_fletcher4() or serial_add_fletcher4() step.
@@ -73,10 +76,20 @@ extern "C" {
  */
 #define	MAX_FLETCHER_4 8
 
+/*
+ * dp_fletcher4_header covers the record header up to drr_checksum. It's
+ * valid only when dp_fletcher4_flags includes F4_HEADER_VALID, and only
+ * for the byte order indicated by F4_HEADER_SWAPPED.
+ */
+#define	F4_HEADER_VALID		(1U << 0)
+#define	F4_HEADER_SWAPPED	(1U << 1)
+
 typedef struct {
 	drr_packet_t	dp_base;
+	zio_cksum_t	dp_fletcher4_header;
 	zio_cksum_t	dp_fletcher4_payload;
 	zio_cksum_t	*dp_fletcher4_overflow;
+	uint32_t	dp_fletcher4_flags;
 } drr_fletcher4_t;
 
 chain_step_t
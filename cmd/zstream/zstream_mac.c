@@ -0,0 +1,485 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * https://opensource.org/license/CDDL-1.0.
+ */
+
+/*
+ * Copyright (c) 2026 by Garth Snyder. All rights reserved.
+ */
+
+#include <ctype.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libnvpair.h>
+#include <openssl/evp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/crypto/icp.h>
+#include <sys/dmu.h>
+#include <sys/dsl_crypt.h>
+#include <sys/fs/zfs.h>
+#include <sys/stdtypes.h>
+#include <sys/zfs_ioctl.h>
+#include <sys/zio_crypt.h>
+#include <unistd.h>
+#include <zfs_prop.h>
+
+#include "zstream_mac.h"
+#include "zstream_util.h"
+
+#define	MAX_KEY_MATERIAL	512
+#define	MIN_PASSPHRASE_LEN	8
+
+/*
+ * Unwrapped dataset keys, one per distinct DSL_CRYPTO_KEY_GUID. Keys are
+ * retained until mac_verify_fini() so that records still in flight in the
+ * parallel step never see a key disappear. Stream packages rarely name
+ * more than a handful of encryption roots, and reusing keys across
+ * substreams avoids repeating the PBKDF2 derivation for each snapshot.
+ */
+typedef struct mac_key {
+	zio_crypt_key_t	mk_key;
+	uint64_t	mk_guid;
+	struct mac_key	*mk_next;
+} mac_key_t;
+
+typedef struct {
+	const char	*mc_keyfile;
+	uint8_t		mc_material[MAX_KEY_MATERIAL + 1];
+	size_t		mc_material_len;
+	boolean_t	mc_crypto_ready;
+	mac_key_t	*mc_keys;
+	mac_key_t	*mc_current;
+	uint64_t	mc_verified;
+	uint64_t	mc_unverified;
+} mac_context_t;
+
+static mac_context_t mac_context;
+
+static void
+read_key_material(mac_context_t *context)
+{
+	int fd = open(context->mc_keyfile, O_RDONLY);
+	if (fd < 0)
+		err(1, "unable to open %s", context->mc_keyfile);
+
+	size_t len = 0;
+	ssize_t n;
+	while (len < sizeof (context->mc_material) &&
+	    (n = read(fd, context->mc_material + len,
+	    sizeof (context->mc_material) - len)) != 0) {
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			err(1, "unable to read %s", context->mc_keyfile);
+		}
+		len += n;
+	}
+	(void) close(fd);
+
+	if (len > MAX_KEY_MATERIAL)
+		errx(1, "%s: key material is too long", context->mc_keyfile);
+	context->mc_material_len = len;
+}
+
+static int
+hex_to_raw(const uint8_t *hex, uint8_t *out, size_t outlen)
+{
+	for (size_t i = 0; i < outlen; i++) {
+		unsigned int c;
+		if (!isxdigit(hex[2 * i]) || !isxdigit(hex[2 * i + 1]))
+			return (EINVAL);
+		if (sscanf((const char *)&hex[2 * i], "%02x", &c) != 1)
+			return (EINVAL);
+		out[i] = c;
+	}
+	return (0);
+}
+
+/*
+ * Derive the wrapping key from the caller's key material as zfs
+ * load-key would, using the keyformat and PBKDF2 parameters recorded
+ * in the stream.
+ */
+static void
+derive_wrapping_key(mac_context_t *context, nvlist_t *keydata,
+    uint8_t *wkey)
+{
+	uint64_t format = fnvlist_lookup_uint64(keydata,
+	    zfs_prop_to_name(ZFS_PROP_KEYFORMAT));
+	uint8_t *material = context->mc_material;
+	size_t len = context->mc_material_len;
+
+	switch (format) {
+	case ZFS_KEYFORMAT_RAW:
+		if (len != WRAPPING_KEY_LEN) {
+			errx(1, "%s: raw key must be %d bytes",
+			    context->mc_keyfile, WRAPPING_KEY_LEN);
+		}
+		memcpy(wkey, material, WRAPPING_KEY_LEN);
+		break;
+	case ZFS_KEYFORMAT_HEX:
+		if (len < WRAPPING_KEY_LEN * 2 ||
+		    hex_to_raw(material, wkey, WRAPPING_KEY_LEN) != 0) {
+			errx(1, "%s: hex key must be %d hex digits",
+			    context->mc_keyfile, WRAPPING_KEY_LEN * 2);
+		}
+		break;
+	case ZFS_KEYFORMAT_PASSPHRASE: {
+		uint64_t iters = fnvlist_lookup_uint64(keydata,
+		    zfs_prop_to_name(ZFS_PROP_PBKDF2_ITERS));
+		uint64_t salt = LE_64(fnvlist_lookup_uint64(keydata,
+		    zfs_prop_to_name(ZFS_PROP_PBKDF2_SALT)));
+
+		while (len > 0 && material[len - 1] == '\n')
+			len--;
+		if (len < MIN_PASSPHRASE_LEN) {
+			errx(1, "%s: passphrase is too short",
+			    context->mc_keyfile);
+		}
+		if (PKCS5_PBKDF2_HMAC_SHA1((char *)material, len,
+		    (uint8_t *)&salt, sizeof (salt), iters, WRAPPING_KEY_LEN,
+		    wkey) != 1) {
+			errx(1, "failed to generate key from passphrase");
+		}
+		break;
+	}
+	default:
+		errx(1, "unsupported keyformat %llu in stream",
+		    (u_longlong_t)format);
+	}
+}
+
+static mac_key_t *
+unwrap_key(mac_context_t *context, nvlist_t *keydata)
+{
+	uint64_t guid = fnvlist_lookup_uint64(keydata, DSL_CRYPTO_KEY_GUID);
+
+	for (mac_key_t *mk = context->mc_keys; mk != NULL; mk = mk->mk_next) {
+		if (mk->mk_guid == guid)
+			return (mk);
+	}
+
+	if (!context->mc_crypto_ready) {
+		zfs_prop_init();
+		VERIFY0(icp_init());
+		context->mc_crypto_ready = B_TRUE;
+	}
+
+	uint64_t crypt = fnvlist_lookup_uint64(keydata,
+	    DSL_CRYPTO_KEY_CRYPTO_SUITE);
+	uint64_t version = fnvlist_lookup_uint64(keydata,
+	    DSL_CRYPTO_KEY_VERSION);
+	uint8_t *master, *hmac, *iv, *mac;
+	uint_t len;
+
+	if (crypt <= ZIO_CRYPT_OFF || crypt >= ZIO_CRYPT_FUNCTIONS)
+		errx(1, "unsupported encryption suite %llu in stream",
+		    (u_longlong_t)crypt);
+	VERIFY0(nvlist_lookup_uint8_array(keydata, DSL_CRYPTO_KEY_MASTER_KEY,
+	    &master, &len));
+	VERIFY3U(len, ==, MASTER_KEY_MAX_LEN);
+	VERIFY0(nvlist_lookup_uint8_array(keydata, DSL_CRYPTO_KEY_HMAC_KEY,
+	    &hmac, &len));
+	VERIFY3U(len, ==, SHA512_HMAC_KEYLEN);
+	VERIFY0(nvlist_lookup_uint8_array(keydata, DSL_CRYPTO_KEY_IV,
+	    &iv, &len));
+	VERIFY3U(len, ==, WRAPPING_IV_LEN);
+	VERIFY0(nvlist_lookup_uint8_array(keydata, DSL_CRYPTO_KEY_MAC,
+	    &mac, &len));
+	VERIFY3U(len, ==, WRAPPING_MAC_LEN);
+
+	uint8_t wkeydata[WRAPPING_KEY_LEN];
+	crypto_key_t wkey = {
+		.ck_data = wkeydata,
+		.ck_length = CRYPTO_BYTES2BITS(WRAPPING_KEY_LEN)
+	};
+	derive_wrapping_key(context, keydata, wkeydata);
+
+	mac_key_t *mk = safe_calloc(sizeof (mac_key_t));
+	int ret = zio_crypt_key_unwrap(&wkey, crypt, version, guid, master,
+	    hmac, iv, mac, &mk->mk_key);
+	memset(wkeydata, 0, sizeof (wkeydata));
+	if (ret == ECKSUM) {
+		errx(1, "incorrect wrapping key for dataset key %llu",
+		    (u_longlong_t)guid);
+	} else if (ret != 0) {
+		errx(1, "unable to unwrap dataset key %llu (error %d)",
+		    (u_longlong_t)guid, ret);
+	}
+
+	mk->mk_guid = guid;
+	mk->mk_next = context->mc_keys;
+	context->mc_keys = mk;
+	return (mk);
+}
+
+/*
+ * Select the key for a new substream. Raw substreams carry their key data
+ * in the BEGIN payload; anything else has no payload MACs to check.
+ */
+static void
+begin_substream(mac_context_t *context, drr_packet_t *pkt)
+{
+	struct drr_begin *drrb = &pkt->dp_drr.drr_u.drr_begin;
+	uint64_t features = DMU_GET_FEATUREFLAGS(drrb->drr_versioninfo);
+	nvlist_t *nvl = NULL, *keydata;
+
+	if (DMU_GET_STREAM_HDRTYPE(drrb->drr_versioninfo) == DMU_COMPOUNDSTREAM)
+		return;
+
+	context->mc_current = NULL;
+	if (!(features & DMU_BACKUP_FEATURE_RAW))
+		return;
+
+	if (pkt->dp_payload_size == 0 || nvlist_unpack((char *)pkt->dp_payload,
+	    pkt->dp_payload_size, &nvl, 0) != 0 ||
+	    nvlist_lookup_nvlist(nvl, "crypt_keydata", &keydata) != 0) {
+		errx(1, "raw substream %s has no key data", drrb->drr_toname);
+	}
+	context->mc_current = unwrap_key(context, keydata);
+	nvlist_free(nvl);
+}
+
+static disposition_t
+chain_assign_mac_keys(void *item_in, void *context_in)
+{
+	drr_mac_t *item = (drr_mac_t *)item_in;
+	mac_context_t *context = (mac_context_t *)context_in;
+
+	if (item == NULL)
+		return (D_OK);
+
+	drr_packet_t *pkt = &item->dm_base;
+	item->dm_key = NULL;
+	item->dm_error = 0;
+
+	switch (pkt->dp_drr.drr_type) {
+	case DRR_BEGIN:
+		begin_substream(context, pkt);
+		break;
+	case DRR_END:
+		context->mc_current = NULL;
+		break;
+	case DRR_WRITE:
+	case DRR_SPILL:
+		if (context->mc_current != NULL && pkt->dp_payload_size > 0)
+			item->dm_key = context->mc_current;
+		break;
+	default:
+		break;
+	}
+	return (D_OK);
+}
+
+static size_t
+chain_verify_mac_cost(queue_item_t *item_in, void *context)
+{
+	(void) context;
+	drr_mac_t *item = (drr_mac_t *)item_in;
+	return (item->dm_key == NULL ? 0 : item->dm_base.dp_payload_size);
+}
+
+static void
+chain_verify_macs(queue_item_t *item_in, void *context)
+{
+	(void) context;
+	drr_mac_t *item = (drr_mac_t *)item_in;
+	drr_packet_t *pkt = &item->dm_base;
+	dmu_replay_record_t *drr = &pkt->dp_drr;
+	dmu_object_type_t ot;
+	uint8_t *salt, *iv, *mac;
+	boolean_t byteswap;
+
+	if (item->dm_key == NULL)
+		return;
+
+	if (drr->drr_type == DRR_WRITE) {
+		struct drr_write *drrw = &drr->drr_u.drr_write;
+		ot = drrw->drr_type;
+		salt = drrw->drr_salt;
+		iv = drrw->drr_iv;
+		mac = drrw->drr_mac;
+		byteswap = !!(drrw->drr_flags & DRR_RAW_BYTESWAP);
+	} else {
+		struct drr_spill *drrs = &drr->drr_u.drr_spill;
+		ot = drrs->drr_type;
+		salt = drrs->drr_salt;
+		iv = drrs->drr_iv;
+		mac = drrs->drr_mac;
+		byteswap = !!(drrs->drr_flags & DRR_RAW_BYTESWAP);
+	}
+
+	if (!DMU_OT_IS_VALID(ot)) {
+		item->dm_error = EINVAL;
+		return;
+	}
+
+	/*
+	 * Object types that aren't encrypted are still authenticated with
+	 * an HMAC of the stored (compressed) block, as in zio_encrypt().
+	 */
+	if (!DMU_OT_IS_ENCRYPTED(ot)) {
+		uint8_t digest[ZIO_DATA_MAC_LEN];
+		item->dm_error = zio_crypt_do_hmac(&item->dm_key->mk_key,
+		    pkt->dp_payload, pkt->dp_payload_size, digest,
+		    sizeof (digest));
+		if (item->dm_error == 0 &&
+		    memcmp(digest, mac, ZIO_DATA_MAC_LEN) != 0) {
+			item->dm_error = ECKSUM;
+		}
+		return;
+	}
+
+	/*
+	 * Dnode and ZIL blocks authenticate only portions of their contents
+	 * and never appear as WRITE or SPILL payloads.
+	 */
+	if (ot == DMU_OT_DNODE || ot == DMU_OT_INTENT_LOG) {
+		item->dm_error = EINVAL;
+		return;
+	}
+
+	boolean_t no_crypt = B_FALSE;
+	uint8_t *plain = safe_malloc(pkt->dp_payload_size);
+	item->dm_error = zio_do_crypt_data(B_FALSE, &item->dm_key->mk_key, ot,
+	    byteswap, salt, iv, mac, pkt->dp_payload_size, plain,
+	    pkt->dp_payload, &no_crypt);
+	memset(plain, 0, pkt->dp_payload_size);
+	free(plain);
+}
+
+static disposition_t
+chain_check_macs(void *item_in, void *context_in)
+{
+	drr_mac_t *item = (drr_mac_t *)item_in;
+	mac_context_t *context = (mac_context_t *)context_in;
+
+	if (item == NULL)
+		return (D_OK);
+
+	drr_packet_t *pkt = &item->dm_base;
+	dmu_replay_record_t *drr = &pkt->dp_drr;
+
+	if (item->dm_key != NULL) {
+		if (item->dm_error != 0) {
+			uint64_t object = drr->drr_type == DRR_WRITE ?
+			    drr->drr_u.drr_write.drr_object :
+			    drr->drr_u.drr_spill.drr_object;
+			uint64_t offset = drr->drr_type == DRR_WRITE ?
+			    drr->drr_u.drr_write.drr_offset : 0;
+			errx(1, "MAC verification failed for %s record "
+			    "(object %llu, offset %llu) at stream offset %lld: "
+			    "%s", drr->drr_type == DRR_WRITE ? "WRITE" :
+			    "SPILL", (u_longlong_t)object, (u_longlong_t)offset,
+			    (longlong_t)pkt->dp_stream_offset,
+			    item->dm_error == ECKSUM ? "MAC mismatch" :
+			    strerror(item->dm_error));
+		}
+		context->mc_verified++;
+	} else if (drr->drr_type == DRR_OBJECT_RANGE) {
+		context->mc_unverified++;
+	}
+	return (D_OK);
+}
+
+chain_step_t
+serial_assign_mac_keys(const char *keyfile)
+{
+	mac_context_t *context = &mac_context;
+
+	VERIFY3P(context->mc_keyfile, ==, NULL);
+	context->mc_keyfile = keyfile;
+	read_key_material(context);
+
+	chain_step_t step = {
+		.cs_type = CS_SERIAL,
+		.cs_name = "assign_mac_keys",
+		.cs_in_size = sizeof (drr_packet_t),
+		.cs_out_size = sizeof (drr_mac_t),
+		.cs_context = context,
+		.cs_serial = {
+			.process = chain_assign_mac_keys
+		}
+	};
+	return (step);
+}
+
+/*
+ * AES-GCM runs at a few GB/s per core with the ICP's SIMD kernels, a bit
+ * faster than compression, so this uses a queue sized like the
+ * decompression step's.
+ */
+chain_step_t
+parallel_verify_macs(void)
+{
+	chain_step_t step = {
+	    .cs_type = CS_PARALLEL,
+	    .cs_name = "verify_macs",
+	    .cs_in_size = sizeof (drr_mac_t),
+	    .cs_out_size = sizeof (drr_mac_t),
+	    .cs_context = &mac_context,
+	    .cs_parallel = {
+		.queue_length = 256,
+		.batch_budget = 256 * 1024,
+		.process = chain_verify_macs,
+		.cost = chain_verify_mac_cost
+	    }
+	};
+	return (step);
+}
+
+chain_step_t
+serial_check_macs(void)
+{
+	chain_step_t step = {
+		.cs_type = CS_SERIAL,
+		.cs_name = "check_macs",
+		.cs_in_size = sizeof (drr_mac_t),
+		.cs_out_size = sizeof (drr_packet_t),
+		.cs_context = &mac_context,
+		.cs_serial = {
+			.process = chain_check_macs
+		}
+	};
+	return (step);
+}
+
+void
+mac_verify_fini(chain_attrs_t *attrs)
+{
+	mac_context_t *context = &mac_context;
+
+	if (attrs->ca_command_opts & CA_VERBOSE) {
+		(void) fprintf(stderr, "Verified MACs of %llu records; "
+		    "%llu dnode block MACs left to zfs receive.\n",
+		    (u_longlong_t)context->mc_verified,
+		    (u_longlong_t)context->mc_unverified);
+	}
+
+	if (context->mc_keys == NULL)
+		warnx("warning - stream has no raw substreams to verify");
+
+	while (context->mc_keys != NULL) {
+		mac_key_t *mk = context->mc_keys;
+		context->mc_keys = mk->mk_next;
+		zio_crypt_key_destroy(&mk->mk_key);
+		free(mk);
+	}
+	if (context->mc_crypto_ready)
+		icp_fini();
+	memset(context->mc_material, 0, sizeof (context->mc_material));
+	context->mc_keyfile = NULL;
+	context->mc_crypto_ready = B_FALSE;
+	context->mc_current = NULL;
+}
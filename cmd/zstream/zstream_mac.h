@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * https://opensource.org/license/CDDL-1.0.
+ */
+
+/*
+ * Copyright (c) 2026 by Garth Snyder. All rights reserved.
+ */
+
+#ifndef _ZSTREAM_MAC_H
+#define	_ZSTREAM_MAC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "zstream_io.h"
+
+/*
+ * zstream_chain module for authenticating the payloads of raw (encrypted)
+ * send streams without decrypting them for anyone downstream.
+ *
+ * The caller supplies the dataset's wrapping key in whatever form the
+ * stream's keyformat calls for: 32 raw bytes, 64 hex digits, or a
+ * passphrase. Each substream's DRR_BEGIN carries the wrapped master and
+ * HMAC keys in its crypt_keydata nvlist; these are unwrapped in memory
+ * and used to check the MAC of every DRR_WRITE and DRR_SPILL payload.
+ * Encrypted object types are checked by AES-GCM/CCM decryption into a
+ * scratch buffer, which is then discarded. Authenticated-only types are
+ * checked by HMAC. The stream itself passes through unmodified.
+ *
+ * MACs for dnode blocks (DRR_OBJECT_RANGE) cover whole dnode blocks that
+ * are not reconstructible from the stream, so they're left to zfs receive.
+ *
+ * serial_assign_mac_keys() tracks substreams and attaches the current key
+ * to each record. parallel_verify_macs() does the cryptography, and
+ * serial_check_macs() reports failures in stream order. The three steps
+ * must appear together, in this order, after the standard input stack.
+ * Call mac_verify_fini() once the chain has completed.
+ */
+
+struct mac_key;
+
+typedef struct {
+	drr_packet_t	dm_base;
+	struct mac_key	*dm_key;
+	int		dm_error;
+} drr_mac_t;
+
+/*
+ * keyfile must remain valid until mac_verify_fini() is called.
+ */
+chain_step_t
+serial_assign_mac_keys(const char *keyfile);
+
+chain_step_t
+parallel_verify_macs(void);
+
+chain_step_t
+serial_check_macs(void);
+
+void
+mac_verify_fini(chain_attrs_t *attrs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _ZSTREAM_MAC_H */
@@ -28,10 +28,16 @@ extern "C" {
 
 #include "zstream_byteswap.h"
 #include "zstream_chain.h"
+#include "zstream_decompress.h"
+#include "zstream_drop_record.h"
 #include "zstream_dump.h"
 #include "zstream_fletcher4.h"
 #include "zstream_io.h"
+#include "zstream_mac.h"
+#include "zstream_pipestats.h"
 #include "zstream_recompress.h"
+#include "zstream_redup.h"
+#include "zstream_stats.h"
 #include "zstream_util.h"
 #include "zstream_validate.h"
 
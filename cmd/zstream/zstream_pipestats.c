@@ -0,0 +1,296 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * https://opensource.org/license/CDDL-1.0.
+ */
+
+/*
+ * Copyright (c) 2026 by Garth Snyder. All rights reserved.
+ */
+
+/*
+ * Pipeline statistics. See zstream_pipestats.h.
+ *
+ * Counters are written by chain and queue worker threads without any
+ * coordination with this module, so periodic reports are approximate.
+ * The final report is exact because it's produced after all threads that
+ * touch the counters have finished with them.
+ *
+ * A stream hop is I/O-bound when read_stream or write_stream shows a
+ * thread count near 1.0; these steps block in read() and write(). It is
+ * CPU-bound when a parallel step accumulates producer wait (its queue is
+ * full) while its thread count approaches the size of the worker pool.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <libnvpair.h>
+#include <libzutil.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/nvpair.h>
+#include <sys/stdtypes.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "zstream_io.h"
+#include "zstream_pipestats.h"
+#include "zstream_queue.h"
+#include "zstream_util.h"
+
+#define	JSON_REPORT_INTERVAL_SEC	1
+
+typedef struct {
+	chain_step_t	*pc_chain;
+	int		pc_num_steps;
+	step_stats_t	*pc_stats;
+	step_stats_t	*pc_prev;	/* Snapshot from the last report */
+	hrtime_t	pc_start;
+	hrtime_t	pc_prev_time;
+	boolean_t	pc_json;
+	boolean_t	pc_stop;
+	pthread_t	pc_reporter;
+	pthread_mutex_t	pc_mutex;
+	pthread_cond_t	pc_cond;
+} pipestats_context_t;
+
+static pipestats_context_t pipestats_context = {
+	.pc_mutex = PTHREAD_MUTEX_INITIALIZER,
+	.pc_cond = PTHREAD_COND_INITIALIZER
+};
+
+void
+pipestats_option(chain_attrs_t *attrs)
+{
+	if (attrs->ca_command_opts & CA_PIPELINE_STATS)
+		ENABLE_OPTION(attrs, CA_PIPELINE_STATS_JSON);
+	ENABLE_OPTION(attrs, CA_PIPELINE_STATS);
+}
+
+void
+pipestats_count(step_stats_t *stats, const void *item)
+{
+	const drr_packet_t *packet = item;
+
+	stats->ps_items++;
+	stats->ps_bytes += sizeof (dmu_replay_record_t) +
+	    packet->dp_payload_size;
+}
+
+static double
+ns_to_sec(uint64_t ns)
+{
+	return ((double)ns / NANOSEC);
+}
+
+static double
+per_sec(uint64_t count, uint64_t ns)
+{
+	return (ns == 0 ? 0.0 : (double)count * NANOSEC / ns);
+}
+
+/*
+ * Threads occupied by a step, on average: 1.0 means that one thread was
+ * busy with the step for the whole interval.
+ */
+static double
+step_threads(chain_step_t *step, step_stats_t *cur, step_stats_t *prev,
+    uint64_t ns)
+{
+	uint64_t busy = (step->cs_type == CS_PARALLEL) ?
+	    cur->ps_queue.zqs_busy_ns - prev->ps_queue.zqs_busy_ns :
+	    cur->ps_busy_ns - prev->ps_busy_ns;
+	return (ns == 0 ? 0.0 : (double)busy / ns);
+}
+
+static double
+mean_depth(step_stats_t *cur, step_stats_t *prev)
+{
+	uint64_t items = cur->ps_queue.zqs_enqueued -
+	    prev->ps_queue.zqs_enqueued;
+	uint64_t depth = cur->ps_queue.zqs_depth_total -
+	    prev->ps_queue.zqs_depth_total;
+	return (items == 0 ? 0.0 : (double)depth / items);
+}
+
+/*
+ * Report on the interval since the previous snapshot, or on the whole run
+ * if prev is all zeroes.
+ */
+static void
+report_json(step_stats_t *cur, step_stats_t *prev, uint64_t ns,
+    boolean_t final)
+{
+	pipestats_context_t *pc = &pipestats_context;
+	zq_pool_stats_t pool;
+	nvlist_t *steps[pc->pc_num_steps];
+
+	zstream_queue_get_stats(&pool);
+	nvlist_t *nvl = fnvlist_alloc();
+	VERIFY0(nvlist_add_double(nvl, "elapsed_sec",
+	    ns_to_sec(gethrtime() - pc->pc_start)));
+	VERIFY0(nvlist_add_double(nvl, "interval_sec", ns_to_sec(ns)));
+	fnvlist_add_boolean_value(nvl, "final", final);
+	fnvlist_add_uint32(nvl, "worker_threads", pool.zps_num_threads);
+	fnvlist_add_uint64(nvl, "idle_waits", pool.zps_idle_waits);
+
+	for (int i = 0; i < pc->pc_num_steps; i++) {
+		chain_step_t *step = &pc->pc_chain[i];
+		step_stats_t *c = &cur[i], *p = &prev[i];
+		nvlist_t *s = fnvlist_alloc();
+		boolean_t parallel = step->cs_type == CS_PARALLEL;
+
+		fnvlist_add_string(s, "name",
+		    step->cs_name ? step->cs_name : "unnamed");
+		fnvlist_add_string(s, "type", parallel ? "parallel" : "serial");
+		fnvlist_add_uint64(s, "items", c->ps_items);
+		fnvlist_add_uint64(s, "bytes", c->ps_bytes);
+		VERIFY0(nvlist_add_double(s, "items_per_sec",
+		    per_sec(c->ps_items - p->ps_items, ns)));
+		VERIFY0(nvlist_add_double(s, "bytes_per_sec",
+		    per_sec(c->ps_bytes - p->ps_bytes, ns)));
+		VERIFY0(nvlist_add_double(s, "threads",
+		    step_threads(step, c, p, ns)));
+		if (parallel) {
+			VERIFY0(nvlist_add_double(s, "mean_queue_depth",
+			    mean_depth(c, p)));
+			VERIFY0(nvlist_add_double(s, "producer_wait_sec",
+			    ns_to_sec(c->ps_queue.zqs_producer_wait_ns)));
+			VERIFY0(nvlist_add_double(s, "consumer_wait_sec",
+			    ns_to_sec(c->ps_queue.zqs_consumer_wait_ns)));
+		}
+		steps[i] = s;
+	}
+	fnvlist_add_nvlist_array(nvl, "steps", (const nvlist_t * const *)steps,
+	    pc->pc_num_steps);
+
+	nvlist_print_json(stderr, nvl);
+	(void) fputc('\n', stderr);
+
+	for (int i = 0; i < pc->pc_num_steps; i++)
+		fnvlist_free(steps[i]);
+	fnvlist_free(nvl);
+}
+
+static void
+report_text(uint64_t ns)
+{
+	pipestats_context_t *pc = &pipestats_context;
+	step_stats_t zero = {0};
+	zq_pool_stats_t pool;
+	char items[16], bytes[16];
+
+	zstream_queue_get_stats(&pool);
+	(void) fprintf(stderr, "pipeline: %.2fs elapsed, %u worker threads, "
+	    "%llu idle waits\n", ns_to_sec(ns), pool.zps_num_threads,
+	    (u_longlong_t)pool.zps_idle_waits);
+	(void) fprintf(stderr, "%-26s %10s %8s %8s %7s %6s %9s %9s\n",
+	    "STEP", "ITEMS", "ITEMS/S", "BYTES/S", "THREADS", "DEPTH",
+	    "PROD-WAIT", "CONS-WAIT");
+
+	for (int i = 0; i < pc->pc_num_steps; i++) {
+		chain_step_t *step = &pc->pc_chain[i];
+		step_stats_t *s = &pc->pc_stats[i];
+
+		zfs_nicenum(per_sec(s->ps_items, ns), items, sizeof (items));
+		zfs_nicebytes(per_sec(s->ps_bytes, ns), bytes, sizeof (bytes));
+		(void) fprintf(stderr, "%-26s %10llu %8s %8s %7.2f",
+		    step->cs_name ? step->cs_name : "unnamed",
+		    (u_longlong_t)s->ps_items, items, bytes,
+		    step_threads(step, s, &zero, ns));
+		if (step->cs_type == CS_PARALLEL) {
+			(void) fprintf(stderr, " %6.1f %8.2fs %8.2fs\n",
+			    mean_depth(s, &zero),
+			    ns_to_sec(s->ps_queue.zqs_producer_wait_ns),
+			    ns_to_sec(s->ps_queue.zqs_consumer_wait_ns));
+		} else {
+			(void) fprintf(stderr, " %6s %9s %9s\n", "-", "-", "-");
+		}
+	}
+}
+
+/*
+ * Body of the reporter thread for periodic JSON output
+ */
+static void *
+pipestats_reporter(void *arg)
+{
+	pipestats_context_t *pc = arg;
+	struct timespec deadline;
+
+	pthread_mutex_lock(&pc->pc_mutex);
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	while (!pc->pc_stop) {
+		deadline.tv_sec += JSON_REPORT_INTERVAL_SEC;
+		int rc = 0;
+		while (!pc->pc_stop && rc != ETIMEDOUT) {
+			rc = pthread_cond_timedwait(&pc->pc_cond,
+			    &pc->pc_mutex, &deadline);
+		}
+		if (pc->pc_stop)
+			break;
+
+		size_t size = pc->pc_num_steps * sizeof (step_stats_t);
+		step_stats_t snapshot[pc->pc_num_steps];
+		memcpy(snapshot, pc->pc_stats, size);
+		hrtime_t now = gethrtime();
+		report_json(snapshot, pc->pc_prev, now - pc->pc_prev_time,
+		    B_FALSE);
+		memcpy(pc->pc_prev, snapshot, size);
+		pc->pc_prev_time = now;
+	}
+	pthread_mutex_unlock(&pc->pc_mutex);
+	return (NULL);
+}
+
+void
+pipestats_start(chain_step_t *chain, int num_steps, step_stats_t *stats)
+{
+	pipestats_context_t *pc = &pipestats_context;
+
+	pc->pc_chain = chain;
+	pc->pc_num_steps = num_steps;
+	pc->pc_stats = stats;
+	pc->pc_prev = safe_calloc(num_steps * sizeof (step_stats_t));
+	pc->pc_start = pc->pc_prev_time = gethrtime();
+	pc->pc_json = OPTION_ENABLED(CA_PIPELINE_STATS_JSON);
+	pc->pc_stop = B_FALSE;
+
+	if (pc->pc_json) {
+		pc->pc_reporter = safe_create_thread(pipestats_reporter, pc,
+		    "pipestats", B_FALSE);
+	}
+}
+
+void
+pipestats_finish(void)
+{
+	pipestats_context_t *pc = &pipestats_context;
+	uint64_t ns = gethrtime() - pc->pc_start;
+
+	if (pc->pc_json) {
+		pthread_mutex_lock(&pc->pc_mutex);
+		pc->pc_stop = B_TRUE;
+		pthread_cond_signal(&pc->pc_cond);
+		pthread_mutex_unlock(&pc->pc_mutex);
+		VERIFY0(pthread_join(pc->pc_reporter, NULL));
+
+		memset(pc->pc_prev, 0, pc->pc_num_steps *
+		    sizeof (step_stats_t));
+		report_json(pc->pc_stats, pc->pc_prev, ns, B_TRUE);
+	} else {
+		report_text(ns);
+	}
+
+	free(pc->pc_prev);
+	pc->pc_prev = NULL;
+}
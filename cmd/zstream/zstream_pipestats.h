@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * https://opensource.org/license/CDDL-1.0.
+ */
+
+/*
+ * Copyright (c) 2026 by Garth Snyder. All rights reserved.
+ */
+
+#ifndef _ZSTREAM_PIPESTATS_H
+#define	_ZSTREAM_PIPESTATS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "zstream_chain.h"
+#include "zstream_queue.h"
+
+/*
+ * Pipeline instrumentation, enabled by the -S option of chain-based
+ * subcommands. When CA_PIPELINE_STATS is set, zstream_chain_exec() keeps a
+ * step_stats_t for each step of the chain and reports on them when the
+ * chain finishes. With CA_PIPELINE_STATS_JSON, a JSON report is also
+ * written to standard error once per second while the chain runs.
+ *
+ * ps_items and ps_bytes count the items (and their header and payload
+ * bytes) presented to a step, or produced by it in the case of the step
+ * that reads the stream. ps_busy_ns is the time that a serial step spent
+ * in its processing function. Parallel steps report through ps_queue.
+ */
+typedef struct {
+	uint64_t		ps_items;
+	uint64_t		ps_bytes;
+	uint64_t		ps_busy_ns;
+	zq_queue_stats_t	ps_queue;
+} step_stats_t;
+
+/*
+ * Handle the -S command line option. Repeating it selects JSON output.
+ */
+void
+pipestats_option(chain_attrs_t *attrs);
+
+/*
+ * Called by the chain mechanism. Storage for the chain and the stats array
+ * must remain valid until pipestats_finish() returns.
+ */
+void
+pipestats_start(chain_step_t *chain, int num_steps, step_stats_t *stats);
+
+void
+pipestats_count(step_stats_t *stats, const void *item);
+
+void
+pipestats_finish(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _ZSTREAM_PIPESTATS_H */
@@ -27,6 +27,7 @@
 #include <sys/random.h>
 #include <sys/stdtypes.h>
 #include <sys/sysmacros.h>
+#include <sys/time.h>
 #include <unistd.h>
 
 #include "zstream_queue.h"
@@ -36,6 +37,7 @@
 #define	MAX_QUEUES 	16	/* Largest # of queues simultaneously active */
 
 #define	PLENTY_OF_WORK		6	/* "Many" items to claim */
+#define	REBALANCE_INTERVAL	16	/* Affine batches between rescoring */
 #define	NO_WORK			0.0001	/* No-work score threshold */
 #define	DEQUEUE_SCORE_WEIGHT	0.3	/* Dequeue score relative weight */
 
@@ -90,6 +92,24 @@
  * locking order is used to avoid deadlocks:
  *
  *   enqueue -> pool -> queue
+ *
+ * AFFINE SCHEDULING
+ *
+ * With ZQ_SCHED_AFFINE, a worker that obtains work through the scoring
+ * process attaches itself to that queue and keeps claiming batches from it
+ * while holding only the queue's own mutex. On a machine with many cores,
+ * this keeps most claims off the enqueue and pool mutexes, which every
+ * worker would otherwise acquire for every batch. The worker detaches and
+ * returns to scoring when its queue has no claimable work or after
+ * REBALANCE_INTERVAL consecutive batches, so threads still migrate to
+ * whichever queue needs them. The ring buffer continues to ensure in-order
+ * completion regardless of which thread processes an item.
+ *
+ * A queue cannot be destroyed while workers are attached to it. Attached
+ * workers detach as soon as they find the queue empty, which is
+ * guaranteed to happen once its end-of-stream marker has been enqueued.
+ * zstream_queue_destroy() waits on the "detached" condition until the
+ * count of attached workers drops to zero.
  */
 
 typedef struct {
@@ -109,6 +129,7 @@ typedef struct {
 typedef struct {
 	pthread_cond_t	completed;
 	pthread_cond_t	dequeued;
+	pthread_cond_t	detached;
 } zq_conditions_t;
 
 typedef struct {
@@ -123,9 +144,25 @@ struct zstream_queue {
 	zq_conditions_t	zq_cond;
 	zq_params_t	zq_params;
 	zq_stats_t	zq_stats;
+	zq_queue_stats_t zq_own_stats;	/* If the caller supplies none */
 	boolean_t	zq_disallow_enqueue;
+	int		zq_attached;	/* Affine workers; see above */
 };
 
+/*
+ * Per-worker state. Counters are written only by the owning worker and
+ * are read without synchronization, so totals are approximate while
+ * queues are active. Padded to avoid false sharing between workers.
+ */
+typedef struct {
+	zstream_queue_t	*w_home;
+	int		w_home_batches;
+	uint64_t	w_local_batches;
+	uint64_t	w_scored_batches;
+	uint64_t	w_items;
+	uint64_t	w_idle_waits;
+} __attribute__((aligned(64))) queue_worker_t;
+
 typedef struct {
 	pthread_mutex_t	tp_pool_mutex;
 	pthread_mutex_t tp_enqueue_mutex;
@@ -134,6 +171,8 @@ typedef struct {
 	int		tp_num_queues;
 	boolean_t	tp_threads_created;
 	int		tp_num_threads;
+	zq_scheduler_t	tp_scheduler;
+	queue_worker_t	*tp_workers;
 } thread_pool_t;
 
 typedef union {
@@ -186,6 +225,55 @@ zstream_queue_set_num_threads(uint_t n)
 	pthread_mutex_unlock(&pool.tp_pool_mutex);
 }
 
+/*
+ * As with zstream_queue_set_num_threads(), this must be called before any
+ * queues have been created.
+ */
+void
+zstream_queue_set_scheduler(zq_scheduler_t scheduler)
+{
+	pthread_once(&once_control, thread_pool_init);
+	pthread_mutex_lock(&pool.tp_pool_mutex);
+	if (pool.tp_threads_created)
+		errx(1, "scheduler must be set before creating queues");
+	pool.tp_scheduler = scheduler;
+	pthread_mutex_unlock(&pool.tp_pool_mutex);
+}
+
+void
+zstream_queue_get_stats(zq_pool_stats_t *stats)
+{
+	*stats = (zq_pool_stats_t) {0};
+
+	pthread_once(&once_control, thread_pool_init);
+	pthread_mutex_lock(&pool.tp_pool_mutex);
+	stats->zps_num_threads = pool.tp_threads_created ?
+	    pool.tp_num_threads : 0;
+	for (int i = 0; i < stats->zps_num_threads; i++) {
+		queue_worker_t *w = &pool.tp_workers[i];
+		stats->zps_local_batches += w->w_local_batches;
+		stats->zps_scored_batches += w->w_scored_batches;
+		stats->zps_items += w->w_items;
+		stats->zps_idle_waits += w->w_idle_waits;
+	}
+	pthread_mutex_unlock(&pool.tp_pool_mutex);
+}
+
+void
+zstream_queue_print_stats(FILE *fp)
+{
+	zq_pool_stats_t stats;
+
+	zstream_queue_get_stats(&stats);
+	uint64_t batches = stats.zps_local_batches + stats.zps_scored_batches;
+	(void) fprintf(fp, "queue: %u threads, %llu items in %llu batches "
+	    "(%llu local, %llu scored), %llu idle waits\n",
+	    stats.zps_num_threads, (u_longlong_t)stats.zps_items,
+	    (u_longlong_t)batches, (u_longlong_t)stats.zps_local_batches,
+	    (u_longlong_t)stats.zps_scored_batches,
+	    (u_longlong_t)stats.zps_idle_waits);
+}
+
 /*
  * Locking: the caller must hold the pool mutex.
  *
@@ -209,10 +297,13 @@ thread_pool_spinup(void)
 #endif
 		pool.tp_num_threads = MAX(pool.tp_num_threads, MIN_THREADS);
 	}
+	pool.tp_workers = safe_calloc(pool.tp_num_threads *
+	    sizeof (queue_worker_t));
 	for (int i = 0; i < pool.tp_num_threads; i++) {
 		char name[32];
 		snprintf(name, sizeof (name), "queue-%d", i);
-		safe_create_thread(queue_worker, NULL, name, B_TRUE);
+		safe_create_thread(queue_worker, &pool.tp_workers[i], name,
+		    B_TRUE);
 	}
 #ifdef MONITOR_QUEUES
 	safe_create_thread(cpu_and_queue_monitor, NULL, "monitor", B_TRUE);
@@ -243,6 +334,8 @@ zstream_queue_create(zq_params_t *params)
 		.zq_slots = safe_malloc(params->qp_queue_length *
 		    (sizeof (queue_slot_t)))
 	};
+	if (queue->zq_params.qp_stats == NULL)
+		queue->zq_params.qp_stats = &queue->zq_own_stats;
 
 	size_t qpis_rounded = P2ROUNDUP(params->qp_item_size,
 	    _Alignof(worst_case_alignment_t));
@@ -255,6 +348,7 @@ zstream_queue_create(zq_params_t *params)
 	pthread_mutex_init(&queue->zq_mutex, NULL);
 	pthread_cond_init(&queue->zq_cond.completed, NULL);
 	pthread_cond_init(&queue->zq_cond.dequeued, NULL);
+	pthread_cond_init(&queue->zq_cond.detached, NULL);
 
 	pool.tp_num_queues++;
 	pthread_mutex_unlock(&pool.tp_pool_mutex);
@@ -468,7 +562,8 @@ claim_batch(zstream_queue_t *queue, queue_slot_t **batch)
  * If everyone follows that order, deadlocks should not occur.
  */
 static int
-assign_queue_and_get_work(zstream_queue_t **queue, queue_slot_t **batch)
+assign_queue_and_get_work(queue_worker_t *worker, zstream_queue_t **queue,
+    queue_slot_t **batch)
 {
 	pthread_mutex_lock(&pool.tp_enqueue_mutex);
 	pthread_mutex_lock(&pool.tp_pool_mutex);
@@ -487,6 +582,7 @@ assign_queue_and_get_work(zstream_queue_t **queue, queue_slot_t **batch)
 				queues_with_work++;
 		}
 		if (!queues_with_work) {
+			worker->w_idle_waits++;
 			pthread_mutex_unlock(&pool.tp_pool_mutex);
 			pthread_cond_wait(&pool.tp_enqueued,
 			    &pool.tp_enqueue_mutex);
@@ -502,6 +598,11 @@ assign_queue_and_get_work(zstream_queue_t **queue, queue_slot_t **batch)
 			 */
 			boolean_t more_here = (*queue)->zq_ix.claim <
 			    (*queue)->zq_ix.enqueue;
+			if (count > 0 && pool.tp_scheduler == ZQ_SCHED_AFFINE) {
+				(*queue)->zq_attached++;
+				worker->w_home = *queue;
+				worker->w_home_batches = 0;
+			}
 			pthread_mutex_unlock(&(*queue)->zq_mutex);
 			if (more_here || queues_with_work > 1) {
 				pthread_cond_signal(&pool.tp_enqueued);
@@ -513,19 +614,57 @@ assign_queue_and_get_work(zstream_queue_t **queue, queue_slot_t **batch)
 	}
 }
 
+/*
+ * The affine fast path: claim more work from the queue this worker is
+ * attached to, holding only that queue's mutex. Returns 0 and detaches if
+ * the queue has nothing to claim or it's time to rebalance.
+ *
+ * Locking: the caller must hold no locks. Attachment guarantees that the
+ * queue still exists. After detaching, the queue must not be touched.
+ */
+static int
+get_home_work(queue_worker_t *worker, queue_slot_t **batch)
+{
+	zstream_queue_t *queue = worker->w_home;
+	int count = 0;
+
+	pthread_mutex_lock(&queue->zq_mutex);
+	if (worker->w_home_batches++ < REBALANCE_INTERVAL)
+		count = claim_batch(queue, batch);
+	if (count == 0) {
+		worker->w_home = NULL;
+		if (--queue->zq_attached == 0)
+			pthread_cond_signal(&queue->zq_cond.detached);
+	}
+	pthread_mutex_unlock(&queue->zq_mutex);
+	return (count);
+}
+
 static uint64_t items_in_claimed_state = 0;  /* Used for tuning/debugging */
 
 static void *
-queue_worker(void *dummy)
+queue_worker(void *arg)
 {
-	(void) dummy;
+	queue_worker_t *worker = arg;
 	zstream_queue_t *queue;
 	queue_slot_t *batch[MAX_BATCH];
-	int count;
+	int count = 0;
 
 	while (B_TRUE) {
-		count = assign_queue_and_get_work(&queue, batch);
+		if (worker->w_home != NULL) {
+			queue = worker->w_home;
+			count = get_home_work(worker, batch);
+			if (count)
+				worker->w_local_batches++;
+		}
+		if (count == 0) {
+			count = assign_queue_and_get_work(worker, &queue,
+			    batch);
+			if (count)
+				worker->w_scored_batches++;
+		}
 		if (count) {
+			worker->w_items += count;
 			zq_process_item_f *process =
 			    queue->zq_params.qp_process;
 			void *context = queue->zq_params.qp_context;
@@ -537,16 +676,21 @@ queue_worker(void *dummy)
 			 * because that creates a race condition with
 			 * advance_indexes().
 			 */
+			hrtime_t start = gethrtime();
 			for (int i = 0; i < count; i++) {
 				process(batch[i]->qs_item, context);
 			}
+			hrtime_t busy = gethrtime() - start;
 			pthread_mutex_lock(&queue->zq_mutex);
 			for (int i = 0; i < count; i++) {
 				batch[i]->qs_completed = B_TRUE;
 			}
+			queue->zq_params.qp_stats->zqs_processed += count;
+			queue->zq_params.qp_stats->zqs_busy_ns += busy;
 			advance_indexes(queue);
 			atomic_sub_64(&items_in_claimed_state, count);
 			pthread_mutex_unlock(&queue->zq_mutex);
+			count = 0;
 		}
 	}
 	return (NULL);
@@ -562,8 +706,14 @@ zstream_enqueue(zstream_queue_t *queue, queue_item_t *item)
 	pthread_mutex_lock(&queue->zq_mutex);
 	VERIFY3B(queue->zq_disallow_enqueue, ==, B_FALSE);
 
-	while (Q_FULL(queue)) {
-		pthread_cond_wait(&queue->zq_cond.dequeued, &queue->zq_mutex);
+	zq_queue_stats_t *stats = queue->zq_params.qp_stats;
+	if (Q_FULL(queue)) {
+		hrtime_t start = gethrtime();
+		while (Q_FULL(queue)) {
+			pthread_cond_wait(&queue->zq_cond.dequeued,
+			    &queue->zq_mutex);
+		}
+		stats->zqs_producer_wait_ns += gethrtime() - start;
 	}
 
 	queue_slot_t *slot = &Q_SLOT(queue, queue->zq_ix.enqueue);
@@ -573,6 +723,9 @@ zstream_enqueue(zstream_queue_t *queue, queue_item_t *item)
 		slot->qs_completed = slot->qs_cost == 0;
 		slot->qs_end_of_stream = B_FALSE;
 		memcpy(slot->qs_item, item, queue->zq_params.qp_item_size);
+		stats->zqs_enqueued++;
+		stats->zqs_depth_total +=
+		    queue->zq_ix.enqueue - queue->zq_ix.dequeue;
 	} else {
 		slot->qs_cost = 0;
 		slot->qs_completed = B_TRUE;
@@ -608,15 +761,23 @@ zstream_queue_fini(zstream_queue_t *queue) {
  * processed, and then dequeue all items.
  *
  * Locking: the caller must NOT hold the queue lock. The pool mutex is
- * held while destroying the queue.
+ * held while destroying the queue, but only after all affine workers have
+ * detached.
  */
 static void
 zstream_queue_destroy(zstream_queue_t *queue)
 {
+	pthread_mutex_lock(&queue->zq_mutex);
+	while (queue->zq_attached > 0) {
+		pthread_cond_wait(&queue->zq_cond.detached, &queue->zq_mutex);
+	}
+	pthread_mutex_unlock(&queue->zq_mutex);
+
 	pthread_mutex_lock(&pool.tp_pool_mutex);
 
 	pthread_mutex_destroy(&queue->zq_mutex);
 	pthread_cond_destroy(&queue->zq_cond.dequeued);
+	pthread_cond_destroy(&queue->zq_cond.detached);
 
 	if (pthread_cond_destroy(&queue->zq_cond.completed) != 0) {
 		errx(1, "cannot destroy zstream_queue completed condition - "
@@ -656,8 +817,14 @@ boolean_t
 zstream_dequeue(zstream_queue_t *queue, queue_item_t *item)
 {
 	pthread_mutex_lock(&queue->zq_mutex);
-	while (queue->zq_ix.dequeue >= queue->zq_ix.complete) {
-		pthread_cond_wait(&queue->zq_cond.completed, &queue->zq_mutex);
+	if (queue->zq_ix.dequeue >= queue->zq_ix.complete) {
+		hrtime_t start = gethrtime();
+		while (queue->zq_ix.dequeue >= queue->zq_ix.complete) {
+			pthread_cond_wait(&queue->zq_cond.completed,
+			    &queue->zq_mutex);
+		}
+		queue->zq_params.qp_stats->zqs_consumer_wait_ns +=
+		    gethrtime() - start;
 	}
 	queue_slot_t *slot = &Q_SLOT(queue, queue->zq_ix.dequeue);
 	queue->zq_ix.dequeue++;
@@ -22,6 +22,7 @@ extern "C" {
 #endif
 
 #include <stddef.h>
+#include <stdio.h>
 #include <sys/stdtypes.h>
 
 /*
@@ -87,9 +88,64 @@ zq_process_item_f(queue_item_t *item, void *context);
 void
 zstream_queue_set_num_threads(uint_t num_threads);
 
+/*
+ * Select how worker threads find work. ZQ_SCHED_SHARED (the default)
+ * rescores every queue for each batch. ZQ_SCHED_AFFINE lets a worker keep
+ * claiming from the queue it last worked on without taking any global
+ * locks, rescoring only when that queue runs dry or periodically to
+ * rebalance. This reduces lock contention on machines with many cores.
+ * Must be set before any queues are created.
+ */
+typedef enum {
+	ZQ_SCHED_SHARED,
+	ZQ_SCHED_AFFINE
+} zq_scheduler_t;
+
+void
+zstream_queue_set_scheduler(zq_scheduler_t scheduler);
+
+/*
+ * Scaling counters for the shared thread pool, summed over all workers.
+ * Batches are counted according to how they were obtained: from an
+ * attached queue without global locks (local), or through queue scoring.
+ * Idle waits count the times a worker found no work on any queue.
+ */
+typedef struct {
+	uint_t		zps_num_threads;
+	uint64_t	zps_local_batches;
+	uint64_t	zps_scored_batches;
+	uint64_t	zps_items;
+	uint64_t	zps_idle_waits;
+} zq_pool_stats_t;
+
+void
+zstream_queue_get_stats(zq_pool_stats_t *stats);
+
+void
+zstream_queue_print_stats(FILE *fp);
+
+/*
+ * Per-queue activity counters. Producer and consumer waits are the times
+ * that zstream_enqueue() spent blocked on a full queue and that
+ * zstream_dequeue() spent awaiting the completion of the next item. The
+ * mean queue depth is zqs_depth_total / zqs_enqueued, as seen by arriving
+ * items. Counters are updated under the queue lock, but they may be read
+ * without it to produce approximate progress reports.
+ */
+typedef struct {
+	uint64_t	zqs_enqueued;
+	uint64_t	zqs_processed;
+	uint64_t	zqs_busy_ns;
+	uint64_t	zqs_depth_total;
+	uint64_t	zqs_producer_wait_ns;
+	uint64_t	zqs_consumer_wait_ns;
+} zq_queue_stats_t;
+
 /*
  * Create a queue. The qp_context field is passed to the cost and processing
- * functions and is not examined by the queue itself.
+ * functions and is not examined by the queue itself. If qp_stats is not
+ * NULL, the queue accumulates its counters there. That storage must
+ * remain valid until the queue has been destroyed.
  */
 
 typedef struct {
@@ -99,6 +155,7 @@ typedef struct {
 	size_t			qp_item_size;
 	size_t			qp_batch_budget;
 	size_t			qp_queue_length;
+	zq_queue_stats_t	*qp_stats;
 } zq_params_t;
 
 zstream_queue_t *
@@ -34,6 +34,7 @@
 #include <linux/falloc.h>
 #include <linux/fs.h>
 #endif
+#include <pthread.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -79,8 +80,39 @@ typedef struct {
 		size_t		length;
 		int		iovcnt;
 	} buffer;
+	struct raw_free {
+		off_t		offset;
+		size_t		length;
+		boolean_t	pending;
+	} free;
+	struct raw_writer {
+		pthread_mutex_t	lock;
+		pthread_cond_t	submitted;
+		pthread_cond_t	retired;
+		struct raw_extent *ring;
+		pthread_t	*threads;
+		int		nthreads;
+		int		depth;
+		uint64_t	head;		/* Next extent to submit */
+		uint64_t	claim;		/* Next extent to write */
+		uint64_t	tail;		/* Oldest unretired extent */
+		boolean_t	exiting;
+	} writer;
 } raw_context_t;
 
+/*
+ * A coalesced run of buffers to be written at one offset. With -q, extents
+ * are handed to a pool of writer threads so that several can be in flight
+ * at once. Each ring slot owns an iovec array of limits.buffers_max entries.
+ */
+typedef struct raw_extent {
+	struct iovec	*iov;
+	int		iovcnt;
+	off_t		offset;
+	size_t		length;
+	boolean_t	done;
+} raw_extent_t;
+
 static void
 write_zeros(raw_context_t *context, off_t offset, size_t length)
 {
@@ -113,6 +145,189 @@ write_zeros(raw_context_t *context, off_t offset, size_t length)
 	ASSERT0(resid);
 }
 
+/*
+ * Write an extent and free its buffers.
+ */
+static void
+write_extent(int fd, raw_extent_t *extent)
+{
+	ssize_t res = pwritev(fd, extent->iov, extent->iovcnt, extent->offset);
+	if (res < 0)
+		err(EXIT_FAILURE, "pwritev");
+	VERIFY3U(res, ==, extent->length);
+	for (int i = 0; i < extent->iovcnt; i++) {
+		free(extent->iov[i].iov_base);
+		extent->iov[i].iov_base = NULL;
+	}
+	extent->iovcnt = 0;
+}
+
+/*
+ * Body of writer threads. Extents may complete in any order; the
+ * submitter prevents overlapping extents from being in flight together.
+ */
+static void *
+raw_writer(void *arg)
+{
+	raw_context_t *context = arg;
+	struct raw_writer *writer = &context->writer;
+
+	pthread_mutex_lock(&writer->lock);
+	while (B_TRUE) {
+		while (writer->claim == writer->head && !writer->exiting)
+			pthread_cond_wait(&writer->submitted, &writer->lock);
+		if (writer->claim == writer->head)
+			break;
+		raw_extent_t *extent =
+		    &writer->ring[writer->claim++ % writer->depth];
+		pthread_mutex_unlock(&writer->lock);
+
+		write_extent(context->volume.fd, extent);
+
+		pthread_mutex_lock(&writer->lock);
+		extent->done = B_TRUE;
+		while (writer->tail < writer->head &&
+		    writer->ring[writer->tail % writer->depth].done)
+			writer->tail++;
+		pthread_cond_broadcast(&writer->retired);
+	}
+	pthread_mutex_unlock(&writer->lock);
+	return (NULL);
+}
+
+static void
+writer_init(raw_context_t *context, int depth)
+{
+	struct raw_writer *writer = &context->writer;
+
+	writer->depth = depth;
+	writer->nthreads = depth;
+	writer->ring = safe_calloc(depth * sizeof (raw_extent_t));
+	for (int i = 0; i < depth; i++) {
+		writer->ring[i].iov = safe_calloc(
+		    context->limits.buffers_max * sizeof (struct iovec));
+	}
+	pthread_mutex_init(&writer->lock, NULL);
+	pthread_cond_init(&writer->submitted, NULL);
+	pthread_cond_init(&writer->retired, NULL);
+	writer->threads = safe_calloc(depth * sizeof (pthread_t));
+	for (int i = 0; i < depth; i++) {
+		char name[32];
+		snprintf(name, sizeof (name), "raw-writer-%d", i);
+		writer->threads[i] = safe_create_thread(raw_writer, context,
+		    name, B_FALSE);
+	}
+}
+
+/*
+ * Wait until no writes are in flight.
+ */
+static void
+writer_drain(raw_context_t *context)
+{
+	struct raw_writer *writer = &context->writer;
+
+	if (writer->nthreads == 0)
+		return;
+	pthread_mutex_lock(&writer->lock);
+	while (writer->tail < writer->head)
+		pthread_cond_wait(&writer->retired, &writer->lock);
+	pthread_mutex_unlock(&writer->lock);
+}
+
+static void
+writer_fini(raw_context_t *context)
+{
+	struct raw_writer *writer = &context->writer;
+
+	if (writer->nthreads == 0)
+		return;
+	pthread_mutex_lock(&writer->lock);
+	writer->exiting = B_TRUE;
+	pthread_cond_broadcast(&writer->submitted);
+	pthread_mutex_unlock(&writer->lock);
+	for (int i = 0; i < writer->nthreads; i++)
+		VERIFY0(pthread_join(writer->threads[i], NULL));
+	for (int i = 0; i < writer->depth; i++)
+		free(writer->ring[i].iov);
+	free(writer->ring);
+	free(writer->threads);
+	pthread_cond_destroy(&writer->retired);
+	pthread_cond_destroy(&writer->submitted);
+	pthread_mutex_destroy(&writer->lock);
+}
+
+static boolean_t
+writer_overlaps(struct raw_writer *writer, off_t offset, size_t length)
+{
+	for (uint64_t i = writer->tail; i < writer->head; i++) {
+		raw_extent_t *extent = &writer->ring[i % writer->depth];
+		if (!extent->done && offset < extent->offset + extent->length &&
+		    extent->offset < offset + length)
+			return (B_TRUE);
+	}
+	return (B_FALSE);
+}
+
+/*
+ * Issue the coalesced buffer vector, either directly or through the writer
+ * threads. A later write to a range that is still in flight waits for it,
+ * so the last write to any block always wins.
+ */
+static void
+issue_buffer(raw_context_t *context)
+{
+	struct raw_buffer *buffer = &context->buffer;
+	struct raw_writer *writer = &context->writer;
+	raw_extent_t *extent;
+
+	ASSERT3U(buffer->iovcnt, >, 0);
+	if (writer->nthreads == 0) {
+		raw_extent_t direct = {
+			.iov = buffer->iov,
+			.iovcnt = buffer->iovcnt,
+			.offset = buffer->position,
+			.length = buffer->length
+		};
+		write_extent(context->volume.fd, &direct);
+	} else {
+		pthread_mutex_lock(&writer->lock);
+		while (writer->head - writer->tail == writer->depth ||
+		    writer_overlaps(writer, buffer->position, buffer->length))
+			pthread_cond_wait(&writer->retired, &writer->lock);
+		extent = &writer->ring[writer->head % writer->depth];
+		memcpy(extent->iov, buffer->iov,
+		    buffer->iovcnt * sizeof (struct iovec));
+		extent->iovcnt = buffer->iovcnt;
+		extent->offset = buffer->position;
+		extent->length = buffer->length;
+		extent->done = B_FALSE;
+		writer->head++;
+		pthread_cond_signal(&writer->submitted);
+		pthread_mutex_unlock(&writer->lock);
+	}
+	buffer->length = 0;
+	buffer->iovcnt = 0;
+}
+
+static void
+free_range(raw_context_t *context, off_t offset, size_t length);
+
+/*
+ * Issue any batched FREE. Writes and other frees must have been issued and
+ * retired first, since the free must not be reordered around them.
+ */
+static void
+flush_free(raw_context_t *context)
+{
+	struct raw_free *pending = &context->free;
+
+	if (!pending->pending)
+		return;
+	pending->pending = B_FALSE;
+	free_range(context, pending->offset, pending->length);
+}
+
 /*
  * buffer_write - pwrite with buffer vectoring and error handling
  *
@@ -126,24 +341,14 @@ buffer_write(raw_context_t *context, void *buf, size_t nbytes, off_t offset)
 	struct raw_buffer *buffer = &context->buffer;
 	struct iovec *iov = buffer->iov;
 
+	flush_free(context);
 	if (buffer->iovcnt == 0)
 		buffer->position = offset;
 	else if (buffer->position + buffer->length != offset ||
 	    buffer->iovcnt == limits->buffers_max) {
 		ASSERT3U(offset + nbytes, >=, offset);
-		ASSERT3U(buffer->iovcnt, >, 0);
-		ssize_t res = pwritev(context->volume.fd, iov, buffer->iovcnt,
-		    buffer->position);
-		if (res < 0)
-			err(EXIT_FAILURE, "pwritev");
-		VERIFY3U(res, ==, buffer->length);
+		issue_buffer(context);
 		buffer->position = offset;
-		buffer->length = 0;
-		for (int i = 0; i < buffer->iovcnt; i++) {
-			free(iov[i].iov_base);
-			iov[i].iov_base = NULL;
-		}
-		buffer->iovcnt = 0;
 	}
 	if (buf == NULL) {
 		/* Sentinel buf for flush. */
@@ -156,10 +361,45 @@ buffer_write(raw_context_t *context, void *buf, size_t nbytes, off_t offset)
 	buffer->iovcnt++;
 }
 
+/*
+ * Issue all pending writes and wait for them to complete.
+ */
+static void
+buffer_sync(raw_context_t *context)
+{
+	if (context->buffer.iovcnt > 0)
+		issue_buffer(context);
+	writer_drain(context);
+}
+
+/*
+ * Contiguous FREE records are merged and issued as one operation, after
+ * all preceding writes have completed.
+ */
+static void
+batch_free(raw_context_t *context, off_t offset, size_t length)
+{
+	struct raw_free *pending = &context->free;
+
+	buffer_sync(context);
+	if (pending->pending && length != (size_t)-1 &&
+	    pending->length != (size_t)-1 &&
+	    pending->offset + pending->length == offset) {
+		pending->length += length;
+		return;
+	}
+	flush_free(context);
+	pending->offset = offset;
+	pending->length = length;
+	pending->pending = B_TRUE;
+}
+
 static inline void
 buffer_finish(raw_context_t *context)
 {
-	buffer_write(context, NULL, 0, 0);
+	buffer_sync(context);
+	flush_free(context);
+	writer_fini(context);
 	if (fsync(context->volume.fd) != 0)
 		err(EXIT_FAILURE, "fsync");
 }
@@ -275,6 +515,10 @@ apply_properties(raw_context_t *context, void *buf, size_t len)
 
 	ASSERT(context->volume.isreg);
 	ASSERT3U(len, >=, sizeof (*mzap));
+
+	/* Don't resize under writes in flight or reorder a batched FREE */
+	writer_drain(context);
+	flush_free(context);
 	ASSERT3U(MZAP_ENT_LEN, ==, sizeof (mzap_ent_phys_t));
 
 	if (mzap->mz_block_type == BSWAP_64(ZBT_MICRO))
@@ -355,7 +599,7 @@ chain_replay_raw(void *item_in, void *context_in)
 			break;
 
 		struct drr_free *drrf = &drr->drr_u.drr_free;
-		free_range(context, drrf->drr_offset, drrf->drr_length);
+		batch_free(context, drrf->drr_offset, drrf->drr_length);
 		break;
 	}
 	case DRR_WRITE_EMBEDDED: {
@@ -401,18 +645,20 @@ chain_replay_raw(void *item_in, void *context_in)
 
 /* Keep this small enough to not accidentally run systems out of memory. */
 #define	BUFFERS_MAX_DEFAULT 32
+#define	QUEUE_DEPTH_MAX 256
 
 int
 zstream_do_raw(int argc, char *argv[])
 {
 	raw_context_t context = { 0 };
 	context.limits.buffers_max = BUFFERS_MAX_DEFAULT;
+	long depth = 1;
 
 	chain_attrs_t attrs = { 0 };
 	ENABLE_OPTION(&attrs, CA_FORBID_DEDUP);
 
 	int c;
-	while ((c = getopt(argc, argv, ":b:g:v")) != -1) {
+	while ((c = getopt(argc, argv, ":b:g:q:Sv")) != -1) {
 		switch (c) {
 		case 'b':
 			context.limits.buffers_max = strtol(optarg, NULL, 0);
@@ -428,11 +674,21 @@ zstream_do_raw(int argc, char *argv[])
 				zstream_usage();
 			}
 			break;
+		case 'q':
+			depth = strtol(optarg, NULL, 0);
+			if (depth <= 0 || depth > QUEUE_DEPTH_MAX) {
+				warnx("invalid queue depth");
+				zstream_usage();
+			}
+			break;
 		case 'v':
 			ENABLE_OPTION(&attrs, CA_VERBOSE);
 			ENABLE_OPTION(&attrs, CA_DUMP_ALL_RECORDS);
 			ENABLE_OPTION(&attrs, CA_DUMP_CHECKSUMS);
 			break;
+		case 'S':
+			pipestats_option(&attrs);
+			break;
 		case ':':
 			warnx("missing argument for '%c' option", optopt);
 			zstream_usage();
@@ -489,6 +745,9 @@ zstream_do_raw(int argc, char *argv[])
 	for (int i = 0; i < iov_max; i++)
 		context.zeros.iov[i].iov_base = zero_page;
 
+	if (depth > 1)
+		writer_init(&context, depth);
+
 	uint32_t drop_mask = DROP_END | DROP_FREEOBJECTS | DROP_OBJECT_RANGE |
 	    DROP_REDACT | DROP_SPILL;
 	zstream_chain_t raw_chain = {
@@ -498,6 +757,7 @@ zstream_do_raw(int argc, char *argv[])
 		parallel_decompress_writes(NULL),
 		{
 			.cs_type = CS_SERIAL,
+			.cs_name = "replay_raw",
 			.cs_in_size = sizeof (drr_packet_t),
 			.cs_out_size = sizeof (drr_packet_t),
 			.cs_context = &context,
@@ -25,12 +25,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <atomic.h>
 #include <sys/dmu.h>
+#include <sys/fs/zfs.h>
 #include <sys/zfs_ioctl.h>
 #include <sys/zio_compress.h>
+#include <sys/zio.h>
 #include <sys/zstd/zstd.h>
 #include <unistd.h>
 #include <sys/stdtypes.h>
+#include <zfs_prop.h>
 
 #include "zstream.h"
 #include "zstream_chain.h"
@@ -182,6 +186,58 @@ chain_compress_writes(queue_item_t *item_in, void *context_in)
 	}
 }
 
+/*
+ * Trial each candidate in order and keep the smallest result. A candidate
+ * that appears later in the list must beat the best result so far by at
+ * least as_min_gain_pct percent to displace it, so lists ordered from
+ * cheapest to most expensive to decompress favor the cheaper algorithms
+ * when the difference is marginal.
+ */
+static void
+chain_compress_adaptive(queue_item_t *item_in, void *context_in)
+{
+	drr_packet_t *item = (drr_packet_t *)item_in;
+	adaptive_spec_t *context = (adaptive_spec_t *)context_in;
+
+	struct drr_write *drrw = &item->dp_drr.drr_u.drr_write;
+	uint8_t *best = NULL;
+	size_t best_size = item->dp_payload_size;
+	int best_ix = context->as_num_candidates;
+
+	VERIFY3U(item->dp_drr.drr_type, ==, DRR_WRITE);
+	VERIFY3B(ctype_is_uncompressed(drrw->drr_compressiontype), ==, B_TRUE);
+
+	for (int i = 0; i < context->as_num_candidates; i++) {
+		size_t csize;
+		uint8_t *cbuff = compress_buffer(item->dp_payload,
+		    item->dp_payload_size, context->as_candidates[i], &csize);
+		if (cbuff == NULL)
+			continue;
+		if (best == NULL || csize * 100 <=
+		    best_size * (100 - context->as_min_gain_pct)) {
+			free(best);
+			best = cbuff;
+			best_size = csize;
+			best_ix = i;
+		} else {
+			free(cbuff);
+		}
+	}
+
+	atomic_inc_64(&context->as_chosen[best_ix]);
+	if (best == NULL) {
+		drrw->drr_compressiontype = 0;
+		drrw->drr_compressed_size = 0;
+	} else {
+		free(item->dp_payload);
+		item->dp_payload = best;
+		item->dp_payload_size = best_size;
+		drrw->drr_compressed_size = best_size;
+		drrw->drr_compressiontype =
+		    context->as_candidates[best_ix].cs_type;
+	}
+}
+
 /*
  * A cost of zero waives processing for the current item. If we want to
  * process it, the cost will always be item->dp_payload_size. So in these
@@ -203,6 +259,19 @@ chain_compress_cost(queue_item_t *item_in, void *context_in)
 	return (needs_compression(item, context) ? drrw->drr_logical_size : 0);
 }
 
+/*
+ * Adaptive compression applies to the same records as fixed compression
+ * with any of its candidates, but does the work once per candidate.
+ */
+static size_t
+chain_compress_adaptive_cost(queue_item_t *item_in, void *context_in)
+{
+	adaptive_spec_t *context = (adaptive_spec_t *)context_in;
+
+	return (chain_compress_cost(item_in, &context->as_candidates[0]) *
+	    context->as_num_candidates);
+}
+
 /*
  * Don't decompress packets that aren't compressed. And don't decompress
  * them if their ultimate fate is to be recompressed using the compression
@@ -245,6 +314,7 @@ parallel_decompress_writes(compression_spec_t *target)
 	}
 	chain_step_t step = {
 	    .cs_type = CS_PARALLEL,
+	    .cs_name = "decompress_writes",
 	    .cs_in_size = sizeof (drr_packet_t),
 	    .cs_out_size = sizeof (drr_packet_t),
 	    .cs_context = context,
@@ -269,6 +339,7 @@ parallel_compress_writes(compression_spec_t *target)
 
 	chain_step_t step = {
 	    .cs_type = CS_PARALLEL,
+	    .cs_name = "compress_writes",
 	    .cs_in_size = sizeof (drr_packet_t),
 	    .cs_out_size = sizeof (drr_packet_t),
 	    .cs_context = context,
@@ -282,6 +353,31 @@ parallel_compress_writes(compression_spec_t *target)
 	return (step);
 }
 
+/*
+ * Storage for the target must remain valid during chain execution
+ */
+chain_step_t
+parallel_compress_adaptive(adaptive_spec_t *target)
+{
+	VERIFY3P(target, !=, NULL);
+	VERIFY3S(target->as_num_candidates, >, 0);
+
+	chain_step_t step = {
+	    .cs_type = CS_PARALLEL,
+	    .cs_name = "compress_adaptive",
+	    .cs_in_size = sizeof (drr_packet_t),
+	    .cs_out_size = sizeof (drr_packet_t),
+	    .cs_context = target,
+	    .cs_parallel = {
+		.queue_length = 1024,
+		.batch_budget = 32 * 1024,
+		.process = chain_compress_adaptive,
+		.cost = chain_compress_adaptive_cost
+	    }
+	};
+	return (step);
+}
+
 /*
  * Keep DRR_BEGIN feature flags consistent with the WRITE payloads we emit.
  * Compressed WRITEs require DMU_BACKUP_FEATURE_COMPRESSED (and LZ4/ZSTD as
@@ -290,23 +386,9 @@ parallel_compress_writes(compression_spec_t *target)
  * LZ4/ZSTD are cleared only when neither EMBED_DATA nor RAW remains, since
  * recompress does not rewrite those record types.
  */
-static disposition_t
-chain_update_compress_features(void *item_in, void *context_in)
+static uint64_t
+compress_feature_flags(uint64_t flags, compression_spec_t *spec)
 {
-	drr_packet_t *item = (drr_packet_t *)item_in;
-	compression_spec_t *spec = (compression_spec_t *)context_in;
-	struct drr_begin *drrb;
-	uint64_t flags;
-
-	if (item == NULL)
-		return (D_OK);
-
-	if (item->dp_drr.drr_type != DRR_BEGIN)
-		return (D_OK);
-
-	drrb = &item->dp_drr.drr_u.drr_begin;
-	flags = DMU_GET_FEATUREFLAGS(drrb->drr_versioninfo);
-
 	if (ctype_is_uncompressed(spec->cs_type)) {
 		if (!(flags & DMU_BACKUP_FEATURE_RAW))
 			flags &= ~DMU_BACKUP_FEATURE_COMPRESSED;
@@ -323,12 +405,59 @@ chain_update_compress_features(void *item_in, void *context_in)
 			flags |= DMU_BACKUP_FEATURE_LZ4;
 		}
 	}
+	return (flags);
+}
+
+static disposition_t
+chain_update_compress_features(void *item_in, void *context_in)
+{
+	drr_packet_t *item = (drr_packet_t *)item_in;
+	compression_spec_t *spec = (compression_spec_t *)context_in;
+	struct drr_begin *drrb;
+	uint64_t flags;
+
+	if (item == NULL)
+		return (D_OK);
+
+	if (item->dp_drr.drr_type != DRR_BEGIN)
+		return (D_OK);
+
+	drrb = &item->dp_drr.drr_u.drr_begin;
+	flags = DMU_GET_FEATUREFLAGS(drrb->drr_versioninfo);
+	DMU_SET_FEATUREFLAGS(drrb->drr_versioninfo,
+	    compress_feature_flags(flags, spec));
+	return (D_OK);
+}
+
+/*
+ * The DRR_BEGIN record precedes every WRITE, so the stream must advertise
+ * every algorithm that adaptive compression might choose.
+ */
+static disposition_t
+chain_update_adaptive_features(void *item_in, void *context_in)
+{
+	drr_packet_t *item = (drr_packet_t *)item_in;
+	adaptive_spec_t *target = (adaptive_spec_t *)context_in;
+	struct drr_begin *drrb;
+	uint64_t flags;
+
+	if (item == NULL)
+		return (D_OK);
+
+	if (item->dp_drr.drr_type != DRR_BEGIN)
+		return (D_OK);
 
+	drrb = &item->dp_drr.drr_u.drr_begin;
+	flags = DMU_GET_FEATUREFLAGS(drrb->drr_versioninfo);
+	for (int i = 0; i < target->as_num_candidates; i++) {
+		flags = compress_feature_flags(flags,
+		    &target->as_candidates[i]);
+	}
 	DMU_SET_FEATUREFLAGS(drrb->drr_versioninfo, flags);
 	return (D_OK);
 }
 
-static chain_step_t
+chain_step_t
 serial_update_compress_features(compression_spec_t *target)
 {
 	int this_spec = next_spec++ % MAX_COMPRESSION_STEPS;
@@ -339,6 +468,7 @@ serial_update_compress_features(compression_spec_t *target)
 
 	chain_step_t step = {
 	    .cs_type = CS_SERIAL,
+	    .cs_name = "update_compress_features",
 	    .cs_in_size = sizeof (drr_packet_t),
 	    .cs_out_size = sizeof (drr_packet_t),
 	    .cs_context = context,
@@ -349,17 +479,114 @@ serial_update_compress_features(compression_spec_t *target)
 	return (step);
 }
 
+chain_step_t
+serial_update_adaptive_features(adaptive_spec_t *target)
+{
+	VERIFY3P(target, !=, NULL);
+
+	chain_step_t step = {
+	    .cs_type = CS_SERIAL,
+	    .cs_name = "update_adaptive_features",
+	    .cs_in_size = sizeof (drr_packet_t),
+	    .cs_out_size = sizeof (drr_packet_t),
+	    .cs_context = target,
+	    .cs_serial = {
+		.process = chain_update_adaptive_features,
+	    }
+	};
+	return (step);
+}
+
+/*
+ * Names that carry a level, such as zstd-19 or zstd-fast-5, are looked up
+ * in the compression property's index table. An explicit level overrides
+ * the one implied by the name.
+ */
+compression_spec_t
+parse_compression_spec(const char *name, int level)
+{
+	compression_spec_t spec = { .cs_level = level };
+	if (strcmp(name, "off") == 0) {
+		spec.cs_type = ZIO_COMPRESS_OFF;
+	} else {
+		enum zio_compress ct;
+		uint64_t index;
+		for (ct = 0; ct < ZIO_COMPRESS_FUNCTIONS; ct++) {
+			const char *ci_name = zio_compress_table[ct].ci_name;
+			if (strcmp(name, ci_name) == 0)
+				break;
+		}
+		if (ct == ZIO_COMPRESS_FUNCTIONS) {
+			zfs_prop_init();
+			if (zfs_prop_string_to_index(ZFS_PROP_COMPRESSION,
+			    name, &index) == 0) {
+				uint8_t implied = ZIO_COMPRESS_LEVEL(index);
+				ct = ZIO_COMPRESS_ALGO(index);
+				if (level == ZIO_COMPLEVEL_DEFAULT)
+					spec.cs_level = implied;
+			}
+		}
+		if (ct >= ZIO_COMPRESS_FUNCTIONS || ctype_is_uncompressed(ct)) {
+			errx(2, "invalid compression type %s", name);
+		}
+		spec.cs_type = ct;
+	}
+	return (spec);
+}
+
+adaptive_spec_t
+parse_adaptive_spec(const char *names, int level, uint_t min_gain_pct)
+{
+	adaptive_spec_t target = { .as_min_gain_pct = min_gain_pct };
+	char *list = strdup(names);
+	char *saveptr = NULL;
+
+	if (list == NULL)
+		errx(1, "out of memory");
+	if (min_gain_pct >= 100)
+		errx(2, "minimum gain must be less than 100 percent");
+
+	for (char *name = strtok_r(list, ",", &saveptr); name != NULL;
+	    name = strtok_r(NULL, ",", &saveptr)) {
+		if (target.as_num_candidates == MAX_ADAPTIVE_CANDIDATES) {
+			errx(2, "at most %d compression types may be given",
+			    MAX_ADAPTIVE_CANDIDATES);
+		}
+		compression_spec_t spec = parse_compression_spec(name, level);
+		if (ctype_is_uncompressed(spec.cs_type)) {
+			errx(2, "compression type %s cannot be combined "
+			    "with others", name);
+		}
+		(void) strlcpy(target.as_names[target.as_num_candidates],
+		    name, sizeof (target.as_names[0]));
+		target.as_candidates[target.as_num_candidates++] = spec;
+	}
+	free(list);
+	if (target.as_num_candidates == 0)
+		errx(2, "invalid compression type %s", names);
+	return (target);
+}
+
 int
 zstream_do_recompress(int argc, char *argv[])
 {
 	int c;
 	int level = ZIO_COMPLEVEL_DEFAULT;
 	uint_t num_threads = 0;
+	uint_t min_gain_pct = 0;
+	boolean_t verbose = B_FALSE;
 
 	chain_attrs_t attrs = { .ca_command_opts = CA_FORBID_DEDUP };
 
-	while ((c = getopt(argc, argv, "t:l:")) != -1) {
+	while ((c = getopt(argc, argv, "g:t:l:Svw")) != -1) {
 		switch (c) {
+		case 'g':
+			if (sscanf(optarg, "%u", &min_gain_pct) != 1) {
+				warnx("failed to parse minimum gain '%s'",
+				    optarg);
+				zstream_usage();
+			}
+			break;
 		case 'l':
 			if (sscanf(optarg, "%d", &level) != 1) {
 				warnx("failed to parse level '%s'", optarg);
@@ -374,6 +601,15 @@ zstream_do_recompress(int argc, char *argv[])
 			}
 			zstream_queue_set_num_threads(num_threads);
 			break;
+		case 'v':
+			verbose = B_TRUE;
+			break;
+		case 'w':
+			zstream_queue_set_scheduler(ZQ_SCHED_AFFINE);
+			break;
+		case 'S':
+			pipestats_option(&attrs);
+			break;
 		case '?':
 			warnx("invalid option '%c'", optopt);
 			zstream_usage();
@@ -386,30 +622,50 @@ zstream_do_recompress(int argc, char *argv[])
 	if (argc != 1)
 		zstream_usage();
 
-	compression_spec_t spec = { .cs_level = level };
-	if (strcmp(argv[0], "off") == 0) {
-		spec.cs_type = ZIO_COMPRESS_OFF;
-	} else {
-		enum zio_compress ct;
-		for (ct = 0; ct < ZIO_COMPRESS_FUNCTIONS; ct++) {
-			const char *ci_name = zio_compress_table[ct].ci_name;
-			if (strcmp(argv[0], ci_name) == 0)
-				break;
-		}
-		if (ct == ZIO_COMPRESS_FUNCTIONS || ctype_is_uncompressed(ct)) {
-			errx(2, "invalid compression type %s", argv[0]);
-		}
-		spec.cs_type = ct;
+	if (strchr(argv[0], ',') == NULL) {
+		compression_spec_t spec = parse_compression_spec(argv[0],
+		    level);
+
+		zstream_chain_t recompress_chain = {
+			STANDARD_INPUT_STACK(NULL),
+			parallel_decompress_writes(&spec),
+			parallel_compress_writes(&spec),
+			serial_update_compress_features(&spec),
+			STANDARD_OUTPUT_STACK(NULL)
+		};
+
+		zstream_chain_exec(recompress_chain, &attrs);
+		if (verbose)
+			zstream_queue_print_stats(stderr);
+		return (0);
 	}
 
-	zstream_chain_t recompress_chain = {
+	/*
+	 * Adaptive mode. Every compressed WRITE is decompressed so that all
+	 * candidates compete on equal terms.
+	 */
+	adaptive_spec_t target = parse_adaptive_spec(argv[0], level,
+	    min_gain_pct);
+
+	zstream_chain_t adaptive_chain = {
 		STANDARD_INPUT_STACK(NULL),
-		parallel_decompress_writes(&spec),
-		parallel_compress_writes(&spec),
-		serial_update_compress_features(&spec),
+		parallel_decompress_writes(NULL),
+		parallel_compress_adaptive(&target),
+		serial_update_adaptive_features(&target),
 		STANDARD_OUTPUT_STACK(NULL)
 	};
 
-	zstream_chain_exec(recompress_chain, &attrs);
+	zstream_chain_exec(adaptive_chain, &attrs);
+
+	if (verbose) {
+		for (int i = 0; i < target.as_num_candidates; i++) {
+			fprintf(stderr, "%s: %llu records\n",
+			    target.as_names[i],
+			    (u_longlong_t)target.as_chosen[i]);
+		}
+		fprintf(stderr, "uncompressed: %llu records\n",
+		    (u_longlong_t)target.as_chosen[target.as_num_candidates]);
+		zstream_queue_print_stats(stderr);
+	}
 	return (0);
 }
@@ -24,12 +24,68 @@ extern "C" {
 #include "zstream_util.h"
 #include "zstream_io.h"
 
+/*
+ * Maximum number of candidates for adaptive compression
+ */
+#define	MAX_ADAPTIVE_CANDIDATES 16
+
+/*
+ * Adaptive compression trials each candidate on every eligible WRITE and
+ * keeps the smallest result. Candidates should be listed from least to
+ * most costly; a later candidate is chosen only if it improves on the
+ * best earlier result by at least as_min_gain_pct percent.
+ *
+ * as_chosen counts the records assigned to each candidate. The final slot
+ * counts records that no candidate could shrink.
+ */
+typedef struct {
+	compression_spec_t	as_candidates[MAX_ADAPTIVE_CANDIDATES];
+	char			as_names[MAX_ADAPTIVE_CANDIDATES][32];
+	int			as_num_candidates;
+	uint_t			as_min_gain_pct;
+	uint64_t		as_chosen[MAX_ADAPTIVE_CANDIDATES + 1];
+} adaptive_spec_t;
+
 chain_step_t
 parallel_decompress_writes(compression_spec_t *target);
 
 chain_step_t
 parallel_compress_writes(compression_spec_t *target);
 
+/*
+ * Expects input from parallel_decompress_writes(NULL). The target is used
+ * in place and must remain valid during chain execution.
+ */
+chain_step_t
+parallel_compress_adaptive(adaptive_spec_t *target);
+
+/*
+ * Update DRR_BEGIN feature flags to match the target compression. Place
+ * this step after parallel_compress_writes().
+ */
+chain_step_t
+serial_update_compress_features(compression_spec_t *target);
+
+/*
+ * As above, but enables features for every adaptive candidate
+ */
+chain_step_t
+serial_update_adaptive_features(adaptive_spec_t *target);
+
+/*
+ * Translate a compression property value such as "lz4" or "gzip-3" into a
+ * compression_spec_t. Exits on invalid input.
+ */
+compression_spec_t
+parse_compression_spec(const char *name, int level);
+
+/*
+ * Parse a comma-separated list of compression types for adaptive
+ * compression. The level applies to any type whose name doesn't imply one.
+ */
+adaptive_spec_t
+parse_adaptive_spec(const char *names, int level, uint_t min_gain_pct);
+
 #ifdef __cplusplus
 }
 #endif
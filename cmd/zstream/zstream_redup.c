@@ -14,102 +14,208 @@
  * Copyright (c) 2020 by Delphix. All rights reserved.
  */
 
-#include <assert.h>
 #include <cityhash.h>
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <libzutil.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/bitops.h>
+#include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/stdtypes.h>
 #include <sys/sysmacros.h>
 #include <sys/zfs_ioctl.h>
-#include <umem.h>
 #include <unistd.h>
 
 #include "zstream.h"
 #include "zstream_modules.h"
 #include "zstream_util.h"
 
+/*
+ * The redup table is an open-addressing hash table of fixed-size entries,
+ * one per WRITE record. While it's smaller than MAX_RDT_PHYSMEM_PERCENT of
+ * physical memory, it lives in anonymous memory. Beyond that, each resize
+ * places the table in an unlinked temporary file (in $TMPDIR, or /var/tmp)
+ * that is mapped shared, so the kernel can write cold parts of the table
+ * back to disk instead of the process running out of memory.
+ *
+ * A stream_offset of zero marks an empty slot. No WRITE record can begin
+ * at offset zero because every stream starts with a DRR_BEGIN.
+ */
 #define	MAX_RDT_PHYSMEM_PERCENT		20
 #define	SMALLEST_POSSIBLE_MAX_RDT_MB	128
+#define	INITIAL_RDT_SLOTS		(1ULL << 16)
+#define	DEFAULT_RDT_TMPDIR		"/var/tmp"
 
-typedef struct redup_entry {
-	struct redup_entry	*rde_next;
-	uint64_t		rde_guid;
-	uint64_t		rde_object;
-	uint64_t		rde_offset;
-	uint64_t		rde_stream_offset;
+typedef struct {
+	uint64_t	rde_guid;
+	uint64_t	rde_object;
+	uint64_t	rde_offset;
+	uint64_t	rde_stream_offset;
 } redup_entry_t;
 
 typedef struct redup_table {
-	redup_entry_t	**redup_hash_array;
-	umem_cache_t	*ddecache;
-	uint64_t	ddt_count;
-	int		numhashbits;
+	redup_entry_t	*rdt_slots;
+	uint64_t	rdt_numslots;	/* Always a power of 2 */
+	uint64_t	rdt_count;
+	uint64_t	rdt_mem_limit;	/* Bytes of anonymous memory allowed */
+	int		rdt_fd;		/* Backing file, or -1 */
 } redup_table_t;
 
 typedef struct {
 	redup_table_t	rc_rdt;
-	FILE		*rc_fp;
+	int		rc_fd;
+	uint64_t	rc_max_table_size;
+	boolean_t	rc_file_backed;
 } redup_context_t;
 
+/*
+ * Packets between serial_redup_writes() and parallel_redup_read(). For
+ * WRITE_BYREF records, rd_ref_offset locates the referenced WRITE.
+ */
+typedef struct {
+	drr_packet_t	rd_base;
+	uint64_t	rd_ref_offset;
+} drr_redup_t;
+
+static redup_context_t redup_context;
+
+static redup_entry_t *
+rdt_alloc(redup_table_t *rdt, uint64_t numslots)
+{
+	size_t size = numslots * sizeof (redup_entry_t);
+	void *slots;
+
+	if (size <= rdt->rdt_mem_limit) {
+		slots = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		rdt->rdt_fd = -1;
+	} else {
+		const char *tmpdir = getenv("TMPDIR");
+		char path[MAXPATHLEN];
+
+		(void) snprintf(path, sizeof (path), "%s/zstream-redup.XXXXXX",
+		    tmpdir ? tmpdir : DEFAULT_RDT_TMPDIR);
+		rdt->rdt_fd = mkstemp(path);
+		if (rdt->rdt_fd < 0)
+			err(1, "unable to create redup table file %s", path);
+		(void) unlink(path);
+		if (ftruncate(rdt->rdt_fd, size) != 0)
+			err(1, "unable to size redup table file");
+		slots = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		    rdt->rdt_fd, 0);
+		if (slots != MAP_FAILED)
+			(void) madvise(slots, size, MADV_RANDOM);
+	}
+	if (slots == MAP_FAILED)
+		err(1, "unable to map redup table");
+
+	rdt->rdt_slots = slots;
+	rdt->rdt_numslots = numslots;
+	return (slots);
+}
+
+static void
+rdt_free(redup_table_t *rdt)
+{
+	(void) munmap(rdt->rdt_slots,
+	    rdt->rdt_numslots * sizeof (redup_entry_t));
+	if (rdt->rdt_fd >= 0)
+		(void) close(rdt->rdt_fd);
+	rdt->rdt_slots = NULL;
+	rdt->rdt_fd = -1;
+}
+
+static redup_entry_t *
+rdt_find_slot(redup_table_t *rdt, uint64_t guid, uint64_t object,
+    uint64_t offset)
+{
+	uint64_t mask = rdt->rdt_numslots - 1;
+	uint64_t ix = cityhash3(guid, object, offset) & mask;
+
+	for (;;) {
+		redup_entry_t *rde = &rdt->rdt_slots[ix];
+		if (rde->rde_stream_offset == 0 || (rde->rde_guid == guid &&
+		    rde->rde_object == object && rde->rde_offset == offset)) {
+			return (rde);
+		}
+		ix = (ix + 1) & mask;
+	}
+}
+
 static void
 rdt_insert(redup_table_t *rdt,
     uint64_t guid, uint64_t object, uint64_t offset, uint64_t stream_offset)
 {
-	uint64_t ch = cityhash3(guid, object, offset);
-	uint64_t hashcode = BF64_GET(ch, 0, rdt->numhashbits);
-	redup_entry_t **rdepp;
+	/*
+	 * Keep the load factor at or below 3/4 so that probe sequences stay
+	 * short. Rehashing walks the old table sequentially.
+	 */
+	if ((rdt->rdt_count + 1) * 4 > rdt->rdt_numslots * 3) {
+		redup_table_t old = *rdt;
+		rdt_alloc(rdt, old.rdt_numslots * 2);
+		for (uint64_t i = 0; i < old.rdt_numslots; i++) {
+			redup_entry_t *rde = &old.rdt_slots[i];
+			if (rde->rde_stream_offset != 0) {
+				*rdt_find_slot(rdt, rde->rde_guid,
+				    rde->rde_object, rde->rde_offset) = *rde;
+			}
+		}
+		rdt_free(&old);
+	}
 
-	rdepp = &(rdt->redup_hash_array[hashcode]);
-	redup_entry_t *rde = umem_cache_alloc(rdt->ddecache, UMEM_NOFAIL);
-	rde->rde_next = *rdepp;
+	/*
+	 * A repeated key replaces the earlier entry, so references resolve
+	 * to the most recent matching WRITE.
+	 */
+	redup_entry_t *rde = rdt_find_slot(rdt, guid, object, offset);
+	if (rde->rde_stream_offset == 0)
+		rdt->rdt_count++;
 	rde->rde_guid = guid;
 	rde->rde_object = object;
 	rde->rde_offset = offset;
 	rde->rde_stream_offset = stream_offset;
-	*rdepp = rde;
-	rdt->ddt_count++;
 }
 
-static void
-rdt_lookup(redup_table_t *rdt,
-    uint64_t guid, uint64_t object, uint64_t offset,
-    uint64_t *stream_offsetp)
+static uint64_t
+rdt_lookup(redup_table_t *rdt, uint64_t guid, uint64_t object,
+    uint64_t offset)
 {
-	uint64_t ch = cityhash3(guid, object, offset);
-	uint64_t hashcode = BF64_GET(ch, 0, rdt->numhashbits);
-
-	for (redup_entry_t *rde = rdt->redup_hash_array[hashcode];
-	    rde != NULL; rde = rde->rde_next) {
-		if (rde->rde_guid == guid &&
-		    rde->rde_object == object &&
-		    rde->rde_offset == offset) {
-			*stream_offsetp = rde->rde_stream_offset;
-			return;
-		}
+	redup_entry_t *rde = rdt_find_slot(rdt, guid, object, offset);
+
+	if (rde->rde_stream_offset == 0) {
+		errx(1, "no WRITE record found for WRITE_BYREF reference "
+		    "to guid %llu object %llu offset %llu",
+		    (u_longlong_t)guid, (u_longlong_t)object,
+		    (u_longlong_t)offset);
 	}
-	assert(!"could not find expected redup table entry");
+	return (rde->rde_stream_offset);
 }
 
+/*
+ * Table maintenance and lookups are serial, but rereading the referenced
+ * records is left to parallel_redup_read().
+ */
 static disposition_t
 chain_redup_writes(void *item_in, void *context_in)
 {
-	drr_packet_t *item = (drr_packet_t *)item_in;
+	drr_redup_t *item = (drr_redup_t *)item_in;
 	redup_context_t *context = (redup_context_t *)context_in;
 
 	if (item == NULL) {
 		return (D_OK);
 	}
 
-	dmu_replay_record_t *drr = &item->dp_drr;
+	dmu_replay_record_t *drr = &item->rd_base.dp_drr;
 	struct drr_write *drrw	 = &drr->drr_u.drr_write;
 	struct drr_begin *drrb	 = &drr->drr_u.drr_begin;
+	struct drr_write_byref *drrwb = &drr->drr_u.drr_write_byref;
+
+	item->rd_ref_offset = 0;
 
 	switch (drr->drr_type) {
 
@@ -123,68 +229,127 @@ chain_redup_writes(void *item_in, void *context_in)
 	}
 
 	case DRR_WRITE_BYREF:
-	{
-		struct drr_write_byref drrwb = drr->drr_u.drr_write_byref;
-
-		/*
-		 * Look up in hash table by drrwb->drr_refguid,
-		 * drr_refobject, drr_refoffset.  Replace this
-		 * record with the found WRITE record, but with
-		 * drr_object,drr_offset,drr_toguid replaced with ours.
-		 */
-		uint64_t stream_offset = 0;
-		rdt_lookup(&context->rc_rdt, drrwb.drr_refguid,
-		    drrwb.drr_refobject, drrwb.drr_refoffset,
-		    &stream_offset);
-
-		if (fseeko(context->rc_fp, stream_offset, SEEK_SET) != 0) {
-			err(1, "seek into source file failed, offset %llu",
-			    (u_longlong_t)stream_offset);
-		}
-		if (fread(drr, sizeof (*drr), 1, context->rc_fp) != 1) {
-			err(1, "read of prior write failed");
-		}
-		if (ATTR_IS_SET(CA_BYTESWAPPED)) {
-			byteswap_record(drr, BSWAP_32(drr->drr_type));
-		}
-
-		VERIFY3U(drr->drr_type,    ==, DRR_WRITE);
-		VERIFY3U(drrw->drr_toguid, ==, drrwb.drr_refguid);
-		VERIFY3U(drrw->drr_object, ==, drrwb.drr_refobject);
-		VERIFY3U(drrw->drr_offset, ==, drrwb.drr_refoffset);
-
-		item->dp_payload_size = DRR_WRITE_PAYLOAD_SIZE(drrw);
-		item->dp_payload = safe_malloc(item->dp_payload_size);
-
-		size_t n_read = fread(item->dp_payload, item->dp_payload_size,
-		    1, context->rc_fp);
-		if (n_read != 1)
-			err(1, "read of prior payload failed");
-
-		drrw->drr_toguid = drrwb.drr_toguid;
-		drrw->drr_object = drrwb.drr_object;
-		drrw->drr_offset = drrwb.drr_offset;
+		item->rd_ref_offset = rdt_lookup(&context->rc_rdt,
+		    drrwb->drr_refguid, drrwb->drr_refobject,
+		    drrwb->drr_refoffset);
 		break;
-	}
 
 	case DRR_WRITE:
 		rdt_insert(&context->rc_rdt, drrw->drr_toguid, drrw->drr_object,
-		    drrw->drr_offset, item->dp_stream_offset);
+		    drrw->drr_offset, item->rd_base.dp_stream_offset);
 		break;
 
 	default:
 		break;
 	}
+
+	uint64_t size = context->rc_rdt.rdt_numslots * sizeof (redup_entry_t);
+	context->rc_max_table_size = MAX(context->rc_max_table_size, size);
+	context->rc_file_backed |= context->rc_rdt.rdt_fd >= 0;
 	return (D_OK);
 }
 
-static chain_step_t
-serial_redup_writes(redup_context_t *context)
+static void
+pread_fully(int fd, void *buff, size_t len, uint64_t offset,
+    const char *what)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t n = pread(fd, (uint8_t *)buff + done, len - done,
+		    offset + done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			err(1, "read of prior %s failed", what);
+		if (n == 0)
+			errx(1, "read of prior %s failed: unexpected EOF",
+			    what);
+		done += n;
+	}
+}
+
+/*
+ * Replace a WRITE_BYREF with the WRITE record it references, but with
+ * drr_object, drr_offset, and drr_toguid replaced with ours. pread() is
+ * safe to use from several workers at once, so rereads proceed in parallel
+ * and the storage under the stream file sees several requests at a time.
+ */
+static void
+chain_redup_read(queue_item_t *item_in, void *context_in)
+{
+	drr_redup_t *item = (drr_redup_t *)item_in;
+	redup_context_t *context = (redup_context_t *)context_in;
+	drr_packet_t *base = &item->rd_base;
+	dmu_replay_record_t *drr = &base->dp_drr;
+	struct drr_write *drrw = &drr->drr_u.drr_write;
+	struct drr_write_byref drrwb = drr->drr_u.drr_write_byref;
+
+	pread_fully(context->rc_fd, drr, sizeof (*drr), item->rd_ref_offset,
+	    "write");
+	if (ATTR_IS_SET(CA_BYTESWAPPED)) {
+		byteswap_record(drr, BSWAP_32(drr->drr_type));
+	}
+
+	VERIFY3U(drr->drr_type,    ==, DRR_WRITE);
+	VERIFY3U(drrw->drr_toguid, ==, drrwb.drr_refguid);
+	VERIFY3U(drrw->drr_object, ==, drrwb.drr_refobject);
+	VERIFY3U(drrw->drr_offset, ==, drrwb.drr_refoffset);
+
+	base->dp_payload_size = DRR_WRITE_PAYLOAD_SIZE(drrw);
+	base->dp_payload = safe_malloc(base->dp_payload_size);
+	pread_fully(context->rc_fd, base->dp_payload, base->dp_payload_size,
+	    item->rd_ref_offset + sizeof (*drr), "payload");
+
+	drrw->drr_toguid = drrwb.drr_toguid;
+	drrw->drr_object = drrwb.drr_object;
+	drrw->drr_offset = drrwb.drr_offset;
+}
+
+static size_t
+chain_redup_read_cost(queue_item_t *item_in, void *context)
+{
+	(void) context;
+	drr_redup_t *item = (drr_redup_t *)item_in;
+
+	return (item->rd_ref_offset == 0 ? 0 : 1);
+}
+
+/*
+ * Redup must be able to reread prior WRITE records, so the stream has to
+ * come from a seekable file. The same filename should be passed to
+ * serial_read_stream(). Call redup_fini() once the chain has completed.
+ */
+chain_step_t
+serial_redup_writes(const char *filename)
 {
+	redup_context_t *context = &redup_context;
+
+	VERIFY3P(context->rc_rdt.rdt_slots, ==, NULL);
+	context->rc_fd = open(filename, O_RDONLY);
+	if (context->rc_fd < 0) {
+		err(1, "unable to open %s", filename);
+	}
+
+#ifdef _ILP32
+	uint64_t max_rde_size = SMALLEST_POSSIBLE_MAX_RDT_MB << 20;
+#else
+	uint64_t physbytes = sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+	uint64_t max_rde_size = MAX((physbytes * MAX_RDT_PHYSMEM_PERCENT) / 100,
+	    SMALLEST_POSSIBLE_MAX_RDT_MB << 20);
+#endif
+
+	context->rc_rdt.rdt_mem_limit = max_rde_size;
+	context->rc_rdt.rdt_count = 0;
+	rdt_alloc(&context->rc_rdt, INITIAL_RDT_SLOTS);
+	context->rc_max_table_size = 0;
+	context->rc_file_backed = B_FALSE;
+
 	chain_step_t step = {
 		.cs_type = CS_SERIAL,
+		.cs_name = "redup_writes",
 		.cs_in_size = sizeof (drr_packet_t),
-		.cs_out_size = sizeof (drr_packet_t),
+		.cs_out_size = sizeof (drr_redup_t),
 		.cs_context = context,
 		.cs_serial = {
 			.process = chain_redup_writes
@@ -193,19 +358,68 @@ serial_redup_writes(redup_context_t *context)
 	return (step);
 }
 
+/*
+ * Must immediately follow serial_redup_writes()
+ */
+chain_step_t
+parallel_redup_read(void)
+{
+	chain_step_t step = {
+	    .cs_type = CS_PARALLEL,
+	    .cs_name = "redup_read",
+	    .cs_in_size = sizeof (drr_redup_t),
+	    .cs_out_size = sizeof (drr_packet_t),
+	    .cs_context = &redup_context,
+	    .cs_parallel = {
+		.queue_length = 256,
+		.batch_budget = 8,
+		.process = chain_redup_read,
+		.cost = chain_redup_read_cost
+	    }
+	};
+	return (step);
+}
+
+/*
+ * Print a summary if requested and release the redup table.
+ */
+void
+redup_fini(chain_attrs_t *attrs)
+{
+	redup_context_t *context = &redup_context;
+
+	if (attrs->ca_command_opts & CA_VERBOSE) {
+		char mem_str[16];
+		record_stats_t *acsi = attrs->ca_stats_in;
+		zfs_nicenum(context->rc_max_table_size, mem_str,
+		    sizeof (mem_str));
+		fprintf(stderr, "Converted stream with %llu total records, "
+		    "including %llu dedup records, using %sB %s.\n",
+		    (u_longlong_t)attrs->ca_totals_in.rs_num_records,
+		    (u_longlong_t)acsi[DRR_WRITE_BYREF].rs_num_records,
+		    mem_str, context->rc_file_backed ?
+		    "file-backed table" : "memory");
+	}
+
+	(void) close(context->rc_fd);
+	context->rc_fd = -1;
+	rdt_free(&context->rc_rdt);
+}
+
 int
 zstream_do_redup(int argc, char *argv[])
 {
 	int c;
 	chain_attrs_t attrs = {0};
-	redup_context_t context = {0};
-	uint64_t numbuckets;
 
-	while ((c = getopt(argc, argv, "v")) != -1) {
+	while ((c = getopt(argc, argv, "Sv")) != -1) {
 		switch (c) {
 		case 'v':
 			ENABLE_OPTION(&attrs, CA_VERBOSE);
 			break;
+		case 'S':
+			pipestats_option(&attrs);
+			break;
 		case '?':
 			warnx("invalid option '%c'", optopt);
 			zstream_usage();
@@ -218,51 +432,14 @@ zstream_do_redup(int argc, char *argv[])
 	if (argc != 1)
 		zstream_usage();
 
-	context.rc_fp = fopen(argv[0], "rb");
-	if (context.rc_fp == NULL) {
-		err(1, "unable to open %s", argv[0]);
-	}
-
-#ifdef _ILP32
-	uint64_t max_rde_size = SMALLEST_POSSIBLE_MAX_RDT_MB << 20;
-#else
-	uint64_t physbytes = sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
-	uint64_t max_rde_size = MAX((physbytes * MAX_RDT_PHYSMEM_PERCENT) / 100,
-	    SMALLEST_POSSIBLE_MAX_RDT_MB << 20);
-#endif
-
-	numbuckets = max_rde_size / (sizeof (redup_entry_t));
-	if (!ISP2(numbuckets))
-		numbuckets = 1ULL << highbit64(numbuckets);
-
-	context.rc_rdt.redup_hash_array =
-	    safe_calloc(numbuckets * sizeof (redup_entry_t *));
-	context.rc_rdt.ddecache = umem_cache_create("rde",
-	    sizeof (redup_entry_t), 0, NULL, NULL, NULL, NULL, NULL, 0);
-	context.rc_rdt.numhashbits = highbit64(numbuckets) - 1;
-	context.rc_rdt.ddt_count = 0;
-
 	zstream_chain_t redup_chain = {
 		STANDARD_INPUT_STACK(argv[0]),
-		serial_redup_writes(&context),
+		serial_redup_writes(argv[0]),
+		parallel_redup_read(),
 		STANDARD_OUTPUT_STACK(NULL)
 	};
 	zstream_chain_exec(redup_chain, &attrs);
 
-	if (attrs.ca_command_opts & CA_VERBOSE) {
-		char mem_str[16];
-		record_stats_t *acsi = attrs.ca_stats_in;
-		zfs_nicenum(context.rc_rdt.ddt_count * sizeof (redup_entry_t),
-		    mem_str, sizeof (mem_str));
-		fprintf(stderr, "Converted stream with %llu total records, "
-		    "including %llu dedup records, using %sB memory.\n",
-		    (u_longlong_t)attrs.ca_totals_in.rs_num_records,
-		    (u_longlong_t)acsi[DRR_WRITE_BYREF].rs_num_records,
-		    mem_str);
-	}
-
-	fclose(context.rc_fp);
-	umem_cache_destroy(context.rc_rdt.ddecache);
-	free(context.rc_rdt.redup_hash_array);
+	redup_fini(&attrs);
 	return (0);
 }
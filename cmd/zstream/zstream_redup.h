@@ -0,0 +1,48 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * https://opensource.org/license/CDDL-1.0.
+ */
+
+/*
+ * Copyright (c) 2026 by Garth Snyder. All rights reserved.
+ */
+
+#ifndef _ZSTREAM_REDUP_H
+#define	_ZSTREAM_REDUP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "zstream_io.h"
+
+/*
+ * Replace WRITE_BYREF records with the WRITE records they reference. Only
+ * one redup step may exist per process. The stream must be read from
+ * filename, which is reopened for random access to earlier records.
+ *
+ * serial_redup_writes() resolves references and must be followed
+ * immediately by parallel_redup_read(), which rereads the referenced
+ * records.
+ */
+chain_step_t
+serial_redup_writes(const char *filename);
+
+chain_step_t
+parallel_redup_read(void);
+
+void
+redup_fini(chain_attrs_t *attrs);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _ZSTREAM_REDUP_H */
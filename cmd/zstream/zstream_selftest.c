@@ -17,7 +17,7 @@
 /*
  * zstream selftest: in-process unit tests for zstream's internal machinery.
  *
- *   zstream selftest [-l] [-s seed] [-t nthreads] module [test ...]
+ *   zstream selftest [-lw] [-s seed] [-t nthreads] module [test ...]
  *
  * Tests are grouped into modules (see zstream_selftest.h). With no test
  * names, all of a module's tests run in order. -l lists the available
@@ -62,12 +62,14 @@ static void
 selftest_usage(void)
 {
 	(void) fprintf(stderr,
-	    "usage: zstream selftest [-l] [-s seed] [-t nthreads] "
+	    "usage: zstream selftest [-lw] [-s seed] [-t nthreads] "
 	    "module [test ...]\n"
 	    "\n"
 	    "\t-l         list available tests\n"
 	    "\t-s seed    seed for pseudo-random workloads (for replays)\n"
 	    "\t-t num     size of the shared worker thread pool\n"
+	    "\t-w         use the affine (per-worker locality) queue\n"
+	    "\t           scheduler\n"
 	    "\n"
 	    "Available modules:");
 	for (int i = 0; i < NUM_MODULES; i++)
@@ -136,7 +138,7 @@ zstream_do_selftest(int argc, char *argv[])
 	char *end;
 	int c;
 
-	while ((c = getopt(argc, argv, "ls:t:")) != -1) {
+	while ((c = getopt(argc, argv, "ls:t:w")) != -1) {
 		switch (c) {
 		case 'l':
 			list_only = B_TRUE;
@@ -157,6 +159,9 @@ zstream_do_selftest(int argc, char *argv[])
 				selftest_usage();
 			}
 			break;
+		case 'w':
+			zstream_queue_set_scheduler(ZQ_SCHED_AFFINE);
+			break;
 		case '?':
 			warnx("invalid option '%c'", optopt);
 			selftest_usage();
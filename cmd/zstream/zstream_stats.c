@@ -0,0 +1,556 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * https://opensource.org/license/CDDL-1.0.
+ */
+
+/*
+ * Copyright (c) 2026 by Garth Snyder. All rights reserved.
+ */
+
+/*
+ * zstream stats: summarize a send stream as JSON.
+ *
+ * Aggregates are collected by a serial step at the end of the standard
+ * input stack. Optionally, a sample of WRITE records is recompressed by
+ * parallel workers with one or more candidate algorithms to estimate how
+ * well the stream's data would compress on the receiving side.
+ */
+
+#include <err.h>
+#include <libnvpair.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/dmu.h>
+#include <sys/fs/zfs.h>
+#include <sys/nvpair.h>
+#include <sys/stdtypes.h>
+#include <sys/sysmacros.h>
+#include <sys/zfs_ioctl.h>
+#include <sys/zio_compress.h>
+#include <unistd.h>
+
+#include "zstream.h"
+#include "zstream_modules.h"
+#include "zstream_queue.h"
+#include "zstream_stats.h"
+#include "zstream_util.h"
+
+#define	DEFAULT_SAMPLE_RATE	16
+
+static const char *record_type_names[DRR_NUMTYPES] = {
+	[DRR_BEGIN]		= "DRR_BEGIN",
+	[DRR_OBJECT]		= "DRR_OBJECT",
+	[DRR_FREEOBJECTS]	= "DRR_FREEOBJECTS",
+	[DRR_WRITE]		= "DRR_WRITE",
+	[DRR_FREE]		= "DRR_FREE",
+	[DRR_END]		= "DRR_END",
+	[DRR_WRITE_BYREF]	= "DRR_WRITE_BYREF",
+	[DRR_SPILL]		= "DRR_SPILL",
+	[DRR_WRITE_EMBEDDED]	= "DRR_WRITE_EMBEDDED",
+	[DRR_OBJECT_RANGE]	= "DRR_OBJECT_RANGE",
+	[DRR_REDACT]		= "DRR_REDACT"
+};
+
+typedef struct {
+	uint64_t	cb_records;
+	uint64_t	cb_logical_bytes;
+	uint64_t	cb_payload_bytes;
+} count_bytes_t;
+
+typedef struct {
+	/* Sampling parameters */
+	compression_spec_t	sc_algs[MAX_STATS_ALGS];
+	const char		*sc_alg_names[MAX_STATS_ALGS];
+	int			sc_num_algs;
+	uint64_t		sc_sample_rate;
+	uint64_t		sc_eligible;
+
+	/* Aggregates */
+	uint64_t		sc_object_records;
+	uint64_t		sc_freed_objects;
+	count_bytes_t		sc_writes;
+	count_bytes_t		sc_embedded;
+	count_bytes_t		sc_byref;
+	count_bytes_t		sc_spill;
+	count_bytes_t		sc_frees;
+	uint64_t		sc_frees_to_end;
+	count_bytes_t		sc_by_compression[ZIO_COMPRESS_FUNCTIONS + 1];
+	count_bytes_t		sc_by_block_size[SPA_MAXBLOCKSHIFT + 1];
+	count_bytes_t		sc_sampled;
+	uint64_t		sc_sampled_csize[MAX_STATS_ALGS];
+} stats_context_t;
+
+static stats_context_t stats_context;
+
+/*
+ * Only unencrypted WRITEs can be sampled, since there's no way to see the
+ * plaintext of an encrypted block.
+ */
+static boolean_t
+sample_eligible(drr_packet_t *item)
+{
+	dmu_replay_record_t *drr = &item->dp_drr;
+
+	if (drr->drr_type != DRR_WRITE || item->dp_payload_size == 0)
+		return (B_FALSE);
+	return (!write_is_encrypted(&drr->drr_u.drr_write));
+}
+
+/*
+ * Widen each packet to a drr_stats_t and decide whether it will be sampled.
+ * The decision has to be made serially so that the sample is deterministic.
+ */
+static disposition_t
+chain_select_samples(void *item_in, void *context_in)
+{
+	drr_stats_t *item = (drr_stats_t *)item_in;
+	stats_context_t *context = (stats_context_t *)context_in;
+
+	if (item == NULL)
+		return (D_OK);
+
+	item->ds_sampled = B_FALSE;
+	if (context->sc_num_algs > 0 && sample_eligible(&item->ds_base)) {
+		item->ds_sampled =
+		    (context->sc_eligible++ % context->sc_sample_rate) == 0;
+	}
+	return (D_OK);
+}
+
+static size_t
+chain_sample_cost(queue_item_t *item_in, void *context_in)
+{
+	drr_stats_t *item = (drr_stats_t *)item_in;
+	stats_context_t *context = (stats_context_t *)context_in;
+
+	if (!item->ds_sampled)
+		return (0);
+	return (item->ds_base.dp_drr.drr_u.drr_write.drr_logical_size *
+	    context->sc_num_algs);
+}
+
+/*
+ * Compress the logical contents of a sampled WRITE with each candidate
+ * algorithm. The payload itself is not modified. Incompressible blocks are
+ * charged at their logical size, just as they would be stored.
+ */
+static void
+chain_sample_compression(queue_item_t *item_in, void *context_in)
+{
+	drr_stats_t *item = (drr_stats_t *)item_in;
+	stats_context_t *context = (stats_context_t *)context_in;
+	drr_packet_t *base = &item->ds_base;
+	struct drr_write *drrw = &base->dp_drr.drr_u.drr_write;
+	uint64_t lsize = drrw->drr_logical_size;
+	uint8_t *data = base->dp_payload;
+
+	if (!ctype_is_uncompressed(drrw->drr_compressiontype)) {
+		data = decompress_buffer(base->dp_payload,
+		    base->dp_payload_size, lsize, drrw->drr_compressiontype);
+		if (data == NULL) {
+			item->ds_sampled = B_FALSE;
+			return;
+		}
+	} else if (base->dp_payload_size != lsize) {
+		item->ds_sampled = B_FALSE;
+		return;
+	}
+
+	for (int i = 0; i < context->sc_num_algs; i++) {
+		size_t csize = lsize;
+		uint8_t *cbuff = compress_buffer(data, lsize,
+		    context->sc_algs[i], &csize);
+		if (cbuff == NULL) {
+			csize = lsize;
+		} else {
+			free(cbuff);
+		}
+		item->ds_csize[i] = csize;
+	}
+
+	if (data != base->dp_payload)
+		free(data);
+}
+
+static void
+add_count(count_bytes_t *cb, uint64_t logical, uint64_t payload)
+{
+	cb->cb_records++;
+	cb->cb_logical_bytes += logical;
+	cb->cb_payload_bytes += payload;
+}
+
+static disposition_t
+chain_collect_stats(void *item_in, void *context_in)
+{
+	drr_stats_t *item = (drr_stats_t *)item_in;
+	stats_context_t *context = (stats_context_t *)context_in;
+
+	if (item == NULL)
+		return (D_OK);
+
+	drr_packet_t *base = &item->ds_base;
+	dmu_replay_record_t *drr = &base->dp_drr;
+
+	switch (drr->drr_type) {
+	case DRR_OBJECT:
+		context->sc_object_records++;
+		break;
+	case DRR_FREEOBJECTS:
+		context->sc_freed_objects +=
+		    drr->drr_u.drr_freeobjects.drr_numobjs;
+		break;
+	case DRR_WRITE: {
+		struct drr_write *drrw = &drr->drr_u.drr_write;
+		uint64_t lsize = drrw->drr_logical_size;
+		uint_t ct = drrw->drr_compressiontype;
+		int shift = lsize == 0 ? 0 :
+		    MIN(highbit64(lsize) - 1, SPA_MAXBLOCKSHIFT);
+
+		if (ct >= ZIO_COMPRESS_FUNCTIONS)
+			ct = ZIO_COMPRESS_FUNCTIONS;
+		else if (ctype_is_uncompressed(ct))
+			ct = ZIO_COMPRESS_OFF;
+
+		add_count(&context->sc_writes, lsize, base->dp_payload_size);
+		add_count(&context->sc_by_compression[ct], lsize,
+		    base->dp_payload_size);
+		add_count(&context->sc_by_block_size[shift], lsize,
+		    base->dp_payload_size);
+
+		if (item->ds_sampled) {
+			add_count(&context->sc_sampled, lsize,
+			    base->dp_payload_size);
+			for (int i = 0; i < context->sc_num_algs; i++) {
+				context->sc_sampled_csize[i] +=
+				    item->ds_csize[i];
+			}
+		}
+		break;
+	}
+	case DRR_WRITE_EMBEDDED: {
+		struct drr_write_embedded *drrwe =
+		    &drr->drr_u.drr_write_embedded;
+		add_count(&context->sc_embedded, drrwe->drr_length,
+		    base->dp_payload_size);
+		break;
+	}
+	case DRR_WRITE_BYREF:
+		add_count(&context->sc_byref,
+		    drr->drr_u.drr_write_byref.drr_length, 0);
+		break;
+	case DRR_SPILL:
+		add_count(&context->sc_spill, drr->drr_u.drr_spill.drr_length,
+		    base->dp_payload_size);
+		break;
+	case DRR_FREE:
+		if (drr->drr_u.drr_free.drr_length == DMU_OBJECT_END) {
+			context->sc_frees_to_end++;
+		} else {
+			add_count(&context->sc_frees,
+			    drr->drr_u.drr_free.drr_length, 0);
+		}
+		break;
+	default:
+		break;
+	}
+	return (D_OK);
+}
+
+chain_step_t
+serial_select_samples(void)
+{
+	chain_step_t step = {
+		.cs_type = CS_SERIAL,
+		.cs_name = "select_samples",
+		.cs_in_size = sizeof (drr_packet_t),
+		.cs_out_size = sizeof (drr_stats_t),
+		.cs_context = &stats_context,
+		.cs_serial = {
+			.process = chain_select_samples
+		}
+	};
+	return (step);
+}
+
+/*
+ * Compression is slow relative to everything else in the chain, so use a
+ * long queue and a modest batch budget, as parallel_compress_writes() does.
+ */
+chain_step_t
+parallel_sample_compression(void)
+{
+	chain_step_t step = {
+	    .cs_type = CS_PARALLEL,
+	    .cs_name = "sample_compression",
+	    .cs_in_size = sizeof (drr_stats_t),
+	    .cs_out_size = sizeof (drr_stats_t),
+	    .cs_context = &stats_context,
+	    .cs_parallel = {
+		.queue_length = 1024,
+		.batch_budget = 32 * 1024,
+		.process = chain_sample_compression,
+		.cost = chain_sample_cost
+	    }
+	};
+	return (step);
+}
+
+chain_step_t
+serial_collect_stats(void)
+{
+	chain_step_t step = {
+		.cs_type = CS_SERIAL,
+		.cs_name = "collect_stats",
+		.cs_in_size = sizeof (drr_stats_t),
+		.cs_out_size = sizeof (drr_packet_t),
+		.cs_context = &stats_context,
+		.cs_serial = {
+			.process = chain_collect_stats
+		}
+	};
+	return (step);
+}
+
+static nvlist_t *
+count_bytes_nvl(count_bytes_t *cb, boolean_t with_payload)
+{
+	nvlist_t *nvl = fnvlist_alloc();
+
+	fnvlist_add_uint64(nvl, "records", cb->cb_records);
+	fnvlist_add_uint64(nvl, "logical_bytes", cb->cb_logical_bytes);
+	if (with_payload)
+		fnvlist_add_uint64(nvl, "payload_bytes", cb->cb_payload_bytes);
+	return (nvl);
+}
+
+static void
+add_count_bytes(nvlist_t *parent, const char *name, count_bytes_t *cb,
+    boolean_t with_payload)
+{
+	nvlist_t *nvl = count_bytes_nvl(cb, with_payload);
+	fnvlist_add_nvlist(parent, name, nvl);
+	fnvlist_free(nvl);
+}
+
+static void
+add_child(nvlist_t *parent, const char *name, nvlist_t *child)
+{
+	fnvlist_add_nvlist(parent, name, child);
+	fnvlist_free(child);
+}
+
+static nvlist_t *
+stream_stats_nvl(chain_attrs_t *attrs)
+{
+	record_stats_t *totals = &attrs->ca_totals_in;
+	nvlist_t *nvl = fnvlist_alloc();
+
+	fnvlist_add_uint64(nvl, "records", totals->rs_num_records);
+	fnvlist_add_uint64(nvl, "header_bytes",
+	    totals->rs_total_header_bytes);
+	fnvlist_add_uint64(nvl, "payload_bytes",
+	    totals->rs_total_payload_bytes);
+	fnvlist_add_uint64(nvl, "total_bytes",
+	    totals->rs_total_header_bytes + totals->rs_total_payload_bytes);
+	return (nvl);
+}
+
+static nvlist_t *
+record_type_stats_nvl(chain_attrs_t *attrs)
+{
+	nvlist_t *nvl = fnvlist_alloc();
+
+	for (int type = 0; type < DRR_NUMTYPES; type++) {
+		record_stats_t *stats = &attrs->ca_stats_in[type];
+		nvlist_t *child = fnvlist_alloc();
+		fnvlist_add_uint64(child, "records", stats->rs_num_records);
+		fnvlist_add_uint64(child, "payload_bytes",
+		    stats->rs_total_payload_bytes);
+		add_child(nvl, record_type_names[type], child);
+	}
+	return (nvl);
+}
+
+static nvlist_t *
+compression_stats_nvl(stats_context_t *context)
+{
+	nvlist_t *nvl = fnvlist_alloc();
+
+	for (int ct = 0; ct <= ZIO_COMPRESS_FUNCTIONS; ct++) {
+		count_bytes_t *cb = &context->sc_by_compression[ct];
+		if (cb->cb_records == 0)
+			continue;
+		const char *name = ct == ZIO_COMPRESS_FUNCTIONS ? "unknown" :
+		    ct == ZIO_COMPRESS_OFF ? "off" :
+		    zio_compress_table[ct].ci_name;
+		add_count_bytes(nvl, name, cb, B_TRUE);
+	}
+	return (nvl);
+}
+
+static nvlist_t *
+block_size_stats_nvl(stats_context_t *context)
+{
+	nvlist_t *nvl = fnvlist_alloc();
+	char name[32];
+
+	for (int shift = 0; shift <= SPA_MAXBLOCKSHIFT; shift++) {
+		count_bytes_t *cb = &context->sc_by_block_size[shift];
+		if (cb->cb_records == 0)
+			continue;
+		(void) snprintf(name, sizeof (name), "%llu",
+		    (u_longlong_t)1ULL << shift);
+		add_count_bytes(nvl, name, cb, B_TRUE);
+	}
+	return (nvl);
+}
+
+static nvlist_t *
+compressibility_stats_nvl(stats_context_t *context)
+{
+	nvlist_t *nvl = fnvlist_alloc();
+	nvlist_t *algs = fnvlist_alloc();
+	uint64_t lsize = context->sc_sampled.cb_logical_bytes;
+
+	fnvlist_add_uint64(nvl, "sample_rate", context->sc_sample_rate);
+	fnvlist_add_uint64(nvl, "sampled_records",
+	    context->sc_sampled.cb_records);
+	fnvlist_add_uint64(nvl, "sampled_logical_bytes", lsize);
+
+	for (int i = 0; i < context->sc_num_algs; i++) {
+		uint64_t csize = context->sc_sampled_csize[i];
+		nvlist_t *child = fnvlist_alloc();
+		fnvlist_add_uint64(child, "compressed_bytes", csize);
+		VERIFY0(nvlist_add_double(child, "ratio",
+		    csize == 0 ? 1.0 : (double)lsize / (double)csize));
+		add_child(algs, context->sc_alg_names[i], child);
+	}
+	add_child(nvl, "algorithms", algs);
+	return (nvl);
+}
+
+int
+zstream_do_stats(int argc, char *argv[])
+{
+	chain_attrs_t attrs = {0};
+	stats_context_t *context = &stats_context;
+	const char *input_file = NULL;
+	uint_t num_threads = 0;
+	int c;
+
+	memset(context, 0, sizeof (*context));
+	context->sc_sample_rate = DEFAULT_SAMPLE_RATE;
+
+	while ((c = getopt(argc, argv, ":Cc:Ss:t:")) != -1) {
+		switch (c) {
+		case 'C':
+			ENABLE_OPTION(&attrs, CA_IGNORE_CKSUMS);
+			break;
+		case 'c': {
+			if (context->sc_num_algs == MAX_STATS_ALGS) {
+				errx(2, "at most %d algorithms may be sampled",
+				    MAX_STATS_ALGS);
+			}
+			compression_spec_t spec = parse_compression_spec(
+			    optarg, ZIO_COMPLEVEL_DEFAULT);
+			if (ctype_is_uncompressed(spec.cs_type))
+				errx(2, "invalid compression type %s", optarg);
+			context->sc_algs[context->sc_num_algs] = spec;
+			context->sc_alg_names[context->sc_num_algs++] = optarg;
+			break;
+		}
+		case 's':
+			if (sscanf(optarg, "%llu",
+			    (u_longlong_t *)&context->sc_sample_rate) != 1 ||
+			    context->sc_sample_rate == 0) {
+				warnx("failed to parse sample rate '%s'",
+				    optarg);
+				zstream_usage();
+			}
+			break;
+		case 't':
+			if (sscanf(optarg, "%u", &num_threads) != 1) {
+				warnx("failed to parse num_threads '%s'",
+				    optarg);
+				zstream_usage();
+			}
+			zstream_queue_set_num_threads(num_threads);
+			break;
+		case 'S':
+			pipestats_option(&attrs);
+			break;
+		case ':':
+			warnx("missing argument for '%c' option", optopt);
+			zstream_usage();
+		case '?':
+			warnx("invalid option '%c'", optopt);
+			zstream_usage();
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc > 1)
+		zstream_usage();
+	if (argc == 1)
+		input_file = argv[0];
+
+	zstream_chain_t stats_chain = {
+		STANDARD_INPUT_STACK(input_file),
+		serial_select_samples(),
+		parallel_sample_compression(),
+		serial_collect_stats(),
+		NULL_OUTPUT_STACK()
+	};
+
+	zstream_chain_exec(stats_chain, &attrs);
+
+	nvlist_t *nvl = fnvlist_alloc();
+	nvlist_t *child;
+
+	add_child(nvl, "stream", stream_stats_nvl(&attrs));
+	add_child(nvl, "record_types", record_type_stats_nvl(&attrs));
+
+	child = fnvlist_alloc();
+	fnvlist_add_uint64(child, "object_records", context->sc_object_records);
+	fnvlist_add_uint64(child, "freed_objects", context->sc_freed_objects);
+	add_child(nvl, "objects", child);
+
+	child = fnvlist_alloc();
+	add_count_bytes(child, "write", &context->sc_writes, B_TRUE);
+	add_count_bytes(child, "write_embedded", &context->sc_embedded,
+	    B_TRUE);
+	add_count_bytes(child, "write_byref", &context->sc_byref, B_FALSE);
+	add_count_bytes(child, "spill", &context->sc_spill, B_TRUE);
+	add_child(nvl, "data", child);
+
+	child = fnvlist_alloc();
+	fnvlist_add_uint64(child, "records",
+	    context->sc_frees.cb_records + context->sc_frees_to_end);
+	fnvlist_add_uint64(child, "bytes", context->sc_frees.cb_logical_bytes);
+	fnvlist_add_uint64(child, "to_end_records", context->sc_frees_to_end);
+	add_child(nvl, "holes", child);
+
+	add_child(nvl, "compression", compression_stats_nvl(context));
+	add_child(nvl, "block_sizes", block_size_stats_nvl(context));
+	if (context->sc_num_algs > 0) {
+		add_child(nvl, "compressibility",
+		    compressibility_stats_nvl(context));
+	}
+
+	nvlist_print_json(stdout, nvl);
+	(void) putchar('\n');
+	fnvlist_free(nvl);
+	return (0);
+}
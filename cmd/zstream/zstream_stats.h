@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * https://opensource.org/license/CDDL-1.0.
+ */
+
+/*
+ * Copyright (c) 2026 by Garth Snyder. All rights reserved.
+ */
+
+#ifndef _ZSTREAM_STATS_H
+#define	_ZSTREAM_STATS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "zstream_io.h"
+
+/*
+ * Maximum number of algorithms for compressibility sampling
+ */
+#define	MAX_STATS_ALGS 8
+
+/*
+ * ds_csize[i] is the size of the sampled block after compression with the
+ * i'th candidate algorithm. Valid only when ds_sampled is set.
+ */
+typedef struct {
+	drr_packet_t	ds_base;
+	boolean_t	ds_sampled;
+	uint64_t	ds_csize[MAX_STATS_ALGS];
+} drr_stats_t;
+
+/*
+ * The three steps must appear together, in this order, after the standard
+ * input stack.
+ */
+chain_step_t
+serial_select_samples(void);
+
+chain_step_t
+parallel_sample_compression(void);
+
+chain_step_t
+serial_collect_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _ZSTREAM_STATS_H */
@@ -0,0 +1,202 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * https://opensource.org/license/CDDL-1.0.
+ */
+
+/*
+ * Copyright (c) 2026 by Garth Snyder. All rights reserved.
+ */
+
+/*
+ * zstream transform: apply several stream transformations in one pass.
+ *
+ * Piping one zstream subcommand into another parses every record once per
+ * process, copies every payload through a pipe at each hop, and runs a
+ * separate worker pool in each process. This subcommand assembles the
+ * same steps those subcommands use into a single chain, so records are
+ * parsed once and all parallel steps draw on one zstream_queue thread pool.
+ *
+ * Steps always run in a fixed order regardless of the order of options:
+ *
+ *   verify MACs -> redup -> drop_record -> decompress -> recompress
+ *
+ * MAC verification (-K) sees records exactly as they arrived, so that a
+ * relay can refuse to forward a damaged raw stream. Redup comes next so
+ * that the records it materializes are visible to the later steps. Named
+ * decompression precedes recompression so that repaired records can be
+ * recompressed in the same pass.
+ */
+
+#include <err.h>
+#include <search.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stdtypes.h>
+#include <sys/sysmacros.h>
+#include <sys/zio_compress.h>
+#include <unistd.h>
+
+#include "zstream.h"
+#include "zstream_modules.h"
+#include "zstream_util.h"
+
+#define	MAX_TRANSFORM_STEPS 24
+
+static int
+append_steps(chain_step_t *chain, int next, chain_step_t *steps,
+    size_t count)
+{
+	VERIFY3U(next + count, <=, MAX_TRANSFORM_STEPS);
+	for (size_t i = 0; i < count; i++) {
+		chain[next++] = steps[i];
+	}
+	return (next);
+}
+
+int
+zstream_do_transform(int argc, char *argv[])
+{
+	chain_attrs_t attrs = {0};
+	chain_step_t chain[MAX_TRANSFORM_STEPS];
+	const char *input_file = NULL;
+	const char *ctype_name = NULL;
+	const char *keyfile = NULL;
+	boolean_t redup = B_FALSE;
+	boolean_t verbose = B_FALSE;
+	int level = ZIO_COMPLEVEL_DEFAULT;
+	uint_t num_threads = 0;
+	int num_drops = 0, num_decompress = 0;
+	int c, n = 0;
+
+	char **drops = safe_calloc(argc * sizeof (char *));
+	char **decompress = safe_calloc(argc * sizeof (char *));
+
+	while ((c = getopt(argc, argv, ":c:d:K:l:rSt:vwx:")) != -1) {
+		switch (c) {
+		case 'c':
+			ctype_name = optarg;
+			break;
+		case 'd':
+			decompress[num_decompress++] = optarg;
+			break;
+		case 'K':
+			keyfile = optarg;
+			break;
+		case 'l':
+			if (sscanf(optarg, "%d", &level) != 1) {
+				warnx("failed to parse level '%s'", optarg);
+				zstream_usage();
+			}
+			break;
+		case 'r':
+			redup = B_TRUE;
+			break;
+		case 't':
+			if (sscanf(optarg, "%u", &num_threads) != 1) {
+				warnx("failed to parse num_threads '%s'",
+				    optarg);
+				zstream_usage();
+			}
+			zstream_queue_set_num_threads(num_threads);
+			break;
+		case 'v':
+			ENABLE_OPTION(&attrs, CA_VERBOSE);
+			verbose = B_TRUE;
+			break;
+		case 'w':
+			zstream_queue_set_scheduler(ZQ_SCHED_AFFINE);
+			break;
+		case 'x':
+			drops[num_drops++] = optarg;
+			break;
+		case 'S':
+			pipestats_option(&attrs);
+			break;
+		case ':':
+			warnx("missing argument for '%c' option", optopt);
+			zstream_usage();
+		case '?':
+			warnx("invalid option '%c'", optopt);
+			zstream_usage();
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc > 1)
+		zstream_usage();
+	if (argc == 1)
+		input_file = argv[0];
+	if (redup && input_file == NULL) {
+		warnx("redup (-r) requires the stream to be named as FILE");
+		zstream_usage();
+	}
+	if (!redup)
+		ENABLE_OPTION(&attrs, CA_FORBID_DEDUP);
+
+	if (hcreate(num_drops + num_decompress) == 0)
+		errx(1, "hcreate failed");
+	for (int i = 0; i < num_drops; i++)
+		drop_record_add(drops[i]);
+	for (int i = 0; i < num_decompress; i++)
+		decompress_record_add(decompress[i]);
+
+	chain_step_t input_stack[] = { STANDARD_INPUT_STACK(input_file) };
+	n = append_steps(chain, n, input_stack, ARRAY_SIZE(input_stack));
+
+	if (keyfile != NULL) {
+		chain_step_t mac_steps[] = {
+			serial_assign_mac_keys(keyfile),
+			parallel_verify_macs(),
+			serial_check_macs()
+		};
+		n = append_steps(chain, n, mac_steps, ARRAY_SIZE(mac_steps));
+	}
+	if (redup) {
+		chain[n++] = serial_redup_writes(input_file);
+		chain[n++] = parallel_redup_read();
+	}
+	if (num_drops > 0) {
+		chain[n++] = serial_drop_records();
+	}
+	if (num_decompress > 0) {
+		chain[n++] = serial_decompress_named_writes();
+	}
+	if (ctype_name != NULL) {
+		compression_spec_t spec = parse_compression_spec(ctype_name,
+		    level);
+		chain_step_t recompress_steps[] = {
+			parallel_decompress_writes(&spec),
+			parallel_compress_writes(&spec),
+			serial_update_compress_features(&spec)
+		};
+		n = append_steps(chain, n, recompress_steps,
+		    ARRAY_SIZE(recompress_steps));
+	}
+
+	chain_step_t output_stack[] = { STANDARD_OUTPUT_STACK(NULL) };
+	n = append_steps(chain, n, output_stack, ARRAY_SIZE(output_stack));
+
+	zstream_chain_exec(chain, &attrs);
+
+	if (keyfile != NULL)
+		mac_verify_fini(&attrs);
+	if (redup)
+		redup_fini(&attrs);
+	if (verbose)
+		zstream_queue_print_stats(stderr);
+	hdestroy();
+	free(drops);
+	free(decompress);
+	return (0);
+}
@@ -174,6 +174,7 @@ serial_validate_records(void)
 
 	chain_step_t step = {
 		.cs_type = CS_SERIAL,
+		.cs_name = "validate_records",
 		.cs_in_size = sizeof (drr_packet_t),
 		.cs_out_size = sizeof (drr_packet_t),
 		.cs_context = context,
@@ -262,7 +262,11 @@ extern uint64_t metaslab_df_alloc_threshold;
 extern uint64_t zfs_deadman_synctime_ms;
 extern uint_t metaslab_preload_limit;
 extern int zfs_compressed_arc_enabled;
+extern uint_t zfs_arc_admit_min_freq;
+extern void arc_sketch_alloc(void);
 extern int zfs_abd_scatter_enabled;
+extern int zio_interrupt_batch;
+extern uint_t zio_interrupt_batch_max;
 extern uint_t dmu_object_alloc_chunk_shift;
 extern boolean_t zfs_force_some_double_word_sm_entries;
 extern unsigned long zfs_reconstruct_indirect_damage_fraction;
@@ -6262,6 +6266,17 @@ ztest_dsl_prop_get_set(ztest_ds_t *zd, uint64_t id)
 	    ztest_random_blocksize(), (int)ztest_random(2));
 	ASSERT(error == 0 || error == ENOSPC);
 
+	/*
+	 * Small ARC limits and reservations, so that quota eviction runs
+	 * alongside everything else; none half the time.
+	 */
+	error = ztest_dsl_prop_set_uint64(zd->zd_name, ZFS_PROP_ARCQUOTA,
+	    ztest_random(2) ? 0 : (1 + ztest_random(16)) << 20, B_FALSE);
+	ASSERT(error == 0 || error == ENOSPC);
+	error = ztest_dsl_prop_set_uint64(zd->zd_name, ZFS_PROP_ARCRESERVATION,
+	    ztest_random(2) ? 0 : (1 + ztest_random(16)) << 20, B_FALSE);
+	ASSERT(error == 0 || error == ENOSPC);
+
 	(void) pthread_rwlock_unlock(&ztest_name_lock);
 }
 
@@ -7574,11 +7589,27 @@ ztest_resume_thread(void *arg)
 		if (ztest_random(10) == 0)
 			zfs_compressed_arc_enabled = ztest_random(2);
 
+		/*
+		 * Periodically change the zfs_arc_admit_min_freq setting.
+		 */
+		if (ztest_random(10) == 0) {
+			zfs_arc_admit_min_freq = ztest_random(4);
+			arc_sketch_alloc();
+		}
+
 		/*
 		 * Periodically change the zfs_abd_scatter_enabled setting.
 		 */
 		if (ztest_random(10) == 0)
 			zfs_abd_scatter_enabled = ztest_random(2);
+
+		/*
+		 * Periodically change the zio_interrupt_batch settings.
+		 */
+		if (ztest_random(10) == 0) {
+			zio_interrupt_batch = ztest_random(2);
+			zio_interrupt_batch_max = 1 + ztest_random(16);
+		}
 	}
 
 	thread_exit();
@@ -234,6 +234,33 @@ AC_DEFUN([ZFS_AC_KERNEL_BIO_ALLOC_4ARG], [
 	])
 ])
 
+dnl #
+dnl # Linux 5.17 API
+dnl #
+dnl # Polled I/O became bio based: a bio marked REQ_POLLED (formerly
+dnl # REQ_HIPRI) is completed by calling bio_poll() on it.
+dnl #
+AC_DEFUN([ZFS_AC_KERNEL_SRC_BIO_POLL], [
+	ZFS_LINUX_TEST_SRC([bio_poll], [
+		#include <linux/bio.h>
+		#include <linux/blkdev.h>
+	],[
+		struct bio *bio = NULL;
+		bio->bi_opf |= REQ_POLLED;
+		(void) bio_poll(bio, NULL, 0);
+	])
+])
+
+AC_DEFUN([ZFS_AC_KERNEL_BIO_POLL], [
+	AC_MSG_CHECKING([whether bio_poll() exists])
+	ZFS_LINUX_TEST_RESULT([bio_poll], [
+		AC_MSG_RESULT(yes)
+		AC_DEFINE(HAVE_BIO_POLL, 1, [bio_poll() exists])
+	],[
+		AC_MSG_RESULT(no)
+	])
+])
+
 AC_DEFUN([ZFS_AC_KERNEL_SRC_BIO], [
 	ZFS_AC_KERNEL_SRC_BIO_OPS
 	ZFS_AC_KERNEL_SRC_BIO_SET_DEV
@@ -243,6 +270,7 @@ AC_DEFUN([ZFS_AC_KERNEL_SRC_BIO], [
 	ZFS_AC_KERNEL_SRC_BDEV_SUBMIT_BIO_RETURNS_VOID
 	ZFS_AC_KERNEL_SRC_BIO_SET_DEV_MACRO
 	ZFS_AC_KERNEL_SRC_BIO_ALLOC_4ARG
+	ZFS_AC_KERNEL_SRC_BIO_POLL
 ])
 
 AC_DEFUN([ZFS_AC_KERNEL_BIO], [
@@ -253,4 +281,5 @@ AC_DEFUN([ZFS_AC_KERNEL_BIO], [
 	ZFS_AC_KERNEL_BIO_BDEV_DISK
 	ZFS_AC_KERNEL_BDEV_SUBMIT_BIO_RETURNS_VOID
 	ZFS_AC_KERNEL_BIO_ALLOC_4ARG
+	ZFS_AC_KERNEL_BIO_POLL
 ])
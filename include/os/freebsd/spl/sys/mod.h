@@ -68,6 +68,9 @@
 #define	param_set_l2arc_dwpd_limit_args(var) \
     CTLTYPE_U64, &var, 0, param_set_l2arc_dwpd_limit, "QU"
 
+#define	param_set_arc_admit_min_freq_args(var) \
+    CTLTYPE_UINT, &var, 0, param_set_arc_admit_min_freq, "IU"
+
 #define	param_set_arc_free_target_args(var) \
     CTLTYPE_UINT, NULL, 0, param_set_arc_free_target, "IU"
 
@@ -442,6 +442,27 @@ bdev_discard_supported(struct block_device *bdev)
 #endif
 }
 
+/*
+ * 6.11 API,
+ *   BLK_FEAT_POLL in queue_limits.features
+ *
+ * 5.17 API,
+ *   QUEUE_FLAG_POLL, with bio_poll()
+ *
+ * Without either, the device is treated as unable to poll.
+ */
+static inline boolean_t
+bdev_poll_supported(struct block_device *bdev)
+{
+#if defined(HAVE_BIO_POLL) && defined(BLK_FEAT_POLL)
+	return ((bdev_get_queue(bdev)->limits.features & BLK_FEAT_POLL) != 0);
+#elif defined(HAVE_BIO_POLL) && defined(QUEUE_FLAG_POLL)
+	return (test_bit(QUEUE_FLAG_POLL, &bdev_get_queue(bdev)->queue_flags));
+#else
+	return (B_FALSE);
+#endif
+}
+
 /*
  * 5.19 API,
  *   bdev_max_secure_erase_sectors()
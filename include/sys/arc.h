@@ -320,6 +320,8 @@ int arc_cached(spa_t *spa, const blkptr_t *bp);
 
 void arc_flush(spa_t *spa, boolean_t retry);
 void arc_flush_async(spa_t *spa);
+void arc_quota_set(spa_t *spa, uint64_t objset, uint64_t limit,
+    uint64_t reserve);
 void arc_tempreserve_clear(uint64_t reserve);
 int arc_tempreserve_space(spa_t *spa, uint64_t reserve, uint64_t txg);
 boolean_t arc_async_flush_guid_inuse(uint64_t load_guid);
@@ -63,6 +63,12 @@ typedef struct l2arc_info {
 	 */
 	uint64_t	l2arc_ext_scanned[L2ARC_FEED_TYPES];
 	int		l2arc_next_sublist[L2ARC_FEED_TYPES]; /* round-robin */
+	/*
+	 * Sum and number of the devices' measured l2ad_write_bw, for
+	 * l2arc_write_balance.  Protected by l2arc_sublist_lock.
+	 */
+	uint64_t	l2arc_write_bw_total;
+	uint64_t	l2arc_write_bw_ndev;
 } l2arc_info_t;
 
 /*
@@ -121,6 +127,31 @@ typedef struct arc_state {
 	wmsum_t arcs_hits[ARC_BUFC_NUMTYPES];
 } arc_state_t;
 
+/*
+ * Per-objset ARC limit and reservation, set through the "arcquota" and
+ * "arcreservation" dataset properties.  Quotas are kept in an AVL tree
+ * keyed by (spa load guid, objset id) and are referenced from the L1
+ * headers of the blocks charged to them.  A header acquires its quota
+ * while it holds no data in a cached state (when it is created by
+ * arc_read() or arc_write(), or when it is brought back from a ghost
+ * state), so that aq_size only ever sees matched charges and credits.
+ *
+ * A quota that is cleared stays in the tree, inactive, until the last
+ * header referencing it goes away; only the eviction thread frees it.
+ */
+typedef struct arc_quota {
+	avl_node_t	aq_node;
+	uint64_t	aq_spa;		/* spa load guid */
+	uint64_t	aq_objset;
+	uint64_t	aq_refcnt;	/* headers referencing this quota */
+	uint64_t	aq_limit;	/* "arcquota", 0 if none */
+	uint64_t	aq_reserve;	/* "arcreservation", 0 if none */
+	boolean_t	aq_active;	/* aq_limit or aq_reserve is set */
+	boolean_t	aq_protected;	/* skip during normal eviction */
+	int64_t		aq_excess;	/* bytes left to evict this round */
+	aggsum_t	aq_size;	/* bytes in mru, mfu and uncached */
+} arc_quota_t;
+
 typedef struct arc_callback arc_callback_t;
 
 struct arc_callback {
@@ -203,6 +234,9 @@ typedef struct l1arc_buf_hdr {
 	arc_callback_t		*b_acb;
 	abd_t			*b_pabd;
 
+	/* set while charge-free (anon or ghost), protected by hash lock */
+	struct arc_quota	*b_quota;
+
 #ifdef ZFS_DEBUG
 	zio_cksum_t		*b_freeze_cksum;
 	kmutex_t		b_freeze_lock;
@@ -452,6 +486,11 @@ typedef struct l2arc_dev {
 	uint64_t		l2ad_dwpd_start;	/* 24h period start */
 	uint64_t		l2ad_dwpd_accumulated;	/* Accumulated */
 	uint64_t		l2ad_dwpd_bump;		/* Reset trigger */
+	/*
+	 * Smoothed write throughput in bytes per second, measured over feed
+	 * cycles that wrote most of their target size.  Zero until measured.
+	 */
+	uint64_t		l2ad_write_bw;
 	/*
 	 * Per-device feed thread for parallel L2ARC writes
 	 */
@@ -497,12 +536,15 @@ typedef struct arc_buf_hdr_crypt {
 	uint8_t			b_mac[ZIO_DATA_MAC_LEN];
 } arc_buf_hdr_crypt_t;
 
+/*
+ * The L2ARC hit count and ARC state live in arc_buf_hdr_t itself, as
+ * b_l2hits and b_l2arcs_state, where they fill what would otherwise be
+ * padding.
+ */
 typedef struct l2arc_buf_hdr {
 	/* protected by arc_buf_hdr mutex */
 	l2arc_dev_t		*b_dev;		/* L2ARC device */
 	uint64_t		b_daddr;	/* disk address, offset byte */
-	uint32_t		b_hits;
-	arc_state_type_t	b_arcs_state;
 	list_node_t		b_l2node;
 } l2arc_buf_hdr_t;
 
@@ -511,18 +553,25 @@ typedef struct l2arc_write_callback {
 	arc_buf_hdr_t	*l2wcb_head;		/* head of write buflist */
 	/* in-flight list of log blocks */
 	list_t		l2wcb_abd_list;
+	/* device busy time of the writes, for l2ad_write_bw */
+	kmutex_t	l2wcb_busy_lock;
+	hrtime_t	l2wcb_busy;	/* time writes were outstanding */
+	hrtime_t	l2wcb_busy_end;	/* latest write completion */
+	uint64_t	l2wcb_sample_asize;	/* bytes to sample, or zero */
 } l2arc_write_callback_t;
 
+/*
+ * Every block cached only in the L2ARC costs one header of size
+ * offsetof(arc_buf_hdr_t, b_l1hdr) in memory, so the fields before
+ * b_l1hdr are ordered and sized to leave no padding: 88 bytes with 64-bit
+ * pointers.
+ */
 struct arc_buf_hdr {
 	/* protected by hash lock */
 	dva_t			b_dva;
 	uint64_t		b_birth;
-
-	arc_buf_contents_t	b_type;
-	uint8_t			b_complevel;
-	uint8_t			b_reserved1;	/* used for 4 byte alignment */
-	uint16_t		b_l2size;	/* alignment or L2-only size */
 	arc_buf_hdr_t		*b_hash_next;
+	uint64_t		b_spa;		/* immutable */
 	arc_flags_t		b_flags;
 
 	/*
@@ -550,9 +599,14 @@ struct arc_buf_hdr {
 	 * of SPA_MINBLOCKSIZE (e.g. 2 == 1024 bytes)
 	 */
 	uint16_t		b_lsize;	/* immutable */
-	uint64_t		b_spa;		/* immutable */
+	uint16_t		b_l2size;	/* alignment or L2-only size */
+	uint8_t			b_type;		/* arc_buf_contents_t */
+	uint8_t			b_complevel;
 
 	/* L2ARC fields. Undefined when not in L2ARC. */
+	uint16_t		b_l2hits;	/* saturates at UINT16_MAX */
+	uint8_t			b_l2arcs_state;	/* arc_state_type_t */
+	uint8_t			b_numa_node;	/* see arc_hdr_set_numa_node */
 	l2arc_buf_hdr_t		b_l2hdr;
 	/* L1ARC fields. Undefined when in l2arc_only state */
 	l1arc_buf_hdr_t		b_l1hdr;
@@ -615,6 +669,29 @@ typedef struct arc_stats {
 	 * buffers to reach its target amount.
 	 */
 	kstat_named_t arcstat_evict_not_enough;
+	/*
+	 * Number of bytes evicted because they were charged to an objset
+	 * that was over its arcquota.
+	 */
+	kstat_named_t arcstat_quota_evicted;
+	/*
+	 * Number of buffers skipped during eviction because they were
+	 * charged to an objset that is within its arcreservation.
+	 */
+	kstat_named_t arcstat_quota_skip;
+	/*
+	 * Number of eviction rounds in which the total of all reservations
+	 * exceeded zfs_arc_quota_reserve_pct of arc_c, so that no
+	 * reservations were honored.
+	 */
+	kstat_named_t arcstat_quota_reserve_overcommit;
+	/*
+	 * Number of data blocks read into a full ARC that the admission
+	 * filter (zfs_arc_admit_min_freq) admitted to the MRU state, or
+	 * rejected by placing them in the uncached state instead.
+	 */
+	kstat_named_t arcstat_admit_accepted;
+	kstat_named_t arcstat_admit_rejected;
 	kstat_named_t arcstat_evict_l2_cached;
 	kstat_named_t arcstat_evict_l2_eligible;
 	kstat_named_t arcstat_evict_l2_eligible_mfu;
@@ -925,6 +1002,15 @@ typedef struct arc_stats {
 	 * log block may hold up to L2ARC_LOG_BLK_MAX_ENTRIES buffers.
 	 */
 	kstat_named_t arcstat_l2_rebuild_log_blks;
+	/*
+	 * Rebuild progress: the number of devices currently rebuilding, the
+	 * number of log blocks their device headers listed when the rebuild
+	 * started, and the number of log blocks read and awaiting
+	 * restoration.
+	 */
+	kstat_named_t arcstat_l2_rebuild_active;
+	kstat_named_t arcstat_l2_rebuild_log_blks_expected;
+	kstat_named_t arcstat_l2_rebuild_log_blks_pending;
 	kstat_named_t arcstat_memory_throttle_count;
 	kstat_named_t arcstat_memory_direct_count;
 	kstat_named_t arcstat_memory_indirect_count;
@@ -944,6 +1030,8 @@ typedef struct arc_stats {
 	kstat_named_t arcstat_demand_hit_predictive_prefetch;
 	/* Number of requests for which predictive prefetch was running. */
 	kstat_named_t arcstat_demand_iohit_predictive_prefetch;
+	/* Number of predictively prefetched buffers evicted unused. */
+	kstat_named_t arcstat_evict_unused_predictive_prefetch;
 	/* Number of prescient prefetch requests. */
 	kstat_named_t arcstat_prescient_prefetch;
 	/* Number of requests for which prescient prefetch has completed. */
@@ -983,6 +1071,11 @@ typedef struct arc_sums {
 	wmsum_t arcstat_access_skip;
 	wmsum_t arcstat_evict_skip;
 	wmsum_t arcstat_evict_not_enough;
+	wmsum_t arcstat_quota_evicted;
+	wmsum_t arcstat_quota_skip;
+	wmsum_t arcstat_quota_reserve_overcommit;
+	wmsum_t arcstat_admit_accepted;
+	wmsum_t arcstat_admit_rejected;
 	wmsum_t arcstat_evict_l2_cached;
 	wmsum_t arcstat_evict_l2_eligible;
 	wmsum_t arcstat_evict_l2_eligible_mfu;
@@ -1041,6 +1134,9 @@ typedef struct arc_sums {
 	wmsum_t arcstat_l2_rebuild_bufs;
 	wmsum_t arcstat_l2_rebuild_bufs_precached;
 	wmsum_t arcstat_l2_rebuild_log_blks;
+	wmsum_t arcstat_l2_rebuild_active;
+	wmsum_t arcstat_l2_rebuild_log_blks_expected;
+	wmsum_t arcstat_l2_rebuild_log_blks_pending;
 	wmsum_t arcstat_memory_throttle_count;
 	wmsum_t arcstat_memory_direct_count;
 	wmsum_t arcstat_memory_indirect_count;
@@ -1050,6 +1146,7 @@ typedef struct arc_sums {
 	wmsum_t arcstat_predictive_prefetch;
 	wmsum_t arcstat_demand_hit_predictive_prefetch;
 	wmsum_t arcstat_demand_iohit_predictive_prefetch;
+	wmsum_t arcstat_evict_unused_predictive_prefetch;
 	wmsum_t arcstat_prescient_prefetch;
 	wmsum_t arcstat_demand_hit_prescient_prefetch;
 	wmsum_t arcstat_demand_iohit_prescient_prefetch;
@@ -1120,14 +1217,18 @@ extern int64_t arc_available_memory(void);
 extern void arc_tuning_update(boolean_t);
 extern void arc_register_hotplug(void);
 extern void arc_unregister_hotplug(void);
+extern uint_t arc_numa_node_count(void);
+extern void arc_numa_note_pressure(int node);
 
 extern int param_set_arc_u64(ZFS_MODULE_PARAM_ARGS);
 extern int param_set_arc_int(ZFS_MODULE_PARAM_ARGS);
 extern int param_set_arc_min(ZFS_MODULE_PARAM_ARGS);
 extern int param_set_arc_max(ZFS_MODULE_PARAM_ARGS);
 extern int param_set_l2arc_dwpd_limit(ZFS_MODULE_PARAM_ARGS);
+extern int param_set_arc_admit_min_freq(ZFS_MODULE_PARAM_ARGS);
 extern int param_set_arc_no_grow_shift(ZFS_MODULE_PARAM_ARGS);
 extern void l2arc_dwpd_bump_reset(void);
+extern void arc_sketch_alloc(void);
 
 /* used in zdb.c */
 boolean_t l2arc_log_blkptr_valid(l2arc_dev_t *dev,
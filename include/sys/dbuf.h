@@ -319,14 +319,25 @@ typedef struct dmu_buf_impl {
 	dmu_buf_user_t *db_user;
 } dmu_buf_impl_t;
 
-#define	DBUF_HASH_MUTEX(h, idx) \
-	(&(h)->hash_mutexes[(idx) & ((h)->hash_mutex_mask)])
+/*
+ * Each hash chain is protected by one of an array of reader/writer locks.
+ * Lookups in dbuf_find() are mostly hits on hot blocks and only need the
+ * lock as reader, so they do not serialize against each other; inserts and
+ * removals take it as writer.  Each lock is padded to a cache line so that
+ * neighbouring chains do not share one.
+ */
+typedef struct dbuf_hash_lock {
+	krwlock_t	hl_lock;
+} ____cacheline_aligned dbuf_hash_lock_t;
+
+#define	DBUF_HASH_LOCK(h, idx) \
+	(&(h)->hash_locks[(idx) & ((h)->hash_lock_mask)].hl_lock)
 
 typedef struct dbuf_hash_table {
 	uint64_t hash_table_mask;
-	uint64_t hash_mutex_mask;
+	uint64_t hash_lock_mask;
 	dmu_buf_impl_t **hash_table;
-	kmutex_t *hash_mutexes;
+	dbuf_hash_lock_t *hash_locks;
 } dbuf_hash_table_t;
 
 typedef void (*dbuf_prefetch_fn)(void *, uint64_t, uint64_t, boolean_t);
@@ -128,6 +128,8 @@ struct objset {
 	zfs_direct_t os_direct;
 	zfs_redundant_metadata_type_t os_redundant_metadata;
 	uint64_t os_recordsize;
+	uint64_t os_arc_quota;
+	uint64_t os_arc_reservation;
 	/*
 	 * The next four values are used as a cache of whatever's on disk, and
 	 * are initialized the first time these properties are queried. Before
@@ -195,6 +195,8 @@ typedef enum {
 	ZFS_PROP_DEFAULTPROJECTOBJQUOTA,
 	ZFS_PROP_SNAPSHOTS_CHANGED_NSECS,
 	ZFS_PROP_ZONED_UID,
+	ZFS_PROP_ARCQUOTA,
+	ZFS_PROP_ARCRESERVATION,
 	ZFS_NUM_PROPS
 } zfs_prop_t;
 
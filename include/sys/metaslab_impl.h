@@ -208,6 +208,21 @@ struct metaslab_class {
 	metaslab_class_allocator_t	mc_allocator[];
 };
 
+/*
+ * A range carved out of a metaslab's ms_allocatable for one allocator and
+ * txg (see metaslab_reserve_size).  The whole range is added to the
+ * metaslab's ms_allocating tree when it is reserved, so allocations from
+ * it only need to advance mr_offset, which is done atomically and without
+ * the ms_lock.  Whatever is left when the txg syncs is given back.
+ */
+typedef struct metaslab_reserve {
+	metaslab_t		*mr_msp;
+	uint64_t		mr_txg;
+	volatile uint64_t	mr_offset;	/* next free offset */
+	uint64_t		mr_end;
+	struct metaslab_reserve	*mr_next;	/* older reserves, same txg */
+} metaslab_reserve_t;
+
 /*
  * Per-allocator data structure.
  */
@@ -215,6 +230,12 @@ typedef struct metaslab_group_allocator {
 	zfs_refcount_t	mga_queue_depth;
 	metaslab_t	*mga_primary;
 	metaslab_t	*mga_secondary;
+
+	/*
+	 * Reserved ranges, newest first, for each open txg.  The heads are
+	 * read without locks; they are set under the mg_lock.
+	 */
+	metaslab_reserve_t *volatile mga_reserve[TXG_SIZE];
 } ____cacheline_aligned metaslab_group_allocator_t;
 
 /*
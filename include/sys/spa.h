@@ -938,6 +938,7 @@ typedef struct spa_stats {
 	spa_history_kstat_t	guid;		/* pool guid */
 	spa_history_kstat_t	iostats;
 	spa_history_kstat_t	log_spacemaps;
+	spa_history_kstat_t	zio_stages;	/* per-stage zio latency */
 } spa_stats_t;
 
 typedef enum txg_state {
@@ -997,6 +998,8 @@ extern txg_stat_t *spa_txg_history_init_io(spa_t *, uint64_t,
     struct dsl_pool *);
 extern void spa_txg_history_fini_io(spa_t *, txg_stat_t *);
 extern void spa_tx_assign_add_nsecs(spa_t *spa, uint64_t nsecs);
+extern void spa_zio_stage_add_nsecs(spa_t *spa, zio_type_t type,
+    uint64_t stage, uint64_t nsecs);
 extern int spa_mmp_history_set_skip(spa_t *spa, uint64_t mmp_kstat_id);
 extern int spa_mmp_history_set(spa_t *spa, uint64_t mmp_kstat_id, int io_error,
     hrtime_t duration);
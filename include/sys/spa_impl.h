@@ -182,9 +182,25 @@ typedef enum spa_proc_state {
 	SPA_PROC_GONE		/* spa_thread() is exiting, spa_proc = &p0 */
 } spa_proc_state_t;
 
+/*
+ * Interrupt taskqs may run completed zios in batches (see
+ * zio_taskq_dispatch()).  Zios are pushed onto a per-CPU batch, which
+ * needs no lock and so may be fed from interrupt context, and a single
+ * dispatch of stb_tqent runs everything that accumulated on it.
+ */
+typedef struct spa_taskq_batch {
+	zio_t *volatile	stb_head;	/* pushed zios, newest first */
+	uint32_t	stb_scheduled;	/* stb_tqent is dispatched */
+	taskq_t		*stb_taskq;
+	struct spa_taskqs *stb_tqs;	/* for zios beyond the limit */
+	taskq_ent_t	stb_tqent;
+} ____cacheline_aligned spa_taskq_batch_t;
+
 typedef struct spa_taskqs {
 	uint_t stqs_count;
 	taskq_t **stqs_taskq;
+	uint_t stqs_nbatch;
+	spa_taskq_batch_t *stqs_batch;
 } spa_taskqs_t;
 
 /* one for each thread in the spa sync taskq */
@@ -490,6 +490,7 @@ struct zio {
 	blkptr_t	io_bp_copy;
 	list_t		io_parent_list;
 	list_t		io_child_list;
+	zio_link_t	io_parent_link;	/* link to the parent given at create */
 	zio_t		*io_logical;
 	zio_transform_t *io_transform_stack;
 
@@ -540,6 +541,8 @@ struct zio {
 	enum zio_stage	io_orig_stage;
 	enum zio_stage	io_orig_pipeline;
 	enum zio_stage	io_pipeline_trace;
+	enum zio_stage	io_stage_timed;	/* stage io_stage_ts belongs to */
+	hrtime_t	io_stage_ts;	/* start of io_stage_timed */
 	int		io_error;
 	int		io_child_error[ZIO_CHILD_TYPES];
 	uint64_t	io_children[ZIO_CHILD_TYPES][ZIO_WAIT_TYPES];
@@ -559,6 +562,7 @@ struct zio {
 
 	/* Taskq dispatching state */
 	taskq_ent_t	io_tqent;
+	zio_t		*io_batch_next;	/* spa_taskq_batch_t stb_head */
 };
 
 enum blk_verify_flag {
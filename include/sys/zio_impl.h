@@ -156,6 +156,9 @@ enum zio_stage {
 	ZIO_STAGE_DONE			= 1 << 26	/* RWFCXT */
 };
 
+/* Number of pipeline stages; a stage's index is highbit64(stage) - 1. */
+#define	ZIO_STAGES				27
+
 #define	ZIO_ROOT_PIPELINE			\
 	ZIO_STAGE_DONE
 
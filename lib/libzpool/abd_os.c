@@ -355,6 +355,13 @@ abd_cache_reap_now(void)
 {
 }
 
+int
+abd_numa_node(abd_t *abd)
+{
+	(void) abd;
+	return (0);
+}
+
 /*
  * Borrow a raw buffer from an ABD without copying the contents of the ABD
  * into the buffer. If the ABD is scattered, this will alloate a raw buffer
@@ -76,3 +76,9 @@ void
 arc_unregister_hotplug(void)
 {
 }
+
+uint_t
+arc_numa_node_count(void)
+{
+	return (1);
+}
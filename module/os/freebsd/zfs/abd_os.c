@@ -586,6 +586,16 @@ abd_cache_reap_now(void)
 	kmem_cache_reap_soon(abd_chunk_cache);
 }
 
+/*
+ * ABD chunks are not allocated per domain, see arc_numa_node_count().
+ */
+int
+abd_numa_node(abd_t *abd)
+{
+	(void) abd;
+	return (0);
+}
+
 /*
  * Borrow a raw buffer from an ABD without copying the contents of the ABD
  * into the buffer. If the ABD is scattered, this will alloate a raw buffer
@@ -185,3 +185,12 @@ void
 arc_unregister_hotplug(void)
 {
 }
+
+/*
+ * NUMA mode needs abd_numa_node(), which is not implemented here.
+ */
+uint_t
+arc_numa_node_count(void)
+{
+	return (1);
+}
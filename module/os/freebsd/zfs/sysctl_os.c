@@ -179,6 +179,20 @@ param_set_l2arc_dwpd_limit(SYSCTL_HANDLER_ARGS)
 	return (0);
 }
 
+int
+param_set_arc_admit_min_freq(SYSCTL_HANDLER_ARGS)
+{
+	int err;
+
+	err = sysctl_handle_int(oidp, arg1, 0, req);
+	if (err != 0 || req->newptr == NULL)
+		return (err);
+
+	arc_sketch_alloc();
+
+	return (0);
+}
+
 int
 param_set_arc_max(SYSCTL_HANDLER_ARGS)
 {
@@ -960,6 +960,29 @@ abd_cache_reap_now(void)
 {
 }
 
+/*
+ * Return the NUMA node holding the first page of an ABD's data.
+ */
+int
+abd_numa_node(abd_t *abd)
+{
+	struct page *page;
+
+	if (abd_is_gang(abd))
+		return (0);
+
+	if (abd_is_linear(abd)) {
+		void *buf = ABD_LINEAR_BUF(abd);
+
+		page = is_vmalloc_addr(buf) ? vmalloc_to_page(buf) :
+		    virt_to_page(buf);
+	} else {
+		page = sg_page(ABD_SCATTER(abd).abd_sgl);
+	}
+
+	return (page_to_nid(page));
+}
+
 /*
  * Borrow a raw buffer from an ABD without copying the contents of the ABD
  * into the buffer. If the ABD is scattered, this will allocate a raw buffer
@@ -206,6 +206,12 @@ arc_shrinker_scan(struct shrinker *shrink, struct shrink_control *sc)
 	 */
 	arc_no_grow = B_TRUE;
 
+	/*
+	 * Reclaim runs on the node that is short of memory, either from
+	 * that node's kswapd or from an allocation made there.
+	 */
+	arc_numa_note_pressure(numa_node_id());
+
 	/*
 	 * Evict the requested number of pages by reducing arc_c and waiting
 	 * for the requested amount of data to be evicted.  To avoid deadlock
@@ -434,6 +440,20 @@ param_set_l2arc_dwpd_limit(const char *buf, zfs_kernel_param_t *kp)
 	return (0);
 }
 
+int
+param_set_arc_admit_min_freq(const char *buf, zfs_kernel_param_t *kp)
+{
+	int error;
+
+	error = param_set_uint(buf, kp);
+	if (error < 0)
+		return (SET_ERROR(error));
+
+	arc_sketch_alloc();
+
+	return (0);
+}
+
 #ifdef CONFIG_MEMORY_HOTPLUG
 static int
 arc_hotplug_callback(struct notifier_block *self, unsigned long action,
@@ -480,6 +500,12 @@ arc_unregister_hotplug(void)
 #endif
 }
 
+uint_t
+arc_numa_node_count(void)
+{
+	return (nr_node_ids);
+}
+
 ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, shrinker_limit, INT, ZMOD_RW,
 	"Limit on number of pages that ARC shrinker can reclaim at once");
 ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, shrinker_seeks, INT, ZMOD_RD,
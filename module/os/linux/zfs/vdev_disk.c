@@ -64,6 +64,7 @@ typedef void zfs_bdev_handle_t;
 typedef struct vdev_disk {
 	zfs_bdev_handle_t		*vd_bdh;
 	krwlock_t			vd_lock;
+	boolean_t			vd_can_poll;	/* has poll queues */
 } vdev_disk_t;
 
 /*
@@ -105,6 +106,34 @@ static unsigned int zfs_vdev_failfast_mask = 1;
  */
 static unsigned int zfs_vdev_disk_calling_thread_io = 0;
 
+/*
+ * With calling thread io, busy-poll for the completion of synchronous
+ * reads and writes to non-rotational devices instead of sleeping until
+ * the completion interrupt wakes the thread.  Requires a kernel with
+ * bio_poll() and a device with poll queues (e.g. nvme.poll_queues);
+ * other devices use the normal submit and wait.
+ */
+static unsigned int zfs_vdev_disk_poll_io = 0;
+
+/*
+ * Latency of the synchronous reads and writes to non-rotational devices
+ * that calling thread io completes, in power of two microsecond buckets,
+ * kept apart for I/Os that were polled and I/Os that waited for the
+ * completion interrupt.  Bucket i counts I/Os that took less than 2^i us
+ * (and at least 2^(i-1) us); the last one counts everything slower.
+ * Exported as the vdev_disk_sync_latency kstat.
+ */
+#define	VDEV_DISK_LAT_BUCKETS	20
+
+typedef struct vdev_disk_lat_stats {
+	kstat_named_t	vdl_poll_fallbacks;
+	kstat_named_t	vdl_polled[VDEV_DISK_LAT_BUCKETS];
+	kstat_named_t	vdl_waited[VDEV_DISK_LAT_BUCKETS];
+} vdev_disk_lat_stats_t;
+
+static vdev_disk_lat_stats_t vdev_disk_lat_stats;
+static kstat_t *vdev_disk_lat_ksp;
+
 /*
  * Convert SPA mode flags into bdev open mode flags.
  */
@@ -450,6 +479,9 @@ vdev_disk_open(vdev_t *v, uint64_t *psize, uint64_t *max_psize,
 	v->vdev_nonrot = blk_queue_nonrot(bdev_get_queue(bdev));
 #endif
 
+	/* Polled I/O is only worth submitting if it can reach a poll queue */
+	vd->vd_can_poll = bdev_poll_supported(bdev);
+
 	/* Is backed by a block device. */
 	v->vdev_is_blkdev = B_TRUE;
 
@@ -612,6 +644,56 @@ vdev_submit_bio_wait(struct bio *bio)
 	current->bio_list = bio_list;
 }
 
+#ifdef HAVE_BIO_POLL
+static void
+vdev_bio_poll_end_io(struct bio *bio)
+{
+	complete(bio->bi_private);
+}
+
+/*
+ * Submit a single BIO marked for polled completion and poll it from the
+ * calling thread until it completes.  A polled BIO on a poll queue raises
+ * no interrupt, so we must not sleep waiting for it.  If the block layer
+ * cleared REQ_POLLED on submission, because the BIO can't be polled after
+ * all, the completion interrupt will arrive, so sleep until it does rather
+ * than spin.  Returns B_TRUE if the BIO was completed by polling.
+ */
+static inline boolean_t
+vdev_submit_bio_poll(struct bio *bio)
+{
+	struct bio_list *bio_list = current->bio_list;
+	DECLARE_COMPLETION_ONSTACK(done);
+	boolean_t polled = B_TRUE;
+
+	current->bio_list = NULL;
+	bio->bi_opf |= REQ_POLLED;
+	bio->bi_private = &done;
+	bio->bi_end_io = vdev_bio_poll_end_io;
+	(void) submit_bio(bio);
+	while (!completion_done(&done)) {
+		if (!(READ_ONCE(bio->bi_opf) & REQ_POLLED)) {
+			wait_for_completion_io(&done);
+			polled = B_FALSE;
+			break;
+		}
+		if (bio_poll(bio, NULL, 0) == 0)
+			cond_resched();
+	}
+	current->bio_list = bio_list;
+
+	return (polled);
+}
+#endif
+
+static void
+vdev_disk_lat_record(kstat_named_t *histo, hrtime_t delta)
+{
+	int b = MIN(highbit64(NSEC2USEC(delta)), VDEV_DISK_LAT_BUCKETS - 1);
+
+	atomic_inc_64(&histo[b].value.ui64);
+}
+
 static inline struct bio *
 vdev_bio_alloc(struct block_device *bdev, gfp_t gfp_mask,
     unsigned short nr_vecs)
@@ -687,6 +769,7 @@ typedef struct {
 	struct bio	*vbio_bio;	/* pointer to the current bio */
 	int		vbio_flags;	/* bio flags */
 	boolean_t	vbio_wait;	/* wait for completion */
+	boolean_t	vbio_poll;	/* poll for completion */
 } vbio_t;
 
 static vbio_t *
@@ -704,6 +787,7 @@ vbio_alloc(zio_t *zio, struct block_device *bdev, int flags)
 	vbio->vbio_bio = NULL;
 	vbio->vbio_flags = flags;
 	vbio->vbio_wait = B_FALSE;
+	vbio->vbio_poll = B_FALSE;
 
 	return (vbio);
 }
@@ -731,6 +815,8 @@ vbio_add_page(vbio_t *vbio, struct page *page, uint_t size, uint_t offset)
 			if (vbio->vbio_bio) {
 				bio_chain(vbio->vbio_bio, bio);
 				vdev_submit_bio(vbio->vbio_bio);
+				/* Only a lone BIO can be polled. */
+				vbio->vbio_poll = B_FALSE;
 			}
 			vbio->vbio_bio = bio;
 		}
@@ -796,6 +882,23 @@ vbio_submit(vbio_t *vbio, abd_t *abd, uint64_t size)
 	 * consider it invalid from this point.
 	 */
 
+#ifdef HAVE_BIO_POLL
+	if (vbio->vbio_poll) {
+		/*
+		 * A plugged BIO is not issued until the plug is flushed, and
+		 * we are about to poll rather than sleep, so unplug first.
+		 */
+		ASSERT(vbio->vbio_wait);
+		blk_finish_plug(&plug);
+		if (!vdev_submit_bio_poll(vbio->vbio_bio)) {
+			vbio->vbio_poll = B_FALSE;
+			atomic_inc_64(
+			    &vdev_disk_lat_stats.vdl_poll_fallbacks.value.ui64);
+		}
+		return;
+	}
+#endif
+
 	if (vbio->vbio_wait) {
 		vdev_submit_bio_wait(vbio->vbio_bio);
 	} else {
@@ -997,15 +1100,28 @@ vdev_disk_io_rw(zio_t *zio)
 	if (abd != zio->io_abd)
 		vbio->vbio_abd = abd;
 
-	boolean_t bio_wait = B_FALSE;
+	boolean_t bio_wait = B_FALSE, timed = B_FALSE;
+	hrtime_t start = 0;
 	if (zfs_vdev_disk_calling_thread_io &&
 	    (zio->io_flags & ZIO_FLAG_BYPASSED_QUEUE)) {
 		vbio->vbio_wait = bio_wait = B_TRUE;
+		timed = v->vdev_nonrot &&
+		    (zio->io_priority == ZIO_PRIORITY_SYNC_READ ||
+		    zio->io_priority == ZIO_PRIORITY_SYNC_WRITE);
+		vbio->vbio_poll = timed && zfs_vdev_disk_poll_io &&
+		    vd->vd_can_poll;
+		start = gethrtime();
 	}
 	/* Fill it with data pages and submit it to the kernel */
 	vbio_submit(vbio, abd, zio->io_size);
 
 	if (bio_wait) {
+		if (timed) {
+			vdev_disk_lat_record(vbio->vbio_poll ?
+			    vdev_disk_lat_stats.vdl_polled :
+			    vdev_disk_lat_stats.vdl_waited,
+			    gethrtime() - start);
+		}
 		vbio->vbio_bio->bi_private = vbio;
 		vbio_completion(vbio->vbio_bio);
 	}
@@ -1325,6 +1441,50 @@ vdev_disk_rele(vdev_t *vd)
 	/* XXX: Implement me as a vnode rele for the device */
 }
 
+static void
+vdev_disk_lat_init(kstat_named_t *ks, const char *prefix, int bucket)
+{
+	char name[KSTAT_STRLEN];
+
+	if (bucket < VDEV_DISK_LAT_BUCKETS - 1) {
+		(void) snprintf(name, sizeof (name), "%s_%lluus", prefix,
+		    1ULL << bucket);
+	} else {
+		(void) snprintf(name, sizeof (name), "%s_slower", prefix);
+	}
+	kstat_named_init(ks, name, KSTAT_DATA_UINT64);
+}
+
+void
+vdev_disk_init(void)
+{
+	vdev_disk_lat_stats_t *vdl = &vdev_disk_lat_stats;
+
+	kstat_named_init(&vdl->vdl_poll_fallbacks, "poll_fallbacks",
+	    KSTAT_DATA_UINT64);
+	for (int i = 0; i < VDEV_DISK_LAT_BUCKETS; i++) {
+		vdev_disk_lat_init(&vdl->vdl_polled[i], "polled", i);
+		vdev_disk_lat_init(&vdl->vdl_waited[i], "waited", i);
+	}
+
+	vdev_disk_lat_ksp = kstat_create("zfs", 0, "vdev_disk_sync_latency",
+	    "misc", KSTAT_TYPE_NAMED, sizeof (*vdl) / sizeof (kstat_named_t),
+	    KSTAT_FLAG_VIRTUAL);
+	if (vdev_disk_lat_ksp != NULL) {
+		vdev_disk_lat_ksp->ks_data = vdl;
+		kstat_install(vdev_disk_lat_ksp);
+	}
+}
+
+void
+vdev_disk_fini(void)
+{
+	if (vdev_disk_lat_ksp != NULL) {
+		kstat_delete(vdev_disk_lat_ksp);
+		vdev_disk_lat_ksp = NULL;
+	}
+}
+
 vdev_ops_t vdev_disk_ops = {
 	.vdev_op_init = NULL,
 	.vdev_op_fini = NULL,
@@ -1403,3 +1563,6 @@ ZFS_MODULE_PARAM(zfs_vdev_disk, zfs_vdev_disk_, max_segs, UINT, ZMOD_RW,
 
 ZFS_MODULE_PARAM(zfs_vdev_disk, zfs_vdev_disk_, calling_thread_io, UINT,
 	ZMOD_RW, "Enable calling thread io");
+
+ZFS_MODULE_PARAM(zfs_vdev_disk, zfs_vdev_disk_, poll_io, UINT, ZMOD_RW,
+	"Poll for sync I/O completion with calling thread io");
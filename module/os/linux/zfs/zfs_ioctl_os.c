@@ -56,6 +56,7 @@
 #include <sys/zfs_ioctl_impl.h>
 
 #include <sys/zfs_sysfs.h>
+#include <sys/vdev_disk.h>
 #include <linux/miscdevice.h>
 #include <linux/slab.h>
 
@@ -284,7 +285,10 @@ openzfs_init_os(void)
 {
 	int error;
 
+	vdev_disk_init();
+
 	if ((error = zfs_kmod_init()) != 0) {
+		vdev_disk_fini();
 		printk(KERN_NOTICE "ZFS: Failed to Load ZFS Filesystem v%s-%s%s"
 		    ", rc = %d\n", ZFS_META_VERSION, ZFS_META_RELEASE,
 		    ZFS_DEBUG_STR, error);
@@ -318,6 +322,7 @@ openzfs_fini_os(void)
 {
 	zfs_sysfs_fini();
 	zfs_kmod_fini();
+	vdev_disk_fini();
 
 	printk(KERN_NOTICE "ZFS: Unloaded module v%s-%s%s\n",
 	    ZFS_META_VERSION, ZFS_META_RELEASE, ZFS_DEBUG_STR);
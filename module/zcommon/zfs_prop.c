@@ -701,6 +701,12 @@ zfs_prop_init(void)
 	zprop_register_number(ZFS_PROP_REFRESERVATION, "refreservation", 0,
 	    PROP_DEFAULT, ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME,
 	    "<size> | none", "REFRESERV", B_FALSE, sfeatures);
+	zprop_register_number(ZFS_PROP_ARCQUOTA, "arcquota", 0,
+	    PROP_DEFAULT, ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME,
+	    "<size> | none", "ARCQUOTA", B_FALSE, sfeatures);
+	zprop_register_number(ZFS_PROP_ARCRESERVATION, "arcreservation", 0,
+	    PROP_DEFAULT, ZFS_TYPE_FILESYSTEM | ZFS_TYPE_VOLUME,
+	    "<size> | none", "ARCRESERV", B_FALSE, sfeatures);
 	zprop_register_number(ZFS_PROP_FILESYSTEM_LIMIT, "filesystem_limit",
 	    UINT64_MAX, PROP_DEFAULT, ZFS_TYPE_FILESYSTEM,
 	    "<count> | none", "FSLIMIT", B_FALSE, sfeatures);
@@ -330,6 +330,59 @@ static clock_t arc_last_uncached_flush;
 static taskq_t *arc_evict_taskq;
 static struct evict_arg *arc_evict_arg;
 
+/*
+ * Per-objset ARC quotas and reservations (see arc_quota_t).  While
+ * arc_quota_count, the number of active quotas, is zero, headers never
+ * look up a quota and eviction behaves exactly as it would without them.
+ * arc_quota_evict_needed asks the eviction thread to run
+ * arc_quota_evict(), which enforces limits even when arc_size is below
+ * arc_c.
+ */
+static avl_tree_t arc_quota_tree;
+static krwlock_t arc_quota_lock;
+static uint64_t arc_quota_count;
+static boolean_t arc_quota_evict_needed = B_FALSE;
+
+/*
+ * Reservations are honored only while their sum stays at or below this
+ * percentage of arc_c, so that they can never pin the whole ARC.
+ */
+static uint_t zfs_arc_quota_reserve_pct = 50;
+
+/*
+ * Scan-resistant admission filter.  When zfs_arc_admit_min_freq is
+ * non-zero, every access to a block is counted in arc_sketch, a
+ * count-min sketch of ARC_SKETCH_DEPTH rows of 4-bit saturating counters
+ * (kept in bytes) indexed by the block's hash.  A data block read into an
+ * ARC that is already full enters the MRU state only if the sketch
+ * estimates at least zfs_arc_admit_min_freq recent accesses to it,
+ * counting this one; otherwise it goes to the uncached state and is
+ * evicted after use, so one pass over a large file can't displace the
+ * working set.  So that past popularity fades, every
+ * ARC_SKETCH_AGE_INTERVAL accesses halve the eight counters in the next
+ * 64-bit word of the sketch, round robin; each counter is thus halved
+ * once every 16 * arc_sketch_width accesses, at a constant cost per
+ * access rather than in one pass over the whole sketch.  The sketch is
+ * allocated by arc_sketch_alloc() only once the filter is first enabled,
+ * and is then kept until arc_fini().
+ */
+#define	ARC_SKETCH_DEPTH	4
+#define	ARC_SKETCH_MAX		15
+#define	ARC_SKETCH_AGE_INTERVAL	32
+static uint8_t *arc_sketch;
+static uint64_t arc_sketch_width;
+static uint64_t arc_sketch_accesses;
+uint_t zfs_arc_admit_min_freq = 0;
+
+/*
+ * How arc_evict_state() treats headers that are charged to a quota.
+ */
+typedef enum arc_evict_quota {
+	ARC_EVICT_QUOTA_IGNORE,		/* evict regardless of quota */
+	ARC_EVICT_QUOTA_RESPECT,	/* skip headers within reservation */
+	ARC_EVICT_QUOTA_OVER,		/* evict only headers over quota */
+} arc_evict_quota_t;
+
 /*
  * Count of bytes evicted since boot.
  */
@@ -481,6 +534,16 @@ static taskq_t *arc_flush_taskq;
  */
 static uint_t zfs_arc_evict_threads = 0;
 
+/*
+ * When set at module load on a NUMA system, the sublists of the MRU, MFU
+ * and uncached states are divided among NUMA nodes, each header being kept
+ * in the range for the node holding its data, and eviction under memory
+ * pressure starts with the sublists of the node that is short of memory.
+ */
+static int zfs_arc_numa = B_FALSE;
+static uint_t arc_numa_nodes = 1;
+static volatile int arc_numa_pressure_node = -1;
+
 /* The 7 states: */
 static arc_state_t ARC_anon;
 /*  */ arc_state_t ARC_mru;
@@ -516,6 +579,11 @@ arc_stats_t arc_stats = {
 	{ "access_skip",		KSTAT_DATA_UINT64 },
 	{ "evict_skip",			KSTAT_DATA_UINT64 },
 	{ "evict_not_enough",		KSTAT_DATA_UINT64 },
+	{ "quota_evicted",		KSTAT_DATA_UINT64 },
+	{ "quota_skip",			KSTAT_DATA_UINT64 },
+	{ "quota_reserve_overcommit",	KSTAT_DATA_UINT64 },
+	{ "admit_accepted",		KSTAT_DATA_UINT64 },
+	{ "admit_rejected",		KSTAT_DATA_UINT64 },
 	{ "evict_l2_cached",		KSTAT_DATA_UINT64 },
 	{ "evict_l2_eligible",		KSTAT_DATA_UINT64 },
 	{ "evict_l2_eligible_mfu",	KSTAT_DATA_UINT64 },
@@ -618,6 +686,9 @@ arc_stats_t arc_stats = {
 	{ "l2_rebuild_bufs",		KSTAT_DATA_UINT64 },
 	{ "l2_rebuild_bufs_precached",	KSTAT_DATA_UINT64 },
 	{ "l2_rebuild_log_blks",	KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_active",		KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_log_blks_expected", KSTAT_DATA_UINT64 },
+	{ "l2_rebuild_log_blks_pending", KSTAT_DATA_UINT64 },
 	{ "memory_throttle_count",	KSTAT_DATA_UINT64 },
 	{ "memory_direct_count",	KSTAT_DATA_UINT64 },
 	{ "memory_indirect_count",	KSTAT_DATA_UINT64 },
@@ -634,6 +705,7 @@ arc_stats_t arc_stats = {
 	{ "predictive_prefetch", KSTAT_DATA_UINT64 },
 	{ "demand_hit_predictive_prefetch", KSTAT_DATA_UINT64 },
 	{ "demand_iohit_predictive_prefetch", KSTAT_DATA_UINT64 },
+	{ "evict_unused_predictive_prefetch", KSTAT_DATA_UINT64 },
 	{ "prescient_prefetch", KSTAT_DATA_UINT64 },
 	{ "demand_hit_prescient_prefetch", KSTAT_DATA_UINT64 },
 	{ "demand_iohit_prescient_prefetch", KSTAT_DATA_UINT64 },
@@ -773,18 +845,32 @@ taskq_t *arc_prune_taskq;
  * Hash table routines
  */
 
-#define	BUF_LOCKS 2048
+/*
+ * Every header lookup takes the lock covering its chain, so the locks are
+ * padded to a cache line each, and their number scales with the number of
+ * CPUs (BUF_LOCKS_PER_CPU, but at least BUF_LOCKS_MIN and at most one per
+ * chain) to keep contention on any one of them low.
+ */
+#define	BUF_LOCKS_MIN		2048
+#define	BUF_LOCKS_PER_CPU	64
+
+typedef struct buf_hash_lock {
+	kmutex_t	hl_lock;
+} ____cacheline_aligned buf_hash_lock_t;
+
 typedef struct buf_hash_table {
 	uint64_t ht_mask;
 	arc_buf_hdr_t **ht_table;
-	kmutex_t ht_locks[BUF_LOCKS] ____cacheline_aligned;
+	uint64_t ht_lock_mask;
+	buf_hash_lock_t *ht_locks;
 } buf_hash_table_t;
 
 static buf_hash_table_t buf_hash_table;
 
 #define	BUF_HASH_INDEX(spa, dva, birth) \
 	(buf_hash(spa, dva, birth) & buf_hash_table.ht_mask)
-#define	BUF_HASH_LOCK(idx)	(&buf_hash_table.ht_locks[idx & (BUF_LOCKS-1)])
+#define	BUF_HASH_LOCK(idx)	\
+	(&buf_hash_table.ht_locks[(idx) & buf_hash_table.ht_lock_mask].hl_lock)
 #define	HDR_LOCK(hdr) \
 	(BUF_HASH_LOCK(BUF_HASH_INDEX(hdr->b_spa, &hdr->b_dva, hdr->b_birth)))
 
@@ -844,6 +930,7 @@ static uint64_t l2arc_feed_min_ms = L2ARC_FEED_MIN_MS;	/* min interval msecs */
 static int l2arc_noprefetch = B_TRUE;		/* don't cache prefetch bufs */
 static int l2arc_feed_again = B_TRUE;		/* turbo warmup */
 static int l2arc_norw = B_FALSE;		/* no reads during writes */
+static int l2arc_write_balance = B_FALSE;	/* split by device bandwidth */
 static uint_t l2arc_meta_percent = 33;	/* limit on headers size */
 
 /*
@@ -909,6 +996,7 @@ static void arc_hdr_destroy(arc_buf_hdr_t *);
 static void arc_access(arc_buf_hdr_t *, arc_flags_t, boolean_t);
 static void arc_buf_watch(arc_buf_t *);
 static void arc_change_state(arc_state_t *, arc_buf_hdr_t *);
+static unsigned int arc_state_numa_multilist_index_func(multilist_t *, void *);
 
 static arc_buf_contents_t arc_buf_type(arc_buf_hdr_t *);
 static uint32_t arc_bufc_to_flags(arc_buf_contents_t);
@@ -917,6 +1005,7 @@ static inline void arc_hdr_clear_flags(arc_buf_hdr_t *hdr, arc_flags_t flags);
 
 static boolean_t l2arc_write_eligible(uint64_t, arc_buf_hdr_t *);
 static void l2arc_read_done(zio_t *);
+static void l2arc_write_bw_update(l2arc_dev_t *, uint64_t, hrtime_t);
 static void l2arc_do_free_on_write(l2arc_dev_t *dev);
 static void l2arc_hdr_arcstats_update(arc_buf_hdr_t *hdr, boolean_t incr,
     boolean_t state_only);
@@ -1011,11 +1100,37 @@ static zio_t *l2arc_log_blk_fetch(vdev_t *vd,
     const l2arc_log_blkptr_t *lp, l2arc_log_blk_phys_t *lb);
 static void l2arc_log_blk_fetch_abort(zio_t *zio);
 
+/*
+ * Restoring a log block's headers is handed to l2arc_rebuild_taskq so that
+ * the rebuild thread can go on reading the log block chain.  Each task
+ * restores its headers in front of a marker that the rebuild thread placed
+ * on l2ad_buflist in chain order, which keeps the list in the temporal
+ * order l2arc_evict() depends on however the tasks are scheduled.
+ */
+typedef struct l2arc_rebuild_sync {
+	kmutex_t		lrs_lock;
+	kcondvar_t		lrs_cv;
+	uint_t			lrs_pending;	/* dispatched, not yet done */
+} l2arc_rebuild_sync_t;
+
+typedef struct l2arc_rebuild_task {
+	l2arc_dev_t		*lrt_dev;
+	l2arc_rebuild_sync_t	*lrt_sync;
+	l2arc_log_blk_phys_t	*lrt_lb;
+	uint64_t		lrt_lb_asize;
+	arc_buf_hdr_t		*lrt_marker;
+	taskq_ent_t		lrt_tqent;
+} l2arc_rebuild_task_t;
+
+static taskq_t *l2arc_rebuild_taskq;
+
 /* L2ARC persistence block restoration routines. */
 static void l2arc_log_blk_restore(l2arc_dev_t *dev,
-    const l2arc_log_blk_phys_t *lb, uint64_t lb_asize);
+    const l2arc_log_blk_phys_t *lb, uint64_t lb_asize, arc_buf_hdr_t *marker);
 static void l2arc_hdr_restore(const l2arc_log_ent_phys_t *le,
-    l2arc_dev_t *dev);
+    l2arc_dev_t *dev, arc_buf_hdr_t *marker);
+static void l2arc_log_blk_dispatch(l2arc_dev_t *dev,
+    l2arc_rebuild_sync_t *sync, l2arc_log_blk_phys_t *lb, uint64_t lb_asize);
 
 /* L2ARC persistence write I/O routines. */
 static uint64_t l2arc_log_blk_commit(l2arc_dev_t *dev, zio_t *pio,
@@ -1180,8 +1295,10 @@ buf_fini(void)
 	kmem_free(buf_hash_table.ht_table,
 	    (buf_hash_table.ht_mask + 1) * sizeof (void *));
 #endif
-	for (int i = 0; i < BUF_LOCKS; i++)
+	for (uint64_t i = 0; i <= buf_hash_table.ht_lock_mask; i++)
 		mutex_destroy(BUF_HASH_LOCK(i));
+	vmem_free(buf_hash_table.ht_locks,
+	    (buf_hash_table.ht_lock_mask + 1) * sizeof (buf_hash_lock_t));
 	kmem_cache_destroy(hdr_full_cache);
 	kmem_cache_destroy(hdr_l2only_cache);
 	kmem_cache_destroy(buf_cache);
@@ -1318,7 +1435,14 @@ retry:
 		for (ct = zfs_crc64_table + i, *ct = i, j = 8; j > 0; j--)
 			*ct = (*ct >> 1) ^ (-(*ct & 1) & ZFS_CRC64_POLY);
 
-	for (i = 0; i < BUF_LOCKS; i++)
+	uint64_t nlocks = BUF_LOCKS_MIN;
+	while (nlocks < (uint64_t)max_ncpus * BUF_LOCKS_PER_CPU)
+		nlocks <<= 1;
+	nlocks = MIN(nlocks, hsize);
+	buf_hash_table.ht_lock_mask = nlocks - 1;
+	buf_hash_table.ht_locks =
+	    vmem_zalloc(nlocks * sizeof (buf_hash_lock_t), KM_SLEEP);
+	for (uint64_t i = 0; i < nlocks; i++)
 		mutex_init(BUF_HASH_LOCK(i), NULL, MUTEX_DEFAULT, NULL);
 }
 
@@ -1790,7 +1914,7 @@ arc_buf_alloc_l2only(size_t size, arc_buf_contents_t type, l2arc_dev_t *dev,
 
 	hdr->b_l2hdr.b_dev = dev;
 	hdr->b_l2hdr.b_daddr = daddr;
-	hdr->b_l2hdr.b_arcs_state = arcs_state;
+	hdr->b_l2arcs_state = arcs_state;
 
 	return (hdr);
 }
@@ -2320,6 +2444,37 @@ arc_evictable_space_decrement(arc_buf_hdr_t *hdr, arc_state_t *state)
 	}
 }
 
+/*
+ * Record the NUMA node of the header's data for
+ * arc_state_numa_multilist_index_func(). Called just before the header is
+ * inserted into a state list, while it is on none.
+ */
+static void
+arc_hdr_set_numa_node(arc_buf_hdr_t *hdr)
+{
+	abd_t *abd = hdr->b_l1hdr.b_pabd;
+
+	if (arc_numa_nodes < 2)
+		return;
+
+	ASSERT(!multilist_link_active(&hdr->b_l1hdr.b_arc_node));
+	if (abd == NULL && HDR_HAS_RABD(hdr))
+		abd = hdr->b_crypt_hdr.b_rabd;
+	hdr->b_numa_node = (abd == NULL) ? 0 :
+	    MIN(abd_numa_node(abd), UINT8_MAX);
+}
+
+/*
+ * Called by the platform's memory reclaim hook with the node it is
+ * reclaiming for, so that arc_evict_state() starts there.
+ */
+void
+arc_numa_note_pressure(int node)
+{
+	if (arc_numa_nodes > 1)
+		arc_numa_pressure_node = node;
+}
+
 /*
  * Add a reference to this hdr indicating that someone is actively
  * referencing that memory. When the refcount transitions from 0 to 1,
@@ -2374,6 +2529,7 @@ remove_reference(arc_buf_hdr_t *hdr, const void *tag)
 		arc_hdr_destroy(hdr);
 		return (0);
 	}
+	arc_hdr_set_numa_node(hdr);
 	multilist_insert(&state->arcs_list[arc_buf_type(hdr)], hdr);
 	arc_evictable_space_increment(hdr, state);
 	return (0);
@@ -2423,7 +2579,7 @@ arc_buf_info(arc_buf_t *ab, arc_buf_info_t *abi, int state_index)
 
 	if (l2hdr) {
 		abi->abi_l2arc_dattr = l2hdr->b_daddr;
-		abi->abi_l2arc_hits = l2hdr->b_hits;
+		abi->abi_l2arc_hits = hdr->b_l2hits;
 	}
 
 	abi->abi_state_type = state ? state->arcs_state : ARC_STATE_ANON;
@@ -2431,6 +2587,115 @@ arc_buf_info(arc_buf_t *ab, arc_buf_info_t *abi, int state_index)
 	abi->abi_size = arc_hdr_size(hdr);
 }
 
+static int
+arc_quota_compare(const void *x1, const void *x2)
+{
+	const arc_quota_t *aq1 = x1;
+	const arc_quota_t *aq2 = x2;
+
+	int cmp = TREE_CMP(aq1->aq_spa, aq2->aq_spa);
+	if (likely(cmp))
+		return (cmp);
+
+	return (TREE_CMP(aq1->aq_objset, aq2->aq_objset));
+}
+
+/*
+ * Charge the header's quota, if any, for a change of delta bytes in the
+ * size of the given state.  Only mru, mfu and uncached are charged; the
+ * header moves its charge along with it through arc_change_state().
+ */
+static inline void
+arc_quota_charge(arc_buf_hdr_t *hdr, arc_state_t *state, int64_t delta)
+{
+	arc_quota_t *aq = hdr->b_l1hdr.b_quota;
+
+	if (likely(aq == NULL) || delta == 0 ||
+	    (state != arc_mru && state != arc_mfu && state != arc_uncached))
+		return;
+
+	aggsum_add(&aq->aq_size, delta);
+
+	/*
+	 * Limits are enforced asynchronously.  Wake the eviction thread
+	 * once for each quota overrun it hasn't yet seen.
+	 */
+	if (delta > 0 && aq->aq_limit != 0 && !arc_quota_evict_needed &&
+	    aggsum_compare(&aq->aq_size, aq->aq_limit) > 0) {
+		arc_quota_evict_needed = B_TRUE;
+		zthr_wakeup(arc_evict_zthr);
+	}
+}
+
+/*
+ * Attach the active quota for (spa, objset), if there is one, to a header
+ * that has nothing charged to any quota: a new anonymous header, or one in
+ * a ghost or l2c_only state that is about to be read back in.
+ */
+static void
+arc_hdr_set_quota(arc_buf_hdr_t *hdr, uint64_t spa, uint64_t objset)
+{
+	ASSERT(HDR_HAS_L1HDR(hdr));
+	ASSERT(hdr->b_l1hdr.b_state == arc_anon ||
+	    hdr->b_l1hdr.b_state == arc_l2c_only ||
+	    GHOST_STATE(hdr->b_l1hdr.b_state));
+
+	if (likely(arc_quota_count == 0) || hdr->b_l1hdr.b_quota != NULL)
+		return;
+
+	arc_quota_t search = { .aq_spa = spa, .aq_objset = objset };
+
+	rw_enter(&arc_quota_lock, RW_READER);
+	arc_quota_t *aq = avl_find(&arc_quota_tree, &search, NULL);
+	if (aq != NULL && aq->aq_active) {
+		atomic_inc_64(&aq->aq_refcnt);
+		hdr->b_l1hdr.b_quota = aq;
+	}
+	rw_exit(&arc_quota_lock);
+}
+
+/*
+ * The number of bytes the header adds to a non-ghost state's arcs_size.
+ */
+static uint64_t
+arc_hdr_quota_size(arc_buf_hdr_t *hdr)
+{
+	uint64_t size = 0;
+
+	for (arc_buf_t *buf = hdr->b_l1hdr.b_buf; buf != NULL;
+	    buf = buf->b_next) {
+		if (!ARC_BUF_SHARED(buf))
+			size += arc_buf_size(buf);
+	}
+	if (hdr->b_l1hdr.b_pabd != NULL)
+		size += arc_hdr_size(hdr);
+	if (HDR_HAS_RABD(hdr))
+		size += HDR_GET_PSIZE(hdr);
+
+	return (size);
+}
+
+/*
+ * Drop the header's quota reference.  The header must no longer have
+ * anything charged, which holds in arc_anon and the ghost states.  An
+ * inactive quota whose last reference this was is left for
+ * arc_quota_evict() to free, since the eviction thread may still be
+ * looking at it.
+ */
+static void
+arc_hdr_clear_quota(arc_buf_hdr_t *hdr)
+{
+	arc_quota_t *aq = hdr->b_l1hdr.b_quota;
+
+	if (aq == NULL)
+		return;
+
+	boolean_t active = aq->aq_active;
+	hdr->b_l1hdr.b_quota = NULL;
+	if (atomic_dec_64_nv(&aq->aq_refcnt) == 0 && !active)
+		arc_quota_evict_needed = B_TRUE;
+}
+
 /*
  * Move the supplied buffer to the indicated state. The hash lock
  * for the buffer must be held by the caller.
@@ -2496,6 +2761,7 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *hdr)
 			 * beforehand.
 			 */
 			ASSERT(HDR_HAS_L1HDR(hdr));
+			arc_hdr_set_numa_node(hdr);
 			multilist_insert(&new_state->arcs_list[type], hdr);
 			arc_evictable_space_increment(hdr, new_state);
 		}
@@ -2620,11 +2886,17 @@ arc_change_state(arc_state_t *new_state, arc_buf_hdr_t *hdr)
 	}
 
 	if (HDR_HAS_L1HDR(hdr)) {
+		if (hdr->b_l1hdr.b_quota != NULL) {
+			int64_t size = arc_hdr_quota_size(hdr);
+
+			arc_quota_charge(hdr, old_state, -size);
+			arc_quota_charge(hdr, new_state, size);
+		}
 		hdr->b_l1hdr.b_state = new_state;
 
 		if (HDR_HAS_L2HDR(hdr) && new_state != arc_l2c_only) {
 			l2arc_hdr_arcstats_decrement_state(hdr);
-			hdr->b_l2hdr.b_arcs_state = new_state->arcs_state;
+			hdr->b_l2arcs_state = new_state->arcs_state;
 			l2arc_hdr_arcstats_increment_state(hdr);
 		}
 	}
@@ -2975,6 +3247,7 @@ arc_hdr_free_on_write(arc_buf_hdr_t *hdr, boolean_t free_rdata)
 		    size, hdr);
 	}
 	(void) zfs_refcount_remove_many(&state->arcs_size[type], size, hdr);
+	arc_quota_charge(hdr, state, -(int64_t)size);
 	if (type == ARC_BUFC_METADATA) {
 		arc_space_return(size, ARC_SPACE_META);
 	} else {
@@ -3312,6 +3585,7 @@ arc_hdr_alloc(uint64_t spa, int32_t psize, int32_t lsize,
 	hdr = kmem_cache_alloc(hdr_full_cache, KM_PUSHPAGE);
 
 	ASSERT(HDR_EMPTY(hdr));
+	ASSERT0P(hdr->b_l1hdr.b_quota);
 #ifdef ZFS_DEBUG
 	ASSERT0P(hdr->b_l1hdr.b_freeze_cksum);
 #endif
@@ -3375,6 +3649,7 @@ arc_hdr_realloc(arc_buf_hdr_t *hdr, kmem_cache_t *old, kmem_cache_t *new)
 
 		/* Verify previous threads set to NULL before freeing */
 		ASSERT0P(nhdr->b_l1hdr.b_pabd);
+		ASSERT0P(nhdr->b_l1hdr.b_quota);
 		ASSERT(!HDR_HAS_RABD(hdr));
 	} else {
 		ASSERT0P(hdr->b_l1hdr.b_buf);
@@ -3401,6 +3676,7 @@ arc_hdr_realloc(arc_buf_hdr_t *hdr, kmem_cache_t *old, kmem_cache_t *new)
 		VERIFY0P(hdr->b_l1hdr.b_pabd);
 		ASSERT(!HDR_HAS_RABD(hdr));
 
+		arc_hdr_clear_quota(hdr);
 		arc_hdr_clear_flags(nhdr, ARC_FLAG_HAS_L1HDR);
 	}
 	/*
@@ -3606,7 +3882,7 @@ l2arc_hdr_arcstats_update(arc_buf_hdr_t *hdr, boolean_t incr,
 		 * possibly absent L1 header (apparent in buffers restored
 		 * from persistent L2ARC).
 		 */
-		switch (hdr->b_l2hdr.b_arcs_state) {
+		switch (hdr->b_l2arcs_state) {
 			case ARC_STATE_MRU_GHOST:
 			case ARC_STATE_MRU:
 				ARCSTAT_INCR(arcstat_l2_mru_asize, asize_s);
@@ -3744,6 +4020,7 @@ arc_hdr_destroy(arc_buf_hdr_t *hdr)
 	if (HDR_HAS_L1HDR(hdr)) {
 		VERIFY(!multilist_link_active(&hdr->b_l1hdr.b_arc_node));
 		ASSERT0P(hdr->b_l1hdr.b_acb);
+		arc_hdr_clear_quota(hdr);
 #ifdef ZFS_DEBUG
 		ASSERT0P(hdr->b_l1hdr.b_freeze_cksum);
 #endif
@@ -3898,6 +4175,14 @@ arc_evict_hdr(arc_buf_hdr_t *hdr, uint64_t *real_evicted)
 		}
 	}
 
+	/*
+	 * arc_access() clears the prefetch flags on the first demand access,
+	 * so these were never used.  dmu_zfetch weighs this against the
+	 * demand_*_predictive_prefetch counts to judge prefetch accuracy.
+	 */
+	if (HDR_PREFETCH(hdr) && !HDR_PRESCIENT_PREFETCH(hdr))
+		ARCSTAT_BUMP(arcstat_evict_unused_predictive_prefetch);
+
 	bytes_evicted += arc_hdr_size(hdr);
 	*real_evicted += arc_hdr_size(hdr);
 
@@ -3940,7 +4225,7 @@ arc_set_need_free(void)
 
 static uint64_t
 arc_evict_state_impl(multilist_t *ml, int idx, arc_buf_hdr_t *marker,
-    uint64_t spa, uint64_t bytes, boolean_t *more)
+    uint64_t spa, arc_evict_quota_t quota, uint64_t bytes, boolean_t *more)
 {
 	multilist_sublist_t *mls;
 	uint64_t bytes_evicted = 0, real_evicted = 0;
@@ -3988,6 +4273,21 @@ arc_evict_state_impl(multilist_t *ml, int idx, arc_buf_hdr_t *marker,
 			continue;
 		}
 
+		/*
+		 * Headers on a list always have an L1 header, and b_quota
+		 * only changes outside of the cached states, so it's stable
+		 * here under the sublist lock.
+		 */
+		arc_quota_t *aq = hdr->b_l1hdr.b_quota;
+		if (quota == ARC_EVICT_QUOTA_OVER &&
+		    (aq == NULL || aq->aq_excess <= 0))
+			continue;
+		if (quota == ARC_EVICT_QUOTA_RESPECT &&
+		    aq != NULL && aq->aq_protected) {
+			ARCSTAT_BUMP(arcstat_quota_skip);
+			continue;
+		}
+
 		hash_lock = HDR_LOCK(hdr);
 
 		/*
@@ -4006,6 +4306,10 @@ arc_evict_state_impl(multilist_t *ml, int idx, arc_buf_hdr_t *marker,
 			uint64_t evicted = arc_evict_hdr(hdr, &revicted);
 			mutex_exit(hash_lock);
 
+			if (quota == ARC_EVICT_QUOTA_OVER)
+				atomic_add_64((uint64_t *)&aq->aq_excess,
+				    -(int64_t)evicted);
+
 			bytes_evicted += evicted;
 			real_evicted += revicted;
 
@@ -4106,6 +4410,7 @@ typedef struct evict_arg {
 	arc_buf_hdr_t		*eva_marker;
 	int			eva_idx;
 	uint64_t		eva_spa;
+	arc_evict_quota_t	eva_quota;
 	uint64_t		eva_bytes;
 	uint64_t		eva_evicted;
 } evict_arg_t;
@@ -4122,7 +4427,7 @@ arc_evict_task(void *arg)
 	do {
 		total_evicted += arc_evict_state_impl(eva->eva_ml,
 		    eva->eva_idx, eva->eva_marker, eva->eva_spa,
-		    eva->eva_bytes - total_evicted, &more);
+		    eva->eva_quota, eva->eva_bytes - total_evicted, &more);
 	} while (total_evicted < eva->eva_bytes && --batches > 0 && more);
 
 	eva->eva_evicted = total_evicted;
@@ -4166,6 +4471,27 @@ arc_evict_thread_init(void)
  */
 #define	MIN_EVICT_SIZE	(SPA_MAXBLOCKSIZE)
 
+/*
+ * Pick the sublist arc_evict_state() starts from: one in the range of the
+ * node under memory pressure when the list is kept per node, otherwise
+ * any sublist.
+ */
+static int
+arc_evict_start_index(multilist_t *ml)
+{
+	int node = arc_numa_pressure_node;
+
+	if (node < 0 ||
+	    ml->ml_index_func != arc_state_numa_multilist_index_func)
+		return (multilist_get_random_index(ml));
+
+	unsigned int num_sublists = multilist_get_num_sublists(ml);
+	unsigned int nodes = MIN(arc_numa_nodes, num_sublists);
+	unsigned int per_node = num_sublists / nodes;
+
+	return ((node % nodes) * per_node + random_in_range(per_node));
+}
+
 /*
  * Evict buffers from the given arc state, until we've removed the
  * specified number of bytes. Move the removed buffers to the
@@ -4178,10 +4504,13 @@ arc_evict_thread_init(void)
  * If bytes is specified using the special value ARC_EVICT_ALL, this
  * will evict all available (i.e. unlocked and evictable) buffers from
  * the given arc state; which is used by arc_flush().
+ *
+ * The quota argument selects how headers charged to an objset's ARC
+ * quota are treated; see arc_quota_evict().
  */
 static uint64_t
 arc_evict_state(arc_state_t *state, arc_buf_contents_t type, uint64_t spa,
-    uint64_t bytes)
+    arc_evict_quota_t quota, uint64_t bytes)
 {
 	uint64_t total_evicted = 0;
 	multilist_t *ml = &state->arcs_list[type];
@@ -4225,6 +4554,7 @@ arc_evict_state(arc_state_t *state, arc_buf_contents_t type, uint64_t spa,
 				taskq_init_ent(&eva[i].eva_tqent);
 				eva[i].eva_ml = ml;
 				eva[i].eva_spa = spa;
+				eva[i].eva_quota = quota;
 			}
 		} else {
 			/*
@@ -4243,7 +4573,7 @@ arc_evict_state(arc_state_t *state, arc_buf_contents_t type, uint64_t spa,
 	 */
 	uint64_t scan_evicted = 0;
 	int sublists_left = num_sublists;
-	int sublist_idx = multilist_get_random_index(ml);
+	int sublist_idx = arc_evict_start_index(ml);
 
 	/*
 	 * While we haven't hit our target number of bytes to evict, or
@@ -4301,8 +4631,8 @@ arc_evict_state(arc_state_t *state, arc_buf_contents_t type, uint64_t spa,
 			}
 
 			bytes_evicted = arc_evict_state_impl(ml, sublist_idx,
-			    markers[sublist_idx], spa, bytes - total_evicted,
-			    NULL);
+			    markers[sublist_idx], spa, quota,
+			    bytes - total_evicted, NULL);
 
 			scan_evicted += bytes_evicted;
 			total_evicted += bytes_evicted;
@@ -4335,9 +4665,12 @@ arc_evict_state(arc_state_t *state, arc_buf_contents_t type, uint64_t spa,
 			 * When bytes is ARC_EVICT_ALL, the only way to
 			 * break the loop is when scan_evicted is zero.
 			 * In that case, we actually have evicted enough,
-			 * so we don't want to increment the kstat.
+			 * so we don't want to increment the kstat.  The
+			 * same goes for quota passes, which stop once
+			 * every quota is back under its limit.
 			 */
-			if (bytes != ARC_EVICT_ALL) {
+			if (bytes != ARC_EVICT_ALL &&
+			    quota != ARC_EVICT_QUOTA_OVER) {
 				ASSERT3S(total_evicted, <, bytes);
 				ARCSTAT_BUMP(arcstat_evict_not_enough);
 			}
@@ -4351,7 +4684,7 @@ arc_evict_state(arc_state_t *state, arc_buf_contents_t type, uint64_t spa,
 		 */
 		if (sublists_left == 0) {
 			sublists_left = num_sublists;
-			sublist_idx = multilist_get_random_index(ml);
+			sublist_idx = arc_evict_start_index(ml);
 			scan_evicted = 0;
 
 			/*
@@ -4399,7 +4732,8 @@ arc_flush_state(arc_state_t *state, uint64_t spa, arc_buf_contents_t type,
 	uint64_t evicted = 0;
 
 	while (zfs_refcount_count(&state->arcs_esize[type]) != 0) {
-		evicted += arc_evict_state(state, type, spa, ARC_EVICT_ALL);
+		evicted += arc_evict_state(state, type, spa,
+		    ARC_EVICT_QUOTA_IGNORE, ARC_EVICT_ALL);
 
 		if (!retry)
 			break;
@@ -4423,7 +4757,9 @@ arc_evict_impl(arc_state_t *state, arc_buf_contents_t type, int64_t bytes)
 	if (bytes > 0 && zfs_refcount_count(&state->arcs_esize[type]) > 0) {
 		delta = MIN(zfs_refcount_count(&state->arcs_esize[type]),
 		    bytes);
-		return (arc_evict_state(state, type, 0, delta));
+		return (arc_evict_state(state, type, 0,
+		    GHOST_STATE(state) ? ARC_EVICT_QUOTA_IGNORE :
+		    ARC_EVICT_QUOTA_RESPECT, delta));
 	}
 
 	return (0);
@@ -4486,6 +4822,79 @@ arc_mf(uint64_t x, uint64_t multiplier, uint64_t divisor)
 	return ((q * multiplier) + ((r * multiplier) / divisor));
 }
 
+/*
+ * Plan and carry out one round of per-objset quota enforcement.
+ *
+ * Each active quota's charged size is sampled once.  A quota over its
+ * limit gets aq_excess set to the overage, which is then worked off by
+ * ARC_EVICT_QUOTA_OVER passes that evict only that quota's headers, oldest
+ * first, from the data and metadata lists of mru and then mfu.  A quota
+ * within its reservation is marked protected, and the normal passes in
+ * arc_evict() (ARC_EVICT_QUOTA_RESPECT) skip its headers until the next
+ * round.  Reservations are all ignored for a round in which they add up to
+ * more than zfs_arc_quota_reserve_pct of arc_c.
+ *
+ * Inactive quotas that are no longer referenced are freed here, since the
+ * eviction thread is the only one that may hold a quota pointer without a
+ * header reference.
+ */
+static uint64_t
+arc_quota_evict(void)
+{
+	static arc_state_t *const states[] = { arc_mru, arc_mru,
+	    arc_mfu, arc_mfu };
+	static const arc_buf_contents_t types[] = { ARC_BUFC_DATA,
+	    ARC_BUFC_METADATA, ARC_BUFC_DATA, ARC_BUFC_METADATA };
+	uint64_t excess = 0, reserved = 0, evicted = 0;
+	arc_quota_t *aq, *next;
+
+	arc_quota_evict_needed = B_FALSE;
+
+	rw_enter(&arc_quota_lock, RW_WRITER);
+	for (aq = avl_first(&arc_quota_tree); aq != NULL; aq = next) {
+		next = AVL_NEXT(&arc_quota_tree, aq);
+
+		if (!aq->aq_active) {
+			if (aq->aq_refcnt == 0) {
+				avl_remove(&arc_quota_tree, aq);
+				aggsum_fini(&aq->aq_size);
+				kmem_free(aq, sizeof (arc_quota_t));
+			}
+			continue;
+		}
+
+		uint64_t size = MAX(aggsum_value(&aq->aq_size), 0);
+		if (aq->aq_limit != 0 && size > aq->aq_limit) {
+			aq->aq_excess = size - aq->aq_limit;
+			excess += aq->aq_excess;
+		} else {
+			aq->aq_excess = 0;
+		}
+		aq->aq_protected = (aq->aq_reserve != 0 &&
+		    size <= aq->aq_reserve);
+		reserved += aq->aq_reserve;
+	}
+	if (reserved > arc_mf(arc_c, zfs_arc_quota_reserve_pct, 100)) {
+		ARCSTAT_BUMP(arcstat_quota_reserve_overcommit);
+		for (aq = avl_first(&arc_quota_tree); aq != NULL;
+		    aq = AVL_NEXT(&arc_quota_tree, aq))
+			aq->aq_protected = B_FALSE;
+	}
+	rw_exit(&arc_quota_lock);
+
+	for (int i = 0; i < ARRAY_SIZE(states) && evicted < excess; i++) {
+		uint64_t esize =
+		    zfs_refcount_count(&states[i]->arcs_esize[types[i]]);
+		if (esize == 0)
+			continue;
+		evicted += arc_evict_state(states[i], types[i], 0,
+		    ARC_EVICT_QUOTA_OVER, MIN(esize, excess - evicted));
+	}
+	ARCSTAT_INCR(arcstat_quota_evicted, evicted);
+
+	return (evicted);
+}
+
 /*
  * Evict buffers from the cache, such that arcstat_size is capped by arc_c.
  */
@@ -4656,6 +5065,51 @@ arc_flush(spa_t *spa, boolean_t retry)
 	arc_flush_impl(spa != NULL ? spa_load_guid(spa) : 0, retry);
 }
 
+/*
+ * Set the ARC limit and reservation for an objset; zero means none.  This
+ * is called from the objset's "arcquota" and "arcreservation" property
+ * callbacks, and with zeros when the objset is evicted.  Blocks that were
+ * already cached before a quota was set are not charged to it.
+ */
+void
+arc_quota_set(spa_t *spa, uint64_t objset, uint64_t limit, uint64_t reserve)
+{
+	arc_quota_t search = {
+		.aq_spa = spa_load_guid(spa),
+		.aq_objset = objset
+	};
+	boolean_t active = (limit != 0 || reserve != 0);
+	avl_index_t where;
+
+	rw_enter(&arc_quota_lock, RW_WRITER);
+	arc_quota_t *aq = avl_find(&arc_quota_tree, &search, &where);
+	if (aq == NULL) {
+		if (!active) {
+			rw_exit(&arc_quota_lock);
+			return;
+		}
+		aq = kmem_zalloc(sizeof (arc_quota_t), KM_SLEEP);
+		aq->aq_spa = search.aq_spa;
+		aq->aq_objset = objset;
+		aggsum_init(&aq->aq_size, 0);
+		avl_insert(&arc_quota_tree, aq, where);
+	}
+	if (active && !aq->aq_active)
+		arc_quota_count++;
+	else if (!active && aq->aq_active)
+		arc_quota_count--;
+	aq->aq_active = active;
+	aq->aq_limit = limit;
+	aq->aq_reserve = reserve;
+	if (reserve == 0)
+		aq->aq_protected = B_FALSE;
+	rw_exit(&arc_quota_lock);
+
+	/* Apply a lowered limit now, or free the quota if it's unused. */
+	arc_quota_evict_needed = B_TRUE;
+	zthr_wakeup(arc_evict_zthr);
+}
+
 static arc_async_flush_t *
 arc_async_flush_add(uint64_t spa_guid, uint_t level)
 {
@@ -4877,7 +5331,7 @@ arc_evict_cb_check(void *arg, zthr_t *zthr)
 	 * which is held before this function is called, and is held by
 	 * arc_wait_for_eviction() when it calls zthr_wakeup().
 	 */
-	if (arc_evict_needed)
+	if (arc_evict_needed || arc_quota_evict_needed)
 		return (B_TRUE);
 
 	/*
@@ -4905,6 +5359,14 @@ arc_evict_cb(void *arg, zthr_t *zthr)
 	evicted += arc_flush_state(arc_uncached, 0, ARC_BUFC_DATA, B_FALSE);
 	evicted += arc_flush_state(arc_uncached, 0, ARC_BUFC_METADATA, B_FALSE);
 
+	/*
+	 * Enforce per-objset quotas, and refresh the reservations that
+	 * arc_evict() must respect, before any normal eviction.
+	 */
+	if (arc_quota_evict_needed ||
+	    (arc_evict_needed && arc_quota_count > 0))
+		evicted += arc_quota_evict();
+
 	/* Evict from other states only if told to. */
 	if (arc_evict_needed)
 		evicted += arc_evict();
@@ -4938,6 +5400,7 @@ arc_evict_cb(void *arg, zthr_t *zthr)
 			cv_signal(&aw->aew_cv);
 		}
 		arc_set_need_free();
+		arc_numa_pressure_node = -1;
 	}
 	mutex_exit(&arc_evict_lock);
 	spl_fstrans_unmark(cookie);
@@ -5300,6 +5763,7 @@ arc_get_data_impl(arc_buf_hdr_t *hdr, uint64_t size, const void *tag,
 
 		(void) zfs_refcount_add_many(&state->arcs_size[type], size,
 		    tag);
+		arc_quota_charge(hdr, state, size);
 
 		/*
 		 * If this is reached via arc_read, the link is
@@ -5358,6 +5822,7 @@ arc_free_data_impl(arc_buf_hdr_t *hdr, uint64_t size, const void *tag)
 		    size, tag);
 	}
 	(void) zfs_refcount_remove_many(&state->arcs_size[type], size, tag);
+	arc_quota_charge(hdr, state, -(int64_t)size);
 
 	VERIFY3U(hdr->b_type, ==, type);
 	if (type == ARC_BUFC_METADATA) {
@@ -5368,6 +5833,103 @@ arc_free_data_impl(arc_buf_hdr_t *hdr, uint64_t size, const void *tag)
 	}
 }
 
+/*
+ * The counter in the given row of arc_sketch for a block.  Rows are
+ * indexed by double hashing of the block's 64-bit hash.
+ */
+static inline uint8_t *
+arc_sketch_counter(uint64_t hash, int row)
+{
+	uint64_t idx = hash + row * ((hash >> 32) | 1);
+
+	return (&arc_sketch[row * arc_sketch_width +
+	    (idx & (arc_sketch_width - 1))]);
+}
+
+/*
+ * Count an access to the block, and age the next word of the sketch if
+ * it is due.  Counters are updated without locking; the occasional lost
+ * update only makes the estimate a little lower.
+ */
+static void
+arc_sketch_increment(arc_buf_hdr_t *hdr)
+{
+	uint64_t hash = buf_hash(hdr->b_spa, &hdr->b_dva, hdr->b_birth);
+
+	for (int row = 0; row < ARC_SKETCH_DEPTH; row++) {
+		uint8_t *c = arc_sketch_counter(hash, row);
+		if (*c < ARC_SKETCH_MAX)
+			(*c)++;
+	}
+
+	uint64_t n = atomic_inc_64_nv(&arc_sketch_accesses);
+	if (n % ARC_SKETCH_AGE_INTERVAL == 0) {
+		uint64_t nwords = ARC_SKETCH_DEPTH * arc_sketch_width /
+		    sizeof (uint64_t);
+		uint64_t *w = (uint64_t *)arc_sketch +
+		    (n / ARC_SKETCH_AGE_INTERVAL) % nwords;
+
+		*w = (*w >> 1) & 0x7f7f7f7f7f7f7f7fULL;
+	}
+}
+
+/*
+ * The estimated number of recent accesses to the block.
+ */
+static uint_t
+arc_sketch_estimate(arc_buf_hdr_t *hdr)
+{
+	uint64_t hash = buf_hash(hdr->b_spa, &hdr->b_dva, hdr->b_birth);
+	uint_t freq = ARC_SKETCH_MAX;
+
+	for (int row = 0; row < ARC_SKETCH_DEPTH; row++)
+		freq = MIN(freq, *arc_sketch_counter(hash, row));
+
+	return (freq);
+}
+
+/*
+ * Allocate the sketch once zfs_arc_admit_min_freq has been enabled.  It is
+ * called from arc_init() and whenever the tunable is set; a setter that
+ * runs before arc_init() has sized the sketch leaves it to arc_init().
+ */
+void
+arc_sketch_alloc(void)
+{
+	if (zfs_arc_admit_min_freq == 0 || arc_sketch_width == 0 ||
+	    arc_sketch != NULL)
+		return;
+
+	uint8_t *sketch = vmem_zalloc(ARC_SKETCH_DEPTH * arc_sketch_width,
+	    KM_SLEEP);
+	if (atomic_cas_ptr(&arc_sketch, NULL, sketch) != NULL)
+		vmem_free(sketch, ARC_SKETCH_DEPTH * arc_sketch_width);
+}
+
+/*
+ * Decide whether a block that is being read into the ARC should be
+ * cached normally, or only until it has been used.  Metadata, and any
+ * block read while the ARC has room to spare, is always admitted.
+ */
+static boolean_t
+arc_admit(arc_buf_hdr_t *hdr)
+{
+	uint_t min_freq = zfs_arc_admit_min_freq;
+
+	if (min_freq == 0 || arc_sketch == NULL ||
+	    arc_buf_type(hdr) != ARC_BUFC_DATA ||
+	    aggsum_lower_bound(&arc_sums.arcstat_size) < arc_c)
+		return (B_TRUE);
+
+	/* The access being admitted hasn't been counted yet. */
+	if (arc_sketch_estimate(hdr) + 1 >= min_freq) {
+		ARCSTAT_BUMP(arcstat_admit_accepted);
+		return (B_TRUE);
+	}
+	ARCSTAT_BUMP(arcstat_admit_rejected);
+	return (B_FALSE);
+}
+
 /*
  * This routine is called whenever a buffer is accessed.
  */
@@ -5377,6 +5939,10 @@ arc_access(arc_buf_hdr_t *hdr, arc_flags_t arc_flags, boolean_t hit)
 	ASSERT(MUTEX_HELD(HDR_LOCK(hdr)));
 	ASSERT(HDR_HAS_L1HDR(hdr));
 
+	if (zfs_arc_admit_min_freq != 0 && arc_sketch != NULL &&
+	    !HDR_EMPTY(hdr))
+		arc_sketch_increment(hdr);
+
 	/*
 	 * Update buffer prefetch status.
 	 */
@@ -6157,6 +6723,8 @@ top:
 			arc_buf_hdr_t *exists = NULL;
 			hdr = arc_hdr_alloc(guid, psize, lsize,
 			    BP_IS_PROTECTED(bp), BP_GET_COMPRESS(bp), 0, type);
+			if (zb != NULL)
+				arc_hdr_set_quota(hdr, guid, zb->zb_objset);
 
 			if (!embedded_bp) {
 				hdr->b_dva = *BP_IDENTITY(bp);
@@ -6182,6 +6750,13 @@ top:
 				    hdr_full_cache);
 			}
 
+			/* Neither of these states holds any charged data. */
+			if (zb != NULL &&
+			    (hdr->b_l1hdr.b_state == arc_l2c_only ||
+			    GHOST_STATE(hdr->b_l1hdr.b_state))) {
+				arc_hdr_set_quota(hdr, guid, zb->zb_objset);
+			}
+
 			if (GHOST_STATE(hdr->b_l1hdr.b_state)) {
 				ASSERT0P(hdr->b_l1hdr.b_pabd);
 				ASSERT(!HDR_HAS_RABD(hdr));
@@ -6227,7 +6802,13 @@ top:
 				goto top;
 			}
 		}
-		if (*arc_flags & ARC_FLAG_UNCACHED) {
+		/*
+		 * A block that isn't in the ghost lists is new to the ARC,
+		 * and must first pass the admission filter.
+		 */
+		if ((*arc_flags & ARC_FLAG_UNCACHED) ||
+		    (hdr->b_l1hdr.b_state == arc_anon && !embedded_bp &&
+		    !arc_admit(hdr))) {
 			arc_hdr_set_flags(hdr, ARC_FLAG_UNCACHED);
 			if (!encrypted_read)
 				alloc_flags |= ARC_HDR_ALLOC_LINEAR;
@@ -6355,7 +6936,8 @@ top:
 
 				DTRACE_PROBE1(l2arc__hit, arc_buf_hdr_t *, hdr);
 				ARCSTAT_BUMP(arcstat_l2_hits);
-				hdr->b_l2hdr.b_hits++;
+				if (hdr->b_l2hits < UINT16_MAX)
+					hdr->b_l2hits++;
 
 				cb = kmem_zalloc(sizeof (l2arc_read_callback_t),
 				    KM_SLEEP);
@@ -6773,6 +7355,7 @@ arc_release(arc_buf_t *buf, const void *tag)
 
 		(void) zfs_refcount_remove_many(&state->arcs_size[type],
 		    arc_buf_size(buf), buf);
+		arc_quota_charge(hdr, state, -(int64_t)arc_buf_size(buf));
 
 		arc_cksum_verify(buf);
 		arc_buf_unwatch(buf);
@@ -7119,6 +7702,8 @@ arc_write(zio_t *pio, spa_t *spa, uint64_t txg,
 	ASSERT(!HDR_IO_IN_PROGRESS(hdr));
 	ASSERT0P(hdr->b_l1hdr.b_acb);
 	ASSERT3P(hdr->b_l1hdr.b_buf, !=, NULL);
+	if (zb != NULL)
+		arc_hdr_set_quota(hdr, spa_load_guid(spa), zb->zb_objset);
 	if (uncached)
 		arc_hdr_set_flags(hdr, ARC_FLAG_UNCACHED);
 	else if (l2arc)
@@ -7363,6 +7948,16 @@ arc_kstat_update(kstat_t *ksp, int rw)
 	    wmsum_value(&arc_sums.arcstat_evict_skip);
 	as->arcstat_evict_not_enough.value.ui64 =
 	    wmsum_value(&arc_sums.arcstat_evict_not_enough);
+	as->arcstat_quota_evicted.value.ui64 =
+	    wmsum_value(&arc_sums.arcstat_quota_evicted);
+	as->arcstat_quota_skip.value.ui64 =
+	    wmsum_value(&arc_sums.arcstat_quota_skip);
+	as->arcstat_quota_reserve_overcommit.value.ui64 =
+	    wmsum_value(&arc_sums.arcstat_quota_reserve_overcommit);
+	as->arcstat_admit_accepted.value.ui64 =
+	    wmsum_value(&arc_sums.arcstat_admit_accepted);
+	as->arcstat_admit_rejected.value.ui64 =
+	    wmsum_value(&arc_sums.arcstat_admit_rejected);
 	as->arcstat_evict_l2_cached.value.ui64 =
 	    wmsum_value(&arc_sums.arcstat_evict_l2_cached);
 	as->arcstat_evict_l2_eligible.value.ui64 =
@@ -7525,6 +8120,12 @@ arc_kstat_update(kstat_t *ksp, int rw)
 	    wmsum_value(&arc_sums.arcstat_l2_rebuild_bufs_precached);
 	as->arcstat_l2_rebuild_log_blks.value.ui64 =
 	    wmsum_value(&arc_sums.arcstat_l2_rebuild_log_blks);
+	as->arcstat_l2_rebuild_active.value.ui64 =
+	    wmsum_value(&arc_sums.arcstat_l2_rebuild_active);
+	as->arcstat_l2_rebuild_log_blks_expected.value.ui64 =
+	    wmsum_value(&arc_sums.arcstat_l2_rebuild_log_blks_expected);
+	as->arcstat_l2_rebuild_log_blks_pending.value.ui64 =
+	    wmsum_value(&arc_sums.arcstat_l2_rebuild_log_blks_pending);
 	as->arcstat_memory_throttle_count.value.ui64 =
 	    wmsum_value(&arc_sums.arcstat_memory_throttle_count);
 	as->arcstat_memory_direct_count.value.ui64 =
@@ -7551,6 +8152,8 @@ arc_kstat_update(kstat_t *ksp, int rw)
 	    wmsum_value(&arc_sums.arcstat_demand_hit_predictive_prefetch);
 	as->arcstat_demand_iohit_predictive_prefetch.value.ui64 =
 	    wmsum_value(&arc_sums.arcstat_demand_iohit_predictive_prefetch);
+	as->arcstat_evict_unused_predictive_prefetch.value.ui64 =
+	    wmsum_value(&arc_sums.arcstat_evict_unused_predictive_prefetch);
 	as->arcstat_prescient_prefetch.value.ui64 =
 	    wmsum_value(&arc_sums.arcstat_prescient_prefetch);
 	as->arcstat_demand_hit_prescient_prefetch.value.ui64 =
@@ -7603,6 +8206,27 @@ arc_state_multilist_index_func(multilist_t *ml, void *obj)
 	    multilist_get_num_sublists(ml));
 }
 
+/*
+ * Used instead of arc_state_multilist_index_func() for the non-ghost states
+ * when zfs_arc_numa is in effect. Each node owns an equal, contiguous range
+ * of sublists, within which headers are spread by hash. b_numa_node only
+ * changes while the header is on no list, so the index stays stable.
+ */
+static unsigned int
+arc_state_numa_multilist_index_func(multilist_t *ml, void *obj)
+{
+	arc_buf_hdr_t *hdr = obj;
+	unsigned int num_sublists = multilist_get_num_sublists(ml);
+	unsigned int nodes = MIN(arc_numa_nodes, num_sublists);
+	unsigned int per_node = num_sublists / nodes;
+
+	ASSERT(!HDR_EMPTY(hdr));
+
+	return ((hdr->b_numa_node % nodes) * per_node +
+	    (unsigned int)buf_hash(hdr->b_spa, &hdr->b_dva, hdr->b_birth) %
+	    per_node);
+}
+
 static unsigned int
 arc_state_l2c_multilist_index_func(multilist_t *ml, void *obj)
 {
@@ -7700,27 +8324,34 @@ static void
 arc_state_init(void)
 {
 	int num_sublists = 0;
+	multilist_sublist_index_func_t *index_func =
+	    arc_state_multilist_index_func;
+
+	if (zfs_arc_numa && arc_numa_node_count() > 1) {
+		arc_numa_nodes = arc_numa_node_count();
+		index_func = arc_state_numa_multilist_index_func;
+	}
 
 	arc_state_multilist_init(&arc_mru->arcs_list[ARC_BUFC_METADATA],
-	    arc_state_multilist_index_func, &num_sublists);
+	    index_func, &num_sublists);
 	arc_state_multilist_init(&arc_mru->arcs_list[ARC_BUFC_DATA],
-	    arc_state_multilist_index_func, &num_sublists);
+	    index_func, &num_sublists);
 	arc_state_multilist_init(&arc_mru_ghost->arcs_list[ARC_BUFC_METADATA],
 	    arc_state_multilist_index_func, &num_sublists);
 	arc_state_multilist_init(&arc_mru_ghost->arcs_list[ARC_BUFC_DATA],
 	    arc_state_multilist_index_func, &num_sublists);
 	arc_state_multilist_init(&arc_mfu->arcs_list[ARC_BUFC_METADATA],
-	    arc_state_multilist_index_func, &num_sublists);
+	    index_func, &num_sublists);
 	arc_state_multilist_init(&arc_mfu->arcs_list[ARC_BUFC_DATA],
-	    arc_state_multilist_index_func, &num_sublists);
+	    index_func, &num_sublists);
 	arc_state_multilist_init(&arc_mfu_ghost->arcs_list[ARC_BUFC_METADATA],
 	    arc_state_multilist_index_func, &num_sublists);
 	arc_state_multilist_init(&arc_mfu_ghost->arcs_list[ARC_BUFC_DATA],
 	    arc_state_multilist_index_func, &num_sublists);
 	arc_state_multilist_init(&arc_uncached->arcs_list[ARC_BUFC_METADATA],
-	    arc_state_multilist_index_func, &num_sublists);
+	    index_func, &num_sublists);
 	arc_state_multilist_init(&arc_uncached->arcs_list[ARC_BUFC_DATA],
-	    arc_state_multilist_index_func, &num_sublists);
+	    index_func, &num_sublists);
 
 	/*
 	 * L2 headers should never be on the L2 state list since they don't
@@ -7798,6 +8429,11 @@ arc_state_init(void)
 	wmsum_init(&arc_sums.arcstat_access_skip, 0);
 	wmsum_init(&arc_sums.arcstat_evict_skip, 0);
 	wmsum_init(&arc_sums.arcstat_evict_not_enough, 0);
+	wmsum_init(&arc_sums.arcstat_quota_evicted, 0);
+	wmsum_init(&arc_sums.arcstat_quota_skip, 0);
+	wmsum_init(&arc_sums.arcstat_quota_reserve_overcommit, 0);
+	wmsum_init(&arc_sums.arcstat_admit_accepted, 0);
+	wmsum_init(&arc_sums.arcstat_admit_rejected, 0);
 	wmsum_init(&arc_sums.arcstat_evict_l2_cached, 0);
 	wmsum_init(&arc_sums.arcstat_evict_l2_eligible, 0);
 	wmsum_init(&arc_sums.arcstat_evict_l2_eligible_mfu, 0);
@@ -7856,6 +8492,9 @@ arc_state_init(void)
 	wmsum_init(&arc_sums.arcstat_l2_rebuild_bufs, 0);
 	wmsum_init(&arc_sums.arcstat_l2_rebuild_bufs_precached, 0);
 	wmsum_init(&arc_sums.arcstat_l2_rebuild_log_blks, 0);
+	wmsum_init(&arc_sums.arcstat_l2_rebuild_active, 0);
+	wmsum_init(&arc_sums.arcstat_l2_rebuild_log_blks_expected, 0);
+	wmsum_init(&arc_sums.arcstat_l2_rebuild_log_blks_pending, 0);
 	wmsum_init(&arc_sums.arcstat_memory_throttle_count, 0);
 	wmsum_init(&arc_sums.arcstat_memory_direct_count, 0);
 	wmsum_init(&arc_sums.arcstat_memory_indirect_count, 0);
@@ -7865,6 +8504,7 @@ arc_state_init(void)
 	wmsum_init(&arc_sums.arcstat_predictive_prefetch, 0);
 	wmsum_init(&arc_sums.arcstat_demand_hit_predictive_prefetch, 0);
 	wmsum_init(&arc_sums.arcstat_demand_iohit_predictive_prefetch, 0);
+	wmsum_init(&arc_sums.arcstat_evict_unused_predictive_prefetch, 0);
 	wmsum_init(&arc_sums.arcstat_prescient_prefetch, 0);
 	wmsum_init(&arc_sums.arcstat_demand_hit_prescient_prefetch, 0);
 	wmsum_init(&arc_sums.arcstat_demand_iohit_prescient_prefetch, 0);
@@ -7957,6 +8597,11 @@ arc_state_fini(void)
 	wmsum_fini(&arc_sums.arcstat_access_skip);
 	wmsum_fini(&arc_sums.arcstat_evict_skip);
 	wmsum_fini(&arc_sums.arcstat_evict_not_enough);
+	wmsum_fini(&arc_sums.arcstat_quota_evicted);
+	wmsum_fini(&arc_sums.arcstat_quota_skip);
+	wmsum_fini(&arc_sums.arcstat_quota_reserve_overcommit);
+	wmsum_fini(&arc_sums.arcstat_admit_accepted);
+	wmsum_fini(&arc_sums.arcstat_admit_rejected);
 	wmsum_fini(&arc_sums.arcstat_evict_l2_cached);
 	wmsum_fini(&arc_sums.arcstat_evict_l2_eligible);
 	wmsum_fini(&arc_sums.arcstat_evict_l2_eligible_mfu);
@@ -8015,6 +8660,9 @@ arc_state_fini(void)
 	wmsum_fini(&arc_sums.arcstat_l2_rebuild_bufs);
 	wmsum_fini(&arc_sums.arcstat_l2_rebuild_bufs_precached);
 	wmsum_fini(&arc_sums.arcstat_l2_rebuild_log_blks);
+	wmsum_fini(&arc_sums.arcstat_l2_rebuild_active);
+	wmsum_fini(&arc_sums.arcstat_l2_rebuild_log_blks_expected);
+	wmsum_fini(&arc_sums.arcstat_l2_rebuild_log_blks_pending);
 	wmsum_fini(&arc_sums.arcstat_memory_throttle_count);
 	wmsum_fini(&arc_sums.arcstat_memory_direct_count);
 	wmsum_fini(&arc_sums.arcstat_memory_indirect_count);
@@ -8024,6 +8672,7 @@ arc_state_fini(void)
 	wmsum_fini(&arc_sums.arcstat_predictive_prefetch);
 	wmsum_fini(&arc_sums.arcstat_demand_hit_predictive_prefetch);
 	wmsum_fini(&arc_sums.arcstat_demand_iohit_predictive_prefetch);
+	wmsum_fini(&arc_sums.arcstat_evict_unused_predictive_prefetch);
 	wmsum_fini(&arc_sums.arcstat_prescient_prefetch);
 	wmsum_fini(&arc_sums.arcstat_demand_hit_prescient_prefetch);
 	wmsum_fini(&arc_sums.arcstat_demand_iohit_prescient_prefetch);
@@ -8068,6 +8717,9 @@ arc_init(void)
 	mutex_init(&arc_evict_lock, NULL, MUTEX_DEFAULT, NULL);
 	list_create(&arc_evict_waiters, sizeof (arc_evict_waiter_t),
 	    offsetof(arc_evict_waiter_t, aew_node));
+	rw_init(&arc_quota_lock, NULL, RW_DEFAULT, NULL);
+	avl_create(&arc_quota_tree, arc_quota_compare, sizeof (arc_quota_t),
+	    offsetof(arc_quota_t, aq_node));
 
 	arc_min_prefetch = MSEC_TO_TICK(1000);
 	arc_min_prescient_prefetch = MSEC_TO_TICK(6000);
@@ -8131,6 +8783,10 @@ arc_init(void)
 
 	buf_init();
 
+	/* One counter per row for every 32K of the maximum ARC size. */
+	arc_sketch_width = 1ULL << MIN(MAX(highbit64(arc_c_max >> 15), 10), 24);
+	arc_sketch_alloc();
+
 	list_create(&arc_prune_list, sizeof (arc_prune_t),
 	    offsetof(arc_prune_t, p_node));
 	mutex_init(&arc_prune_mtx, NULL, MUTEX_DEFAULT, NULL);
@@ -8257,6 +8913,23 @@ arc_fini(void)
 	mutex_destroy(&arc_evict_lock);
 	list_destroy(&arc_evict_waiters);
 
+	arc_quota_t *aq;
+	void *cookie = NULL;
+	while ((aq = avl_destroy_nodes(&arc_quota_tree, &cookie)) != NULL) {
+		ASSERT0(aq->aq_refcnt);
+		aggsum_fini(&aq->aq_size);
+		kmem_free(aq, sizeof (arc_quota_t));
+	}
+	avl_destroy(&arc_quota_tree);
+	rw_destroy(&arc_quota_lock);
+	arc_quota_count = 0;
+
+	if (arc_sketch != NULL) {
+		vmem_free(arc_sketch, ARC_SKETCH_DEPTH * arc_sketch_width);
+		arc_sketch = NULL;
+	}
+	arc_sketch_width = 0;
+
 	/*
 	 * Free any buffers that were tagged for destruction.  This needs
 	 * to occur before arc_state_fini() runs and destroys the aggsum
@@ -8613,6 +9286,33 @@ l2arc_do_free_on_write(l2arc_dev_t *dev)
  * A write to a cache device has completed.  Update all headers to allow
  * reads from these buffers to begin.
  */
+/*
+ * Add the time the cache device spent on one of a feed cycle's writes, from
+ * the write entering the vdev queue to its completion, to the cycle's busy
+ * time.  Time with no write outstanding, such as while
+ * l2arc_write_buffers() is still scanning and transforming buffers, is left
+ * out, so that l2ad_write_bw reflects the device rather than the feed
+ * thread.  Completions are taken to arrive in issue order, which holds
+ * closely for the sequential writes of a feed cycle.
+ */
+static void
+l2arc_write_child_done(zio_t *zio)
+{
+	l2arc_write_callback_t *cb = zio->io_private;
+	hrtime_t end = gethrtime();
+
+	if (zio->io_timestamp == 0)
+		return;
+
+	mutex_enter(&cb->l2wcb_busy_lock);
+	hrtime_t start = MAX(zio->io_timestamp, cb->l2wcb_busy_end);
+	if (end > start) {
+		cb->l2wcb_busy += end - start;
+		cb->l2wcb_busy_end = end;
+	}
+	mutex_exit(&cb->l2wcb_busy_lock);
+}
+
 static void
 l2arc_write_done(zio_t *zio)
 {
@@ -8794,6 +9494,13 @@ top:
 
 	l2arc_do_free_on_write(dev);
 
+	if (zio->io_error == 0 && cb->l2wcb_sample_asize != 0 &&
+	    cb->l2wcb_busy != 0) {
+		l2arc_write_bw_update(dev, cb->l2wcb_sample_asize,
+		    cb->l2wcb_busy);
+	}
+	mutex_destroy(&cb->l2wcb_busy_lock);
+
 	kmem_free(cb, sizeof (l2arc_write_callback_t));
 }
 
@@ -8919,14 +9626,26 @@ l2arc_read_done(zio_t *zio)
 	 * move it and free the buffer.
 	 */
 	if (cb->l2rcb_abd != NULL) {
-		ASSERT3U(arc_hdr_size(hdr), <, zio->io_size);
+		uint64_t size = arc_hdr_size(hdr);
+
+		/*
+		 * As in arc_read(), a compressed L2ARC block read for a
+		 * header with Compressed ARC disabled is only PSIZE long.
+		 */
+		if (HDR_GET_COMPRESS(hdr) != ZIO_COMPRESS_OFF &&
+		    !HDR_COMPRESSION_ENABLED(hdr) &&
+		    HDR_GET_PSIZE(hdr) != 0) {
+			size = HDR_GET_PSIZE(hdr);
+		}
+
+		ASSERT3U(size, <, zio->io_size);
 		if (zio->io_error == 0) {
 			if (using_rdata) {
 				abd_copy(hdr->b_crypt_hdr.b_rabd,
-				    cb->l2rcb_abd, arc_hdr_size(hdr));
+				    cb->l2rcb_abd, size);
 			} else {
 				abd_copy(hdr->b_l1hdr.b_pabd,
-				    cb->l2rcb_abd, arc_hdr_size(hdr));
+				    cb->l2rcb_abd, size);
 			}
 		}
 
@@ -8942,7 +9661,7 @@ l2arc_read_done(zio_t *zio)
 		 * needs real data.
 		 */
 		abd_free(cb->l2rcb_abd);
-		zio->io_size = zio->io_orig_size = arc_hdr_size(hdr);
+		zio->io_size = zio->io_orig_size = size;
 
 		if (using_rdata) {
 			ASSERT(HDR_HAS_RABD(hdr));
@@ -9250,6 +9969,55 @@ l2arc_dwpd_rate_limit(l2arc_dev_t *dev)
 	return ((total_budget - dev->l2ad_dwpd_writes) / remaining_secs);
 }
 
+/*
+ * Fold the throughput of a completed feed cycle, over the time the device
+ * was busy with its writes, into the device's smoothed write bandwidth and
+ * the pool's total.
+ */
+static void
+l2arc_write_bw_update(l2arc_dev_t *dev, uint64_t bytes, hrtime_t busy)
+{
+	l2arc_info_t *info = &dev->l2ad_spa->spa_l2arc_info;
+	uint64_t sample = bytes * NANOSEC / MAX(busy, 1);
+	uint64_t old = dev->l2ad_write_bw;
+	uint64_t bw = (old == 0) ? sample : (old * 7 + sample) / 8;
+
+	mutex_enter(&info->l2arc_sublist_lock);
+	if (old == 0)
+		info->l2arc_write_bw_ndev++;
+	info->l2arc_write_bw_total += bw - old;
+	dev->l2ad_write_bw = bw;
+	mutex_exit(&info->l2arc_sublist_lock);
+}
+
+/*
+ * With l2arc_write_balance, the pool's combined write rate of
+ * l2arc_write_max per device is split among its cache devices in
+ * proportion to their measured write bandwidth, so that faster devices
+ * absorb more of the feed.  No device gets less than a quarter of
+ * l2arc_write_max.
+ */
+static uint64_t
+l2arc_balanced_write_rate(l2arc_dev_t *dev, uint64_t write_max)
+{
+	l2arc_info_t *info = &dev->l2ad_spa->spa_l2arc_info;
+	uint64_t bw = dev->l2ad_write_bw;
+
+	if (!l2arc_write_balance || bw == 0)
+		return (write_max);
+
+	mutex_enter(&info->l2arc_sublist_lock);
+	uint64_t total = info->l2arc_write_bw_total;
+	uint64_t ndev = info->l2arc_write_bw_ndev;
+	mutex_exit(&info->l2arc_sublist_lock);
+
+	if (ndev < 2 || total == 0)
+		return (write_max);
+
+	uint64_t share = MIN(bw * 1000 / total, 1000);
+	return (MAX(write_max * ndev / 1000 * share, write_max / 4));
+}
+
 /*
  * Get write rate based on device state and DWPD configuration.
  */
@@ -9267,6 +10035,7 @@ l2arc_get_write_rate(l2arc_dev_t *dev)
 		    "resetting it to the default (%d)", L2ARC_WRITE_SIZE);
 		write_max = l2arc_write_max = L2ARC_WRITE_SIZE;
 	}
+	write_max = l2arc_balanced_write_rate(dev, write_max);
 
 	/* Apply DWPD rate limit for persistent marker configurations */
 	if (!dev->l2ad_first && l2arc_dwpd_limit > 0 &&
@@ -9787,8 +10556,8 @@ skip:
 
 		hdr->b_l2hdr.b_dev = dev;
 		hdr->b_l2hdr.b_daddr = dev->l2ad_hand;
-		hdr->b_l2hdr.b_hits = 0;
-		hdr->b_l2hdr.b_arcs_state =
+		hdr->b_l2hits = 0;
+		hdr->b_l2arcs_state =
 		    hdr->b_l1hdr.b_state->arcs_state;
 		/* l2arc_hdr_arcstats_update() expects a valid asize */
 		HDR_SET_L2SIZE(hdr, asize);
@@ -9820,6 +10589,11 @@ skip:
 			    KM_SLEEP);
 			(*cb)->l2wcb_dev = dev;
 			(*cb)->l2wcb_head = head;
+			mutex_init(&(*cb)->l2wcb_busy_lock, NULL,
+			    MUTEX_DEFAULT, NULL);
+			(*cb)->l2wcb_busy = 0;
+			(*cb)->l2wcb_busy_end = 0;
+			(*cb)->l2wcb_sample_asize = 0;
 			list_create(&(*cb)->l2wcb_abd_list,
 			    sizeof (l2arc_lb_abd_buf_t),
 			    offsetof(l2arc_lb_abd_buf_t, node));
@@ -9829,7 +10603,7 @@ skip:
 
 		zio_t *wzio = zio_write_phys(*pio, dev->l2ad_vdev,
 		    dev->l2ad_hand, asize, to_write, ZIO_CHECKSUM_OFF,
-		    NULL, hdr, ZIO_PRIORITY_ASYNC_WRITE,
+		    l2arc_write_child_done, *cb, ZIO_PRIORITY_ASYNC_WRITE,
 		    ZIO_FLAG_CANFAIL, B_FALSE);
 
 		DTRACE_PROBE2(l2arc__write, vdev_t *, dev->l2ad_vdev,
@@ -10166,6 +10940,14 @@ l2arc_write_buffers(spa_t *spa, l2arc_dev_t *dev, uint64_t target_sz)
 	ARCSTAT_BUMP(arcstat_l2_writes_sent);
 	ARCSTAT_INCR(arcstat_l2_write_bytes, write_psize);
 
+	/*
+	 * A cycle that ran short of eligible buffers says little about
+	 * how fast the device can write.  l2arc_write_done() takes the
+	 * sample, and the root zio can't complete before zio_wait().
+	 */
+	if (write_asize >= target_sz / 2)
+		cb->l2wcb_sample_asize = write_asize;
+
 	dev->l2ad_writing = B_TRUE;
 	(void) zio_wait(pio);
 	dev->l2ad_writing = B_FALSE;
@@ -10681,6 +11463,13 @@ l2arc_remove_vdev(vdev_t *vd)
 	spa->spa_l2arc_info.l2arc_total_capacity -=
 	    (remdev->l2ad_end - remdev->l2ad_start);
 	l2arc_update_smallest_capacity(spa);
+	if (remdev->l2ad_write_bw != 0) {
+		mutex_enter(&spa->spa_l2arc_info.l2arc_sublist_lock);
+		spa->spa_l2arc_info.l2arc_write_bw_total -=
+		    remdev->l2ad_write_bw;
+		spa->spa_l2arc_info.l2arc_write_bw_ndev--;
+		mutex_exit(&spa->spa_l2arc_info.l2arc_sublist_lock);
+	}
 
 	/*
 	 * Clean up pool-based markers if this was the last L2ARC device
@@ -10724,11 +11513,16 @@ l2arc_init(void)
 	    offsetof(l2arc_dev_t, l2ad_node));
 	list_create(l2arc_free_on_write, sizeof (l2arc_data_free_t),
 	    offsetof(l2arc_data_free_t, l2df_list_node));
+
+	l2arc_rebuild_taskq = taskq_create("l2arc_rebuild", boot_ncpus,
+	    minclsyspri, 1, INT_MAX, TASKQ_DYNAMIC);
 }
 
 void
 l2arc_fini(void)
 {
+	taskq_destroy(l2arc_rebuild_taskq);
+
 	mutex_destroy(&l2arc_rebuild_thr_lock);
 	cv_destroy(&l2arc_rebuild_thr_cv);
 	mutex_destroy(&l2arc_dev_mtx);
@@ -10841,11 +11635,17 @@ l2arc_rebuild(l2arc_dev_t *dev)
 	zio_t			*this_io = NULL, *next_io = NULL;
 	l2arc_log_blkptr_t	lbps[2];
 	l2arc_lb_ptr_buf_t	*lb_ptr_buf;
+	l2arc_rebuild_sync_t	sync;
 	boolean_t		lock_held;
 
 	this_lb = vmem_zalloc(sizeof (*this_lb), KM_SLEEP);
 	next_lb = vmem_zalloc(sizeof (*next_lb), KM_SLEEP);
 
+	mutex_init(&sync.lrs_lock, NULL, MUTEX_DEFAULT, NULL);
+	cv_init(&sync.lrs_cv, NULL, CV_DEFAULT, NULL);
+	sync.lrs_pending = 0;
+	ARCSTAT_BUMP(arcstat_l2_rebuild_active);
+
 	/*
 	 * We prevent device removal while issuing reads to the device,
 	 * then during the rebuilding phases we drop this lock again so
@@ -10878,6 +11678,8 @@ l2arc_rebuild(l2arc_dev_t *dev)
 
 	/* Prepare the rebuild process */
 	memcpy(lbps, l2dhdr->dh_start_lbps, sizeof (lbps));
+	ARCSTAT_INCR(arcstat_l2_rebuild_log_blks_expected,
+	    l2dhdr->dh_lb_count);
 
 	/* Start the rebuild process */
 	for (;;) {
@@ -10910,15 +11712,20 @@ l2arc_rebuild(l2arc_dev_t *dev)
 
 		/*
 		 * Now that we know that the next_lb checks out alright, we
-		 * can start reconstruction from this log block.
+		 * can start reconstruction from this log block. The task
+		 * takes ownership of this_lb, and the block being fetched
+		 * into next_lb becomes the next one we look at.
 		 * L2BLK_GET_PSIZE returns aligned size for log blocks.
 		 */
 		uint64_t asize = L2BLK_GET_PSIZE((&lbps[0])->lbp_prop);
-		l2arc_log_blk_restore(dev, this_lb, asize);
+		l2arc_log_blkptr_t prev_lbp = this_lb->lb_prev_lbp;
+		l2arc_log_blk_dispatch(dev, &sync, this_lb, asize);
+		this_lb = next_lb;
+		next_lb = NULL;
 
 		/*
-		 * log block restored, include its pointer in the list of
-		 * pointers to log blocks present in the L2ARC device.
+		 * Include the log block's pointer in the list of pointers
+		 * to log blocks present in the L2ARC device.
 		 */
 		lb_ptr_buf = kmem_zalloc(sizeof (l2arc_lb_ptr_buf_t), KM_SLEEP);
 		lb_ptr_buf->lb_ptr = kmem_zalloc(sizeof (l2arc_log_blkptr_t),
@@ -10989,8 +11796,8 @@ l2arc_rebuild(l2arc_dev_t *dev)
 		 * Continue with the next log block.
 		 */
 		lbps[0] = lbps[1];
-		lbps[1] = this_lb->lb_prev_lbp;
-		PTR_SWAP(this_lb, next_lb);
+		lbps[1] = prev_lbp;
+		next_lb = vmem_zalloc(sizeof (*next_lb), KM_SLEEP);
 		this_io = next_io;
 		next_io = NULL;
 	}
@@ -11000,8 +11807,19 @@ l2arc_rebuild(l2arc_dev_t *dev)
 out:
 	if (next_io != NULL)
 		l2arc_log_blk_fetch_abort(next_io);
-	vmem_free(this_lb, sizeof (*this_lb));
-	vmem_free(next_lb, sizeof (*next_lb));
+	if (this_lb != NULL)
+		vmem_free(this_lb, sizeof (*this_lb));
+	if (next_lb != NULL)
+		vmem_free(next_lb, sizeof (*next_lb));
+
+	/* Wait for the restore tasks still working on our log blocks. */
+	mutex_enter(&sync.lrs_lock);
+	while (sync.lrs_pending > 0)
+		cv_wait(&sync.lrs_cv, &sync.lrs_lock);
+	mutex_exit(&sync.lrs_lock);
+	mutex_destroy(&sync.lrs_lock);
+	cv_destroy(&sync.lrs_cv);
+	ARCSTAT_BUMPDOWN(arcstat_l2_rebuild_active);
 
 	if (err == ECANCELED) {
 		/*
@@ -11230,15 +12048,80 @@ cleanup:
 	return (err);
 }
 
+/*
+ * Restores one log block on l2arc_rebuild_taskq, then releases the marker
+ * and log block buffer handed over by l2arc_log_blk_dispatch().
+ */
+static void
+l2arc_log_blk_restore_task(void *arg)
+{
+	l2arc_rebuild_task_t *lrt = arg;
+	l2arc_dev_t *dev = lrt->lrt_dev;
+	l2arc_rebuild_sync_t *sync = lrt->lrt_sync;
+
+	l2arc_log_blk_restore(dev, lrt->lrt_lb, lrt->lrt_lb_asize,
+	    lrt->lrt_marker);
+
+	mutex_enter(&dev->l2ad_mtx);
+	list_remove(&dev->l2ad_buflist, lrt->lrt_marker);
+	mutex_exit(&dev->l2ad_mtx);
+
+	arc_state_free_marker(lrt->lrt_marker);
+	vmem_free(lrt->lrt_lb, sizeof (*lrt->lrt_lb));
+	kmem_free(lrt, sizeof (*lrt));
+	ARCSTAT_BUMPDOWN(arcstat_l2_rebuild_log_blks_pending);
+
+	mutex_enter(&sync->lrs_lock);
+	sync->lrs_pending--;
+	cv_broadcast(&sync->lrs_cv);
+	mutex_exit(&sync->lrs_lock);
+}
+
+/*
+ * Queues a validated log block for restoration. Its headers will be
+ * restored in front of a marker placed at the tail of l2ad_buflist now,
+ * behind those of every log block dispatched earlier. At most two log
+ * blocks per CPU are outstanding per device, which bounds the memory
+ * held by log block buffers when restoration falls behind the reads.
+ */
+static void
+l2arc_log_blk_dispatch(l2arc_dev_t *dev, l2arc_rebuild_sync_t *sync,
+    l2arc_log_blk_phys_t *lb, uint64_t lb_asize)
+{
+	l2arc_rebuild_task_t *lrt = kmem_zalloc(sizeof (*lrt), KM_SLEEP);
+
+	mutex_enter(&sync->lrs_lock);
+	while (sync->lrs_pending >= 2 * boot_ncpus)
+		cv_wait(&sync->lrs_cv, &sync->lrs_lock);
+	sync->lrs_pending++;
+	mutex_exit(&sync->lrs_lock);
+
+	lrt->lrt_dev = dev;
+	lrt->lrt_sync = sync;
+	lrt->lrt_lb = lb;
+	lrt->lrt_lb_asize = lb_asize;
+	lrt->lrt_marker = arc_state_alloc_marker();
+
+	mutex_enter(&dev->l2ad_mtx);
+	list_insert_tail(&dev->l2ad_buflist, lrt->lrt_marker);
+	mutex_exit(&dev->l2ad_mtx);
+
+	ARCSTAT_BUMP(arcstat_l2_rebuild_log_blks_pending);
+	taskq_init_ent(&lrt->lrt_tqent);
+	taskq_dispatch_ent(l2arc_rebuild_taskq, l2arc_log_blk_restore_task,
+	    lrt, 0, &lrt->lrt_tqent);
+}
+
 /*
  * Restores the payload of a log block to ARC. This creates empty ARC hdr
  * entries which only contain an l2arc hdr, essentially restoring the
  * buffers to their L2ARC evicted state. This function also updates space
  * usage on the L2ARC vdev to make sure it tracks restored buffers.
+ * Headers are inserted into l2ad_buflist just ahead of `marker'.
  */
 static void
 l2arc_log_blk_restore(l2arc_dev_t *dev, const l2arc_log_blk_phys_t *lb,
-    uint64_t lb_asize)
+    uint64_t lb_asize, arc_buf_hdr_t *marker)
 {
 	uint64_t	size = 0, asize = 0;
 	uint64_t	log_entries = dev->l2ad_log_entries;
@@ -11254,8 +12137,10 @@ l2arc_log_blk_restore(l2arc_dev_t *dev, const l2arc_log_blk_phys_t *lb,
 		/*
 		 * Restore goes in the reverse temporal direction to preserve
 		 * correct temporal ordering of buffers in the l2ad_buflist.
-		 * l2arc_hdr_restore also does a list_insert_tail instead of
-		 * list_insert_head on the l2ad_buflist:
+		 * l2arc_hdr_restore inserts each buffer just ahead of this
+		 * log block's marker, which has the effect of a
+		 * list_insert_tail rather than a list_insert_head on the
+		 * l2ad_buflist:
 		 *
 		 *		LIST	l2ad_buflist		LIST
 		 *		HEAD  <------ (time) ------	TAIL
@@ -11274,7 +12159,7 @@ l2arc_log_blk_restore(l2arc_dev_t *dev, const l2arc_log_blk_phys_t *lb,
 		size += L2BLK_GET_LSIZE((&lb->lb_entries[i])->le_prop);
 		asize += vdev_psize_to_asize(dev->l2ad_vdev,
 		    L2BLK_GET_PSIZE((&lb->lb_entries[i])->le_prop));
-		l2arc_hdr_restore(&lb->lb_entries[i], dev);
+		l2arc_hdr_restore(&lb->lb_entries[i], dev, marker);
 	}
 
 	/*
@@ -11295,7 +12180,8 @@ l2arc_log_blk_restore(l2arc_dev_t *dev, const l2arc_log_blk_phys_t *lb,
  * into a state indicating that it has been evicted to L2ARC.
  */
 static void
-l2arc_hdr_restore(const l2arc_log_ent_phys_t *le, l2arc_dev_t *dev)
+l2arc_hdr_restore(const l2arc_log_ent_phys_t *le, l2arc_dev_t *dev,
+    arc_buf_hdr_t *marker)
 {
 	arc_buf_hdr_t		*hdr, *exists;
 	kmutex_t		*hash_lock;
@@ -11324,7 +12210,7 @@ l2arc_hdr_restore(const l2arc_log_ent_phys_t *le, l2arc_dev_t *dev)
 	vdev_space_update(dev->l2ad_vdev, asize, 0, 0);
 
 	mutex_enter(&dev->l2ad_mtx);
-	list_insert_tail(&dev->l2ad_buflist, hdr);
+	list_insert_before(&dev->l2ad_buflist, marker, hdr);
 	(void) zfs_refcount_add_many(&dev->l2ad_alloc, arc_hdr_size(hdr), hdr);
 	mutex_exit(&dev->l2ad_mtx);
 
@@ -11342,12 +12228,12 @@ l2arc_hdr_restore(const l2arc_log_ent_phys_t *le, l2arc_dev_t *dev)
 			arc_hdr_set_flags(exists, ARC_FLAG_HAS_L2HDR);
 			exists->b_l2hdr.b_dev = dev;
 			exists->b_l2hdr.b_daddr = le->le_daddr;
-			exists->b_l2hdr.b_arcs_state =
+			exists->b_l2arcs_state =
 			    L2BLK_GET_STATE((le)->le_prop);
 			/* l2arc_hdr_arcstats_update() expects a valid asize */
 			HDR_SET_L2SIZE(exists, asize);
 			mutex_enter(&dev->l2ad_mtx);
-			list_insert_tail(&dev->l2ad_buflist, exists);
+			list_insert_before(&dev->l2ad_buflist, marker, exists);
 			(void) zfs_refcount_add_many(&dev->l2ad_alloc,
 			    arc_hdr_size(exists), exists);
 			mutex_exit(&dev->l2ad_mtx);
@@ -11536,7 +12422,7 @@ l2arc_log_blk_commit(l2arc_dev_t *dev, zio_t *pio, l2arc_write_callback_t *cb)
 	/* perform the write itself */
 	abd_buf->abd = abd;
 	wzio = zio_write_phys(pio, dev->l2ad_vdev, dev->l2ad_hand,
-	    asize, abd_buf->abd, ZIO_CHECKSUM_OFF, NULL, NULL,
+	    asize, abd_buf->abd, ZIO_CHECKSUM_OFF, l2arc_write_child_done, cb,
 	    ZIO_PRIORITY_ASYNC_WRITE, ZIO_FLAG_CANFAIL, B_FALSE);
 	DTRACE_PROBE2(l2arc__write, vdev_t *, dev->l2ad_vdev, zio_t *, wzio);
 	(void) zio_nowait(wzio);
@@ -11657,7 +12543,7 @@ l2arc_log_blk_insert(l2arc_dev_t *dev, const arc_buf_hdr_t *hdr)
 	L2BLK_SET_TYPE((le)->le_prop, hdr->b_type);
 	L2BLK_SET_PROTECTED((le)->le_prop, !!(HDR_PROTECTED(hdr)));
 	L2BLK_SET_PREFETCH((le)->le_prop, !!(HDR_PREFETCH(hdr)));
-	L2BLK_SET_STATE((le)->le_prop, hdr->b_l2hdr.b_arcs_state);
+	L2BLK_SET_STATE((le)->le_prop, hdr->b_l2arcs_state);
 
 	dev->l2ad_log_blk_payload_asize += vdev_psize_to_asize(dev->l2ad_vdev,
 	    HDR_GET_PSIZE(hdr));
@@ -11754,6 +12640,9 @@ ZFS_MODULE_PARAM_CALL(zfs_arc, zfs_arc_, min_prescient_prefetch_ms,
 ZFS_MODULE_PARAM(zfs_l2arc, l2arc_, write_max, U64, ZMOD_RW,
 	"Max write bytes per interval");
 
+ZFS_MODULE_PARAM(zfs_l2arc, l2arc_, write_balance, INT, ZMOD_RW,
+	"Split L2ARC writes among devices by measured bandwidth");
+
 ZFS_MODULE_PARAM_CALL(zfs_l2arc, l2arc_, dwpd_limit, param_set_l2arc_dwpd_limit,
 	spl_param_get_u64, ZMOD_RW,
 	"L2ARC device endurance limit as percentage (100 = 1.0 DWPD)");
@@ -11828,8 +12717,18 @@ ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, evict_batch_limit, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, evict_batches_limit, UINT, ZMOD_RW,
 	"The number of batches to run per parallel eviction task");
 
+ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, quota_reserve_pct, UINT, ZMOD_RW,
+	"Percent of arc_c that dataset arcreservations may add up to");
+
+ZFS_MODULE_PARAM_CALL(zfs_arc, zfs_arc_, admit_min_freq,
+	param_set_arc_admit_min_freq, param_get_uint, ZMOD_RW,
+	"Recent accesses a data block needs to enter a full ARC (0 = any)");
+
 ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, prune_task_threads, INT, ZMOD_RW,
 	"Number of arc_prune threads");
 
 ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, evict_threads, UINT, ZMOD_RD,
 	"Number of threads to use for ARC eviction.");
+
+ZFS_MODULE_PARAM(zfs_arc, zfs_arc_, numa, INT, ZMOD_RD,
+	"Keep ARC eviction lists per NUMA node");
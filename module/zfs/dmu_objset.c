@@ -270,6 +270,26 @@ prefetch_changed_cb(void *arg, uint64_t newval)
 	os->os_prefetch = newval;
 }
 
+static void
+arc_quota_changed_cb(void *arg, uint64_t newval)
+{
+	objset_t *os = arg;
+
+	os->os_arc_quota = newval;
+	arc_quota_set(os->os_spa, dmu_objset_id(os), os->os_arc_quota,
+	    os->os_arc_reservation);
+}
+
+static void
+arc_reservation_changed_cb(void *arg, uint64_t newval)
+{
+	objset_t *os = arg;
+
+	os->os_arc_reservation = newval;
+	arc_quota_set(os->os_spa, dmu_objset_id(os), os->os_arc_quota,
+	    os->os_arc_reservation);
+}
+
 static void
 sync_changed_cb(void *arg, uint64_t newval)
 {
@@ -626,8 +646,21 @@ dmu_objset_open_impl(spa_t *spa, dsl_dataset_t *ds, blkptr_t *bp,
 				    zfs_prop_to_name(ZFS_PROP_DIRECT),
 				    direct_changed_cb, os);
 			}
+			if (err == 0) {
+				err = dsl_prop_register(ds,
+				    zfs_prop_to_name(ZFS_PROP_ARCQUOTA),
+				    arc_quota_changed_cb, os);
+			}
+			if (err == 0) {
+				err = dsl_prop_register(ds,
+				    zfs_prop_to_name(ZFS_PROP_ARCRESERVATION),
+				    arc_reservation_changed_cb, os);
+			}
 		}
 		if (err != 0) {
+			if (os->os_arc_quota != 0 ||
+			    os->os_arc_reservation != 0)
+				arc_quota_set(spa, ds->ds_object, 0, 0);
 			arc_buf_destroy(os->os_phys_buf, &os->os_phys_buf);
 			kmem_free(os, sizeof (objset_t));
 			return (err);
@@ -998,6 +1031,13 @@ dmu_objset_evict(objset_t *os)
 	if (ds)
 		dsl_prop_unregister_all(ds, os);
 
+	/*
+	 * Blocks cached for this objset stay charged to its quota until they
+	 * are evicted, but the limit and reservation no longer apply.
+	 */
+	if (os->os_arc_quota != 0 || os->os_arc_reservation != 0)
+		arc_quota_set(os->os_spa, dmu_objset_id(os), 0, 0);
+
 	if (os->os_sa)
 		sa_tear_down(os);
 
@@ -60,6 +60,17 @@ static unsigned int	zfetch_max_idistance = 128 * 1024 * 1024;
 static unsigned int	zfetch_max_reorder = 16 * 1024 * 1024;
 /* Max log2 fraction of holes in a stream */
 static unsigned int	zfetch_hole_shift = 2;
+/* Min percent of predictive prefetches used before eviction, 0 to ignore */
+static unsigned int	zfetch_min_accuracy = 0;
+
+/*
+ * Last sample of the ARC's predictive prefetch outcomes, taken at most once
+ * a second by dmu_zfetch_inaccurate(), and the accuracy derived from it.
+ */
+static uint32_t		zfetch_accuracy_time;
+static uint64_t		zfetch_accuracy_used;
+static uint64_t		zfetch_accuracy_unused;
+static unsigned int	zfetch_accuracy = 100;
 
 typedef struct zfetch_stats {
 	kstat_named_t zfetchstat_hits;
@@ -70,6 +81,8 @@ typedef struct zfetch_stats {
 	kstat_named_t zfetchstat_max_streams;
 	kstat_named_t zfetchstat_io_issued;
 	kstat_named_t zfetchstat_io_active;
+	kstat_named_t zfetchstat_accuracy;
+	kstat_named_t zfetchstat_throttled;
 } zfetch_stats_t;
 
 static zfetch_stats_t zfetch_stats = {
@@ -81,6 +94,8 @@ static zfetch_stats_t zfetch_stats = {
 	{ "max_streams",		KSTAT_DATA_UINT64 },
 	{ "io_issued",			KSTAT_DATA_UINT64 },
 	{ "io_active",			KSTAT_DATA_UINT64 },
+	{ "accuracy",			KSTAT_DATA_UINT64 },
+	{ "throttled",			KSTAT_DATA_UINT64 },
 };
 
 struct {
@@ -92,6 +107,7 @@ struct {
 	wmsum_t zfetchstat_max_streams;
 	wmsum_t zfetchstat_io_issued;
 	aggsum_t zfetchstat_io_active;
+	wmsum_t zfetchstat_throttled;
 } zfetch_sums;
 
 #define	ZFETCHSTAT_BUMP(stat)					\
@@ -125,6 +141,9 @@ zfetch_kstats_update(kstat_t *ksp, int rw)
 	    wmsum_value(&zfetch_sums.zfetchstat_io_issued);
 	zs->zfetchstat_io_active.value.ui64 =
 	    aggsum_value(&zfetch_sums.zfetchstat_io_active);
+	zs->zfetchstat_accuracy.value.ui64 = zfetch_accuracy;
+	zs->zfetchstat_throttled.value.ui64 =
+	    wmsum_value(&zfetch_sums.zfetchstat_throttled);
 	return (0);
 }
 
@@ -139,6 +158,7 @@ zfetch_init(void)
 	wmsum_init(&zfetch_sums.zfetchstat_max_streams, 0);
 	wmsum_init(&zfetch_sums.zfetchstat_io_issued, 0);
 	aggsum_init(&zfetch_sums.zfetchstat_io_active, 0);
+	wmsum_init(&zfetch_sums.zfetchstat_throttled, 0);
 
 	zfetch_ksp = kstat_create("zfs", 0, "zfetchstats", "misc",
 	    KSTAT_TYPE_NAMED, sizeof (zfetch_stats) / sizeof (kstat_named_t),
@@ -168,6 +188,7 @@ zfetch_fini(void)
 	wmsum_fini(&zfetch_sums.zfetchstat_io_issued);
 	ASSERT0(aggsum_value(&zfetch_sums.zfetchstat_io_active));
 	aggsum_fini(&zfetch_sums.zfetchstat_io_active);
+	wmsum_fini(&zfetch_sums.zfetchstat_throttled);
 }
 
 /*
@@ -331,6 +352,43 @@ dmu_zfetch_done(void *arg, uint64_t level, uint64_t blkid, boolean_t io_issued)
 	aggsum_add(&zfetch_sums.zfetchstat_io_active, -1);
 }
 
+/*
+ * Return whether too few predictively prefetched buffers are being used
+ * before the ARC evicts them.  Accuracy is the share of used buffers among
+ * those the ARC saw used or evicted unused over the last second, recomputed
+ * by whichever caller first notices that the second has changed.  It is
+ * left alone across quiet seconds, so an idle period doesn't reset it.
+ */
+static boolean_t
+dmu_zfetch_inaccurate(void)
+{
+	if (zfetch_min_accuracy == 0)
+		return (B_FALSE);
+
+	uint32_t now = gethrestime_sec();
+	uint32_t then = zfetch_accuracy_time;
+	if (now != then &&
+	    atomic_cas_32(&zfetch_accuracy_time, then, now) == then) {
+		uint64_t used = wmsum_value(
+		    &arc_sums.arcstat_demand_hit_predictive_prefetch) +
+		    wmsum_value(
+		    &arc_sums.arcstat_demand_iohit_predictive_prefetch);
+		uint64_t unused = wmsum_value(
+		    &arc_sums.arcstat_evict_unused_predictive_prefetch);
+		uint64_t d_used = used - zfetch_accuracy_used;
+		uint64_t d_unused = unused - zfetch_accuracy_unused;
+
+		zfetch_accuracy_used = used;
+		zfetch_accuracy_unused = unused;
+		if (d_used + d_unused >= 64) {
+			zfetch_accuracy =
+			    d_used * 100 / (d_used + d_unused);
+		}
+	}
+
+	return (zfetch_accuracy < zfetch_min_accuracy);
+}
+
 /*
  * Process stream hit access for nblks blocks starting at zs_blkid.  Return
  * number of blocks to proceed for after aggregation with future ranges.
@@ -664,19 +722,27 @@ out:
 	 * Don't double the distance beyond single block if we have more
 	 * than ~6% of ARC held by active prefetches.  It should help with
 	 * getting out of RAM on some badly mispredicted read patterns.
+	 *
+	 * If the ARC is evicting too much predictively prefetched data
+	 * before anyone reads it (see zfetch_min_accuracy), halve the
+	 * distance instead, down to the demand access size.
 	 */
 	unsigned int nbytes = nblks << dbs;
 	unsigned int pf_nblks;
 	if (fetch_data) {
-		if (unlikely(zs->zs_pf_dist < nbytes))
+		if (unlikely(zs->zs_pf_dist < nbytes)) {
 			zs->zs_pf_dist = nbytes;
-		else if (zs->zs_pf_dist < zfetch_min_distance &&
+		} else if (dmu_zfetch_inaccurate()) {
+			zs->zs_pf_dist = MAX(zs->zs_pf_dist / 2, nbytes);
+			ZFETCHSTAT_BUMP(zfetchstat_throttled);
+		} else if (zs->zs_pf_dist < zfetch_min_distance &&
 		    (zs->zs_pf_dist < (1 << dbs) ||
 		    aggsum_compare(&zfetch_sums.zfetchstat_io_active,
-		    arc_c_max >> (4 + dbs)) < 0))
+		    arc_c_max >> (4 + dbs)) < 0)) {
 			zs->zs_pf_dist *= 2;
-		else if (zs->zs_more)
+		} else if (zs->zs_more) {
 			zs->zs_pf_dist += zs->zs_pf_dist / 8;
+		}
 		zs->zs_more = B_FALSE;
 		if (zs->zs_pf_dist > zfetch_max_distance)
 			zs->zs_pf_dist = zfetch_max_distance;
@@ -848,3 +914,6 @@ ZFS_MODULE_PARAM(zfs_prefetch, zfetch_, max_reorder, UINT, ZMOD_RW,
 
 ZFS_MODULE_PARAM(zfs_prefetch, zfetch_, hole_shift, UINT, ZMOD_RW,
 	"Max log2 fraction of holes in a stream");
+
+ZFS_MODULE_PARAM(zfs_prefetch, zfetch_, min_accuracy, UINT, ZMOD_RW,
+	"Min percent of prefetched data used before eviction");
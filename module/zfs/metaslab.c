@@ -319,6 +319,14 @@ static const uint32_t metaslab_by_size_min_shift = 14;
  */
 static int zfs_metaslab_try_hard_before_gang = B_FALSE;
 
+/*
+ * When non-zero, each allocator carves ranges of up to this many bytes out
+ * of its primary metaslab and serves allocations of up to 1/8 of this size
+ * from them by advancing an offset, without taking the mg_lock or ms_lock.
+ * Space left in the ranges is returned when the txg syncs.
+ */
+static uint64_t metaslab_reserve_size = 0;
+
 /*
  * When not trying hard, we only consider the best zfs_metaslab_find_max_tries
  * metaslabs.  This improves performance, especially when there are many
@@ -1125,6 +1133,8 @@ metaslab_group_destroy(metaslab_group_t *mg)
 	for (int i = 0; i < spa->spa_alloc_count; i++) {
 		metaslab_group_allocator_t *mga = &mg->mg_allocator[i];
 		zfs_refcount_destroy(&mga->mga_queue_depth);
+		for (int t = 0; t < TXG_SIZE; t++)
+			ASSERT0P(mga->mga_reserve[t]);
 	}
 	kmem_free(mg, offsetof(metaslab_group_t,
 	    mg_allocator[spa->spa_alloc_count]));
@@ -4917,6 +4927,119 @@ metaslab_block_alloc(metaslab_t *msp, uint64_t size, uint64_t max_size,
 	return (start);
 }
 
+/*
+ * Allocate from the range most recently reserved by this allocator in the
+ * given txg.  Only ranges reserved in the same txg are ever seen here:
+ * mga_reserve[] for a txg is emptied by metaslab_group_reserve_sync()
+ * before anything can allocate in the next txg that maps to its slot.
+ */
+static uint64_t
+metaslab_reserve_alloc(metaslab_group_allocator_t *mga, uint64_t size,
+    uint64_t txg, metaslab_t **mspp)
+{
+	metaslab_reserve_t *mr = mga->mga_reserve[txg & TXG_MASK];
+
+	if (mr == NULL)
+		return (-1ULL);
+	ASSERT3U(mr->mr_txg, ==, txg);
+
+	uint64_t offset = mr->mr_offset;
+	while (offset + size <= mr->mr_end) {
+		uint64_t old = atomic_cas_64(&mr->mr_offset, offset,
+		    offset + size);
+		if (old == offset) {
+			*mspp = mr->mr_msp;
+			return (offset);
+		}
+		offset = old;
+	}
+	return (-1ULL);
+}
+
+/*
+ * Make [offset, end), which metaslab_block_alloc() has just moved to
+ * ms_allocating, this allocator's current reserve for the txg.
+ */
+static void
+metaslab_reserve_add(metaslab_group_t *mg, metaslab_group_allocator_t *mga,
+    metaslab_t *msp, uint64_t offset, uint64_t end, uint64_t txg)
+{
+	metaslab_reserve_t *mr = kmem_alloc(sizeof (*mr), KM_SLEEP);
+
+	ASSERT(MUTEX_HELD(&msp->ms_lock));
+	ASSERT3U(offset, <, end);
+
+	mr->mr_msp = msp;
+	mr->mr_txg = txg;
+	mr->mr_offset = offset;
+	mr->mr_end = end;
+
+	mutex_enter(&mg->mg_lock);
+	mr->mr_next = mga->mga_reserve[txg & TXG_MASK];
+	membar_producer();	/* complete *mr before publishing it */
+	mga->mga_reserve[txg & TXG_MASK] = mr;
+	mutex_exit(&mg->mg_lock);
+}
+
+/*
+ * Give the unused part of each range reserved in this txg back to its
+ * metaslab, before the metaslabs sync.  Later sync passes do allocate in
+ * the syncing txg, for the MOS, and may carve new ranges.  Carving a range
+ * dirties the vdev, so vdev_sync() runs for it again in that pass, after
+ * the pass's writes have been allocated, and calls this again.  The slot
+ * is therefore empty by the time the txg has finished syncing.
+ *
+ * metaslab_block_alloc() cleared the whole range from ms_trim when it was
+ * carved.  With autotrim on, the unused part goes back into ms_trim as
+ * well, so that autotrim doesn't lose it; any of it that had already been
+ * trimmed is merely trimmed again.
+ */
+void
+metaslab_group_reserve_sync(metaslab_group_t *mg, uint64_t txg)
+{
+	spa_t *spa = mg->mg_class->mc_spa;
+
+	for (int i = 0; i < spa->spa_alloc_count; i++) {
+		metaslab_group_allocator_t *mga = &mg->mg_allocator[i];
+		metaslab_reserve_t *mr, *next;
+
+		if (mga->mga_reserve[txg & TXG_MASK] == NULL)
+			continue;
+
+		mutex_enter(&mg->mg_lock);
+		mr = mga->mga_reserve[txg & TXG_MASK];
+		mga->mga_reserve[txg & TXG_MASK] = NULL;
+		mutex_exit(&mg->mg_lock);
+
+		for (; mr != NULL; mr = next) {
+			metaslab_t *msp = mr->mr_msp;
+			uint64_t size = mr->mr_end - mr->mr_offset;
+
+			ASSERT3U(mr->mr_txg, ==, txg);
+			next = mr->mr_next;
+			if (size != 0) {
+				mutex_enter(&msp->ms_lock);
+				zfs_range_tree_remove(
+				    msp->ms_allocating[txg & TXG_MASK],
+				    mr->mr_offset, size);
+				msp->ms_allocating_total -= size;
+				if (msp->ms_loaded) {
+					zfs_range_tree_add(msp->ms_allocatable,
+					    mr->mr_offset, size);
+					msp->ms_max_size =
+					    metaslab_largest_allocatable(msp);
+				}
+				if (spa_get_autotrim(spa) == SPA_AUTOTRIM_ON) {
+					zfs_range_tree_add(msp->ms_trim,
+					    mr->mr_offset, size);
+				}
+				mutex_exit(&msp->ms_lock);
+			}
+			kmem_free(mr, sizeof (*mr));
+		}
+	}
+}
+
 /*
  * Find the metaslab with the highest weight that is less than what we've
  * already tried.  In the common case, this means that we will examine each
@@ -5058,6 +5181,26 @@ metaslab_group_alloc(metaslab_group_t *mg, zio_alloc_list_t *zal,
 
 	ASSERT3U(mg->mg_vd->vdev_ms_count, >=, 2);
 
+	/*
+	 * Small fixed-size allocations for a primary DVA may be served from
+	 * a range reserved earlier in this txg.  dRAID is excluded because
+	 * its allocations must stay aligned to its redundancy groups.
+	 */
+	uint64_t reserve_size = P2ALIGN_TYPED(metaslab_reserve_size,
+	    1ULL << mg->mg_vd->vdev_ashift, uint64_t);
+	boolean_t reserve = (activation_weight == METASLAB_WEIGHT_PRIMARY &&
+	    !try_hard && max_asize == asize && asize <= reserve_size / 8 &&
+	    mg->mg_vd->vdev_ops != &vdev_draid_ops);
+	if (reserve) {
+		offset = metaslab_reserve_alloc(mga, asize, txg, &msp);
+		if (offset != -1ULL) {
+			metaslab_trace_add(zal, mg, msp, asize, d, offset,
+			    allocator);
+			*actual_asize = asize;
+			return (offset);
+		}
+	}
+
 	metaslab_t *search = kmem_alloc(sizeof (*search), KM_SLEEP);
 	search->ms_weight = UINT64_MAX;
 	search->ms_start = 0;
@@ -5247,8 +5390,17 @@ metaslab_group_alloc(metaslab_group_t *mg, zio_alloc_list_t *zal,
 			continue;
 		}
 
-		offset = metaslab_block_alloc(msp, asize, max_asize, txg,
-		    actual_asize);
+		offset = metaslab_block_alloc(msp, asize,
+		    reserve ? reserve_size : max_asize, txg, actual_asize);
+
+		if (offset != -1ULL && reserve) {
+			if (*actual_asize > asize) {
+				metaslab_reserve_add(mg, mga, msp,
+				    offset + asize, offset + *actual_asize,
+				    txg);
+			}
+			*actual_asize = asize;
+		}
 
 		if (offset != -1ULL) {
 			metaslab_trace_add(zal, mg, msp, *actual_asize, d,
@@ -6472,6 +6624,9 @@ ZFS_MODULE_PARAM(zfs_metaslab, zfs_metaslab_, mem_limit, UINT, ZMOD_RW,
 ZFS_MODULE_PARAM(zfs_metaslab, zfs_metaslab_, try_hard_before_gang, INT,
 	ZMOD_RW, "Try hard to allocate before ganging");
 
+ZFS_MODULE_PARAM(zfs_metaslab, metaslab_, reserve_size, U64, ZMOD_RW,
+	"Size of the ranges each allocator reserves for small allocations");
+
 ZFS_MODULE_PARAM(zfs_metaslab, zfs_metaslab_, find_max_tries, UINT, ZMOD_RW,
 	"Normally only consider this many of the best metaslabs in each vdev");
 
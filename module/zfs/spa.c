@@ -1288,6 +1288,8 @@ spa_taskqs_init(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
 	case ZTI_MODE_NULL:
 		tqs->stqs_count = 0;
 		tqs->stqs_taskq = NULL;
+		tqs->stqs_nbatch = 0;
+		tqs->stqs_batch = NULL;
 		return;
 
 	default:
@@ -1335,6 +1337,24 @@ spa_taskqs_init(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
 
 		tqs->stqs_taskq[i] = tq;
 	}
+
+	/*
+	 * One batch per CPU for the interrupt taskqs, spread over their
+	 * taskqs, so that completions on different CPUs do not share one.
+	 */
+	tqs->stqs_nbatch = 0;
+	tqs->stqs_batch = NULL;
+	if (q == ZIO_TASKQ_INTERRUPT || q == ZIO_TASKQ_INTERRUPT_HIGH) {
+		tqs->stqs_nbatch = boot_ncpus;
+		tqs->stqs_batch = kmem_zalloc(tqs->stqs_nbatch *
+		    sizeof (spa_taskq_batch_t), KM_SLEEP);
+		for (uint_t i = 0; i < tqs->stqs_nbatch; i++) {
+			spa_taskq_batch_t *stb = &tqs->stqs_batch[i];
+			stb->stb_taskq = tqs->stqs_taskq[i % count];
+			stb->stb_tqs = tqs;
+			taskq_init_ent(&stb->stb_tqent);
+		}
+	}
 }
 
 static void
@@ -1354,6 +1374,17 @@ spa_taskqs_fini(spa_t *spa, zio_type_t t, zio_taskq_type_t q)
 
 	kmem_free(tqs->stqs_taskq, tqs->stqs_count * sizeof (taskq_t *));
 	tqs->stqs_taskq = NULL;
+
+	if (tqs->stqs_batch != NULL) {
+		for (uint_t i = 0; i < tqs->stqs_nbatch; i++) {
+			ASSERT0P(tqs->stqs_batch[i].stb_head);
+			ASSERT0(tqs->stqs_batch[i].stb_scheduled);
+		}
+		kmem_free(tqs->stqs_batch, tqs->stqs_nbatch *
+		    sizeof (spa_taskq_batch_t));
+		tqs->stqs_batch = NULL;
+		tqs->stqs_nbatch = 0;
+	}
 }
 
 #ifdef _KERNEL
@@ -19,7 +19,9 @@
 #include <sys/spa_impl.h>
 #include <sys/vdev_impl.h>
 #include <sys/spa.h>
+#include <sys/zio_impl.h>
 #include <zfs_comutil.h>
+#include <zfs_valstr.h>
 
 /*
  * Keeps stats on last N reads per spa_t, disabled by default.
@@ -544,6 +546,180 @@ spa_tx_assign_add_nsecs(spa_t *spa, uint64_t nsecs)
 	atomic_inc_64(&((kstat_named_t *)shk->priv)[idx].value.ui64);
 }
 
+/*
+ * ==========================================================================
+ * SPA ZIO Stage Histogram Routines
+ * ==========================================================================
+ */
+
+/*
+ * Zio stage statistics - time spent in each zio pipeline stage, per zio
+ * type, collected when zio_stage_latency is set.  The time charged to a
+ * stage runs from its start to the start of the next stage, so it covers
+ * any taskq, throttle, queue or device wait the stage leads into.  Each
+ * histogram has power of two buckets for 1ns to 2,199s.
+ */
+#define	SPA_ZIO_STAGE_BUCKETS	42
+
+typedef struct spa_zio_stage_hist {
+	uint64_t	zsh_count;
+	uint64_t	zsh_nsecs;
+	uint64_t	zsh_buckets[SPA_ZIO_STAGE_BUCKETS];
+	zio_type_t	zsh_type;
+	int		zsh_stage;
+} spa_zio_stage_hist_t;
+
+static int
+spa_zio_stages_headers(char *buf, size_t size)
+{
+	(void) snprintf(buf, size, "%-6s %-20s %12s %16s %s\n", "type",
+	    "stage", "count", "total_ns", "log2(ns):count ...");
+
+	return (0);
+}
+
+/*
+ * Only stages that have been timed are shown, and of their histograms
+ * only the non-empty buckets.
+ */
+static int
+spa_zio_stages_data(char *buf, size_t size, void *data)
+{
+	spa_zio_stage_hist_t *zsh = (spa_zio_stage_hist_t *)data;
+	char type[16], stage[32];
+	size_t n;
+
+	buf[0] = '\0';
+	if (zsh->zsh_count == 0)
+		return (0);
+
+	(void) zfs_valstr_zio_type(zsh->zsh_type, type, sizeof (type));
+	(void) zfs_valstr_zio_stage(1ULL << zsh->zsh_stage, stage,
+	    sizeof (stage));
+	n = snprintf(buf, size, "%-6s %-20s %12llu %16llu", type, stage,
+	    (u_longlong_t)zsh->zsh_count, (u_longlong_t)zsh->zsh_nsecs);
+
+	for (int i = 0; i < SPA_ZIO_STAGE_BUCKETS && n < size; i++) {
+		if (zsh->zsh_buckets[i] == 0)
+			continue;
+		n += snprintf(buf + n, size - n, " %d:%llu", i,
+		    (u_longlong_t)zsh->zsh_buckets[i]);
+	}
+	if (n < size)
+		(void) snprintf(buf + n, size - n, "\n");
+
+	return (0);
+}
+
+static void *
+spa_zio_stages_addr(kstat_t *ksp, loff_t n)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_history_kstat_t *shk = &spa->spa_stats.zio_stages;
+
+	if (n < shk->count)
+		return (&((spa_zio_stage_hist_t *)shk->priv)[n]);
+	return (NULL);
+}
+
+/*
+ * When the kstat is written zero all counters.
+ */
+static int
+spa_zio_stages_update(kstat_t *ksp, int rw)
+{
+	spa_t *spa = ksp->ks_private;
+	spa_history_kstat_t *shk = &spa->spa_stats.zio_stages;
+
+	if (rw == KSTAT_WRITE) {
+		for (int i = 0; i < shk->count; i++) {
+			spa_zio_stage_hist_t *zsh =
+			    &((spa_zio_stage_hist_t *)shk->priv)[i];
+			zsh->zsh_count = 0;
+			zsh->zsh_nsecs = 0;
+			memset(zsh->zsh_buckets, 0, sizeof (zsh->zsh_buckets));
+		}
+	}
+
+	return (0);
+}
+
+static void
+spa_zio_stages_init(spa_t *spa)
+{
+	spa_history_kstat_t *shk = &spa->spa_stats.zio_stages;
+	spa_zio_stage_hist_t *zsh;
+	char *name;
+	kstat_t *ksp;
+
+	mutex_init(&shk->lock, NULL, MUTEX_DEFAULT, NULL);
+
+	shk->count = ZIO_TYPES * ZIO_STAGES;
+	shk->size = shk->count * sizeof (spa_zio_stage_hist_t);
+	shk->priv = vmem_zalloc(shk->size, KM_SLEEP);
+
+	for (int i = 0; i < shk->count; i++) {
+		zsh = &((spa_zio_stage_hist_t *)shk->priv)[i];
+		zsh->zsh_type = i / ZIO_STAGES;
+		zsh->zsh_stage = i % ZIO_STAGES;
+	}
+
+	name = kmem_asprintf("zfs/%s", spa_name(spa));
+
+	ksp = kstat_create(name, 0, "zio_stages", "misc",
+	    KSTAT_TYPE_RAW, 0, KSTAT_FLAG_VIRTUAL);
+	shk->kstat = ksp;
+
+	if (ksp) {
+		ksp->ks_lock = &shk->lock;
+		ksp->ks_data = NULL;
+		ksp->ks_ndata = shk->count;
+		ksp->ks_private = spa;
+		ksp->ks_update = spa_zio_stages_update;
+		kstat_set_raw_ops(ksp, spa_zio_stages_headers,
+		    spa_zio_stages_data, spa_zio_stages_addr);
+		kstat_install(ksp);
+	}
+	kmem_strfree(name);
+}
+
+static void
+spa_zio_stages_destroy(spa_t *spa)
+{
+	spa_history_kstat_t *shk = &spa->spa_stats.zio_stages;
+	kstat_t *ksp;
+
+	ksp = shk->kstat;
+	if (ksp)
+		kstat_delete(ksp);
+
+	vmem_free(shk->priv, shk->size);
+	mutex_destroy(&shk->lock);
+}
+
+void
+spa_zio_stage_add_nsecs(spa_t *spa, zio_type_t type, uint64_t stage,
+    uint64_t nsecs)
+{
+	spa_history_kstat_t *shk = &spa->spa_stats.zio_stages;
+	spa_zio_stage_hist_t *zsh;
+	uint64_t idx = 0;
+
+	ASSERT3U(type, <, ZIO_TYPES);
+	ASSERT(ISP2(stage));
+	ASSERT3U(stage, <=, ZIO_STAGE_DONE);
+
+	zsh = &((spa_zio_stage_hist_t *)shk->priv)[type * ZIO_STAGES +
+	    highbit64(stage) - 1];
+
+	if (nsecs > 1)
+		idx = MIN(highbit64(nsecs - 1), SPA_ZIO_STAGE_BUCKETS - 1);
+
+	atomic_inc_64(&zsh->zsh_count);
+	atomic_add_64(&zsh->zsh_nsecs, nsecs);
+	atomic_inc_64(&zsh->zsh_buckets[idx]);
+}
+
 /*
  * ==========================================================================
  * SPA MMP History Routines
@@ -1123,11 +1299,13 @@ spa_stats_init(spa_t *spa)
 	spa_guid_init(spa);
 	spa_iostats_init(spa);
 	spa_log_sm_stats_init(spa);
+	spa_zio_stages_init(spa);
 }
 
 void
 spa_stats_destroy(spa_t *spa)
 {
+	spa_zio_stages_destroy(spa);
 	spa_log_sm_stats_destroy(spa);
 	spa_iostats_destroy(spa);
 	spa_health_destroy(spa);
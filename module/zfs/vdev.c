@@ -4317,6 +4317,11 @@ vdev_sync(vdev_t *vd, uint64_t txg)
 		vdev_config_dirty(vd);
 	}
 
+	if (vd->vdev_mg != NULL)
+		metaslab_group_reserve_sync(vd->vdev_mg, txg);
+	if (vd->vdev_log_mg != NULL)
+		metaslab_group_reserve_sync(vd->vdev_log_mg, txg);
+
 	while ((msp = txg_list_remove(&vd->vdev_ms_list, txg)) != NULL) {
 		metaslab_sync(msp, txg);
 		(void) txg_list_add(&vd->vdev_ms_list, msp, TXG_CLEAN(txg));
@@ -695,11 +695,14 @@ zfs_secpolicy_setprop(const char *dsname, zfs_prop_t prop, nvpair_t *propval,
 
 	/*
 	 * Check zoned_uid delegation first.  However, even delegated
-	 * namespace users must not be allowed to modify zoned_uid itself.
+	 * namespace users must not be allowed to modify zoned_uid itself,
+	 * nor the ARC share that the host has granted them.
 	 */
 	zone_result = zone_dataset_admin_check(dsname, ZONE_OP_SETPROP, NULL);
 	if (zone_result == ZONE_ADMIN_ALLOWED) {
-		if (prop == ZFS_PROP_ZONED_UID)
+		if (prop == ZFS_PROP_ZONED_UID ||
+		    prop == ZFS_PROP_ARCQUOTA ||
+		    prop == ZFS_PROP_ARCRESERVATION)
 			return (SET_ERROR(EPERM));
 		if (prop == ZFS_PROP_FILESYSTEM_LIMIT ||
 		    prop == ZFS_PROP_SNAPSHOT_LIMIT) {
@@ -739,6 +742,15 @@ zfs_secpolicy_setprop(const char *dsname, zfs_prop_t prop, nvpair_t *propval,
 		if (!INGLOBALZONE(curproc))
 			return (SET_ERROR(EPERM));
 		break;
+	case ZFS_PROP_ARCQUOTA:
+	case ZFS_PROP_ARCRESERVATION:
+		/*
+		 * ARC limits are shared between all datasets on the host,
+		 * so only the global zone may hand them out.
+		 */
+		if (!INGLOBALZONE(curproc))
+			return (SET_ERROR(EPERM));
+		break;
 
 	case ZFS_PROP_QUOTA:
 	case ZFS_PROP_FILESYSTEM_LIMIT:
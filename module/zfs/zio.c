@@ -130,6 +130,21 @@ static uint_t zfs_sync_pass_rewrite = 2;
 int zio_exclude_metadata = 0;
 static int zio_requeue_io_start_cut_in_line = 1;
 
+/*
+ * Run zios handed to the interrupt taskqs in per-CPU batches, so that one
+ * taskq dispatch and wakeup serves every zio that completed meanwhile.
+ * At most zio_interrupt_batch_max zios of a batch run one after another;
+ * the rest are dispatched individually.
+ */
+int zio_interrupt_batch = 0;
+uint_t zio_interrupt_batch_max = 16;
+
+/*
+ * Record how long zios spend in each pipeline stage in the per-pool
+ * zio_stages kstat.
+ */
+static int zio_stage_latency = 0;
+
 #ifdef ZFS_DEBUG
 static const int zio_buf_debug_limit = 16384;
 #else
@@ -141,6 +156,10 @@ typedef struct zio_stats {
 	kstat_named_t ziostat_alloc_class_fallbacks;
 	kstat_named_t ziostat_gang_writes;
 	kstat_named_t ziostat_gang_multilevel;
+	kstat_named_t ziostat_interrupt_batches;
+	kstat_named_t ziostat_interrupt_batch_zios;
+	kstat_named_t ziostat_interrupt_batch_max;
+	kstat_named_t ziostat_interrupt_batch_spills;
 } zio_stats_t;
 
 static zio_stats_t zio_stats = {
@@ -148,6 +167,10 @@ static zio_stats_t zio_stats = {
 	{ "alloc_class_fallbacks",	KSTAT_DATA_UINT64 },
 	{ "gang_writes",	KSTAT_DATA_UINT64 },
 	{ "gang_multilevel",	KSTAT_DATA_UINT64 },
+	{ "interrupt_batches",	KSTAT_DATA_UINT64 },
+	{ "interrupt_batch_zios",	KSTAT_DATA_UINT64 },
+	{ "interrupt_batch_max",	KSTAT_DATA_UINT64 },
+	{ "interrupt_batch_spills",	KSTAT_DATA_UINT64 },
 };
 
 struct {
@@ -155,6 +178,9 @@ struct {
 	wmsum_t ziostat_alloc_class_fallbacks;
 	wmsum_t ziostat_gang_writes;
 	wmsum_t ziostat_gang_multilevel;
+	wmsum_t ziostat_interrupt_batches;
+	wmsum_t ziostat_interrupt_batch_zios;
+	wmsum_t ziostat_interrupt_batch_spills;
 } ziostat_sums;
 
 #define	ZIOSTAT_BUMP(stat)	wmsum_add(&ziostat_sums.stat, 1);
@@ -180,6 +206,12 @@ zio_kstats_update(kstat_t *ksp, int rw)
 	    wmsum_value(&ziostat_sums.ziostat_gang_writes);
 	zs->ziostat_gang_multilevel.value.ui64 =
 	    wmsum_value(&ziostat_sums.ziostat_gang_multilevel);
+	zs->ziostat_interrupt_batches.value.ui64 =
+	    wmsum_value(&ziostat_sums.ziostat_interrupt_batches);
+	zs->ziostat_interrupt_batch_zios.value.ui64 =
+	    wmsum_value(&ziostat_sums.ziostat_interrupt_batch_zios);
+	zs->ziostat_interrupt_batch_spills.value.ui64 =
+	    wmsum_value(&ziostat_sums.ziostat_interrupt_batch_spills);
 	return (0);
 }
 
@@ -197,6 +229,9 @@ zio_init(void)
 	wmsum_init(&ziostat_sums.ziostat_alloc_class_fallbacks, 0);
 	wmsum_init(&ziostat_sums.ziostat_gang_writes, 0);
 	wmsum_init(&ziostat_sums.ziostat_gang_multilevel, 0);
+	wmsum_init(&ziostat_sums.ziostat_interrupt_batches, 0);
+	wmsum_init(&ziostat_sums.ziostat_interrupt_batch_zios, 0);
+	wmsum_init(&ziostat_sums.ziostat_interrupt_batch_spills, 0);
 	zio_ksp = kstat_create("zfs", 0, "zio_stats",
 	    "misc", KSTAT_TYPE_NAMED, sizeof (zio_stats) /
 	    sizeof (kstat_named_t), KSTAT_FLAG_VIRTUAL);
@@ -342,6 +377,9 @@ zio_fini(void)
 	wmsum_fini(&ziostat_sums.ziostat_alloc_class_fallbacks);
 	wmsum_fini(&ziostat_sums.ziostat_gang_writes);
 	wmsum_fini(&ziostat_sums.ziostat_gang_multilevel);
+	wmsum_fini(&ziostat_sums.ziostat_interrupt_batches);
+	wmsum_fini(&ziostat_sums.ziostat_interrupt_batch_zios);
+	wmsum_fini(&ziostat_sums.ziostat_interrupt_batch_spills);
 
 	kmem_cache_destroy(zio_link_cache);
 	kmem_cache_destroy(zio_cache);
@@ -752,7 +790,12 @@ zio_add_child_impl(zio_t *pio, zio_t *cio, boolean_t first)
 	    (cio->io_child_type != ZIO_CHILD_VDEV),
 	    (pio->io_pipeline & ZIO_STAGE_READY) == 0);
 
-	zio_link_t *zl = kmem_cache_alloc(zio_link_cache, KM_SLEEP);
+	/*
+	 * Nearly every zio gets exactly one parent, the one it is created
+	 * with, so that link is embedded in the child rather than allocated.
+	 */
+	zio_link_t *zl = first ? &cio->io_parent_link :
+	    kmem_cache_alloc(zio_link_cache, KM_SLEEP);
 	zl->zl_parent = pio;
 	zl->zl_child = cio;
 
@@ -804,7 +847,8 @@ zio_remove_child(zio_t *pio, zio_t *cio, zio_link_t *zl)
 
 	mutex_exit(&cio->io_lock);
 	mutex_exit(&pio->io_lock);
-	kmem_cache_free(zio_link_cache, zl);
+	if (zl != &cio->io_parent_link)
+		kmem_cache_free(zio_link_cache, zl);
 }
 
 static boolean_t
@@ -2150,6 +2194,111 @@ zio_free_bp_init(zio_t *zio)
  * ==========================================================================
  */
 
+/*
+ * Run the zios pushed onto a batch, oldest first.  At most
+ * zio_interrupt_batch_max of them run here, one after another.  Any others
+ * taken off the batch are dispatched individually first, so that a zio
+ * that blocks holds up no more than that many, and a burst of completions
+ * that need checksumming or decompression still spreads over the taskq
+ * threads.  Zios pushed meanwhile are left to a new dispatch of the batch.
+ */
+static void
+zio_taskq_batch_run(void *arg)
+{
+	spa_taskq_batch_t *stb = arg;
+	spa_taskqs_t *tqs = stb->stb_tqs;
+	uint64_t *maxp = &zio_stats.ziostat_interrupt_batch_max.value.ui64;
+	uint_t limit = MAX(zio_interrupt_batch_max, 1);
+	zio_t *zio, *next, *list = NULL;
+	uint64_t n = 0, spills = 0, m;
+
+	ASSERT3U(stb->stb_scheduled, ==, 1);
+
+	/* The batch is pushed newest first; restore arrival order. */
+	for (zio = atomic_swap_ptr(&stb->stb_head, NULL); zio != NULL;
+	    zio = next) {
+		next = zio->io_batch_next;
+		zio->io_batch_next = list;
+		list = zio;
+		n++;
+	}
+
+	if (n > limit) {
+		zio = list;
+		for (uint_t i = 1; i < limit; i++)
+			zio = zio->io_batch_next;
+		next = zio->io_batch_next;
+		zio->io_batch_next = NULL;
+		for (zio = next; zio != NULL; zio = next) {
+			next = zio->io_batch_next;
+			zio->io_batch_next = NULL;
+			taskq_dispatch_ent(tqs->stqs_taskq[
+			    ((uint64_t)gethrtime()) % tqs->stqs_count],
+			    zio_execute, zio, 0, &zio->io_tqent);
+		}
+		spills = n - limit;
+		n = limit;
+	}
+
+	for (zio = list; zio != NULL; zio = next) {
+		next = zio->io_batch_next;
+		zio->io_batch_next = NULL;
+		zio_execute(zio);
+	}
+
+	if (n != 0) {
+		wmsum_add(&ziostat_sums.ziostat_interrupt_batches, 1);
+		wmsum_add(&ziostat_sums.ziostat_interrupt_batch_zios, n);
+		wmsum_add(&ziostat_sums.ziostat_interrupt_batch_spills,
+		    spills);
+		while (n > (m = *maxp) && m != atomic_cas_64(maxp, m, n))
+			continue;
+	}
+
+	/*
+	 * Whoever clears stb_scheduled and then still finds zios on the
+	 * batch must either dispatch it again or leave that to a concurrent
+	 * pusher.
+	 */
+	stb->stb_scheduled = 0;
+	membar_sync();
+	if (stb->stb_head != NULL &&
+	    atomic_cas_32(&stb->stb_scheduled, 0, 1) == 0) {
+		taskq_dispatch_ent(stb->stb_taskq, zio_taskq_batch_run, stb, 0,
+		    &stb->stb_tqent);
+	}
+}
+
+/*
+ * Push a zio onto this CPU's batch for an interrupt taskq, and dispatch
+ * the batch unless it is already pending or running.  This takes no lock,
+ * so it is safe from the interrupt context zio_interrupt() is called in.
+ */
+static boolean_t
+zio_taskq_batch_dispatch(zio_t *zio, spa_taskqs_t *tqs)
+{
+	spa_taskq_batch_t *stb;
+	zio_t *head;
+
+	if (tqs->stqs_batch == NULL)
+		return (B_FALSE);
+
+	ASSERT(taskq_empty_ent(&zio->io_tqent));
+	ASSERT0P(zio->io_batch_next);
+
+	stb = &tqs->stqs_batch[CPU_SEQID_UNSTABLE % tqs->stqs_nbatch];
+	do {
+		head = stb->stb_head;
+		zio->io_batch_next = head;
+	} while (atomic_cas_ptr(&stb->stb_head, head, zio) != head);
+
+	if (atomic_cas_32(&stb->stb_scheduled, 0, 1) == 0) {
+		taskq_dispatch_ent(stb->stb_taskq, zio_taskq_batch_run, stb, 0,
+		    &stb->stb_tqent);
+	}
+	return (B_TRUE);
+}
+
 static void
 zio_taskq_dispatch(zio_t *zio, zio_taskq_type_t q, boolean_t cutinline)
 {
@@ -2183,6 +2332,10 @@ zio_taskq_dispatch(zio_t *zio, zio_taskq_type_t q, boolean_t cutinline)
 
 	ASSERT3U(q, <, ZIO_TASKQ_TYPES);
 
+	if (zio_interrupt_batch && !cutinline &&
+	    zio_taskq_batch_dispatch(zio, &spa->spa_zio_taskq[t][q]))
+		return;
+
 	spa_taskq_dispatch(spa, t, q, zio_execute, zio, cutinline);
 }
 
@@ -2473,6 +2626,32 @@ __zio_execute(zio_t *zio)
 			return;
 		}
 
+		/*
+		 * Charge the time since the last timed stage started to that
+		 * stage.  zio_done() may free the zio, so the done stage is
+		 * instead timed across the call below.
+		 */
+		hrtime_t done_ts = 0;
+		spa_t *spa = zio->io_spa;
+		zio_type_t type = zio->io_type;
+		if (zio_stage_latency) {
+			hrtime_t now = gethrtime();
+			if (zio->io_stage_ts != 0) {
+				spa_zio_stage_add_nsecs(spa, type,
+				    zio->io_stage_timed,
+				    now - zio->io_stage_ts);
+			}
+			if (stage == ZIO_STAGE_DONE) {
+				done_ts = now;
+				zio->io_stage_ts = 0;
+			} else {
+				zio->io_stage_timed = stage;
+				zio->io_stage_ts = now;
+			}
+		} else {
+			zio->io_stage_ts = 0;
+		}
+
 		zio->io_stage = stage;
 		zio->io_pipeline_trace |= zio->io_stage;
 
@@ -2483,6 +2662,11 @@ __zio_execute(zio_t *zio)
 		 */
 		zio = zio_pipeline[highbit64(stage) - 1](zio);
 
+		if (done_ts != 0) {
+			spa_zio_stage_add_nsecs(spa, type, ZIO_STAGE_DONE,
+			    gethrtime() - done_ts);
+		}
+
 		if (zio == NULL)
 			return;
 	}
@@ -2601,6 +2785,7 @@ zio_reexecute(void *arg)
 	pio->io_post = 0;
 	pio->io_flags |= ZIO_FLAG_REEXECUTED;
 	pio->io_pipeline_trace = 0;
+	pio->io_stage_ts = 0;
 	pio->io_error = 0;
 	pio->io_state[ZIO_WAIT_READY] = (pio->io_stage >= ZIO_STAGE_READY) ||
 	    (pio->io_pipeline & ZIO_STAGE_READY) == 0;
@@ -6217,6 +6402,15 @@ EXPORT_SYMBOL(zio_data_buf_free);
 ZFS_MODULE_PARAM(zfs_zio, zio_, slow_io_ms, INT, ZMOD_RW,
 	"Max I/O completion time (milliseconds) before marking it as slow");
 
+ZFS_MODULE_PARAM(zfs_zio, zio_, interrupt_batch, INT, ZMOD_RW,
+	"Run zios on the interrupt taskqs in per-CPU batches");
+
+ZFS_MODULE_PARAM(zfs_zio, zio_, interrupt_batch_max, UINT, ZMOD_RW,
+	"Max zios of a batch to run one after another on one taskq thread");
+
+ZFS_MODULE_PARAM(zfs_zio, zio_, stage_latency, INT, ZMOD_RW,
+	"Record per-stage zio latency histograms in the zio_stages kstat");
+
 ZFS_MODULE_PARAM(zfs_zio, zio_, requeue_io_start_cut_in_line, INT, ZMOD_RW,
 	"Prioritize requeued I/O");
 
@@ -0,0 +1,212 @@
+// SPDX-License-Identifier: CDDL-1.0
+/*
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * https://opensource.org/license/CDDL-1.0.
+ */
+
+/*
+ * Microbenchmark for the ARC buf_hash_table lock layout.
+ *
+ * Each thread repeatedly picks a random hash chain, takes the lock that
+ * covers it, reads the chain head and drops the lock, the way
+ * buf_hash_find() does.  This is run against three lock layouts:
+ *
+ *   packed  the old layout, BUF_LOCKS_MIN mutexes packed into one array
+ *   padded  BUF_LOCKS_MIN mutexes, each on its own cache line
+ *   scaled  padded, and BUF_LOCKS_PER_CPU locks per CPU as in buf_init()
+ *
+ * For each layout it reports lookups per second and the share of lock
+ * acquisitions that found the lock already held.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/zfs_context.h>
+
+/* Keep these in sync with module/zfs/arc.c. */
+#define	BUF_LOCKS_MIN		2048
+#define	BUF_LOCKS_PER_CPU	64
+
+typedef struct buf_hash_lock {
+	kmutex_t	hl_lock;
+} ____cacheline_aligned buf_hash_lock_t;
+
+typedef struct bench_layout {
+	const char	*bl_name;
+	uint64_t	bl_lock_mask;
+	size_t		bl_stride;
+	char		*bl_locks;
+} bench_layout_t;
+
+typedef struct bench_thread {
+	pthread_t	bt_thread;
+	bench_layout_t	*bt_layout;
+	uint64_t	bt_seed;
+	uint64_t	bt_contended;
+} bench_thread_t;
+
+static uint64_t bench_ops = 1000000;
+static uint64_t bench_hsize = 1ULL << 20;
+static uintptr_t *bench_table;
+static pthread_barrier_t bench_barrier;
+
+static void
+usage(int exit_value)
+{
+	(void) fprintf(stderr, "Usage:\tbuf_hash_lock_bench [-c cpus] "
+	    "[-n lookups] [-t threads]\n");
+	(void) fprintf(stderr, "\t-c  CPU count used to size the scaled "
+	    "layout (default: online CPUs)\n");
+	(void) fprintf(stderr, "\t-n  lookups per thread "
+	    "(default: %llu)\n", (u_longlong_t)bench_ops);
+	(void) fprintf(stderr, "\t-t  number of threads "
+	    "(default: online CPUs)\n");
+	exit(exit_value);
+}
+
+#define	BENCH_LOCK(bl, idx)	((kmutex_t *)((bl)->bl_locks + \
+	((idx) & (bl)->bl_lock_mask) * (bl)->bl_stride))
+
+static void
+bench_layout_init(bench_layout_t *bl, const char *name, uint64_t nlocks,
+    size_t stride)
+{
+	bl->bl_name = name;
+	bl->bl_lock_mask = nlocks - 1;
+	bl->bl_stride = stride;
+	bl->bl_locks = umem_zalloc(nlocks * stride, UMEM_NOFAIL);
+	for (uint64_t i = 0; i < nlocks; i++)
+		mutex_init(BENCH_LOCK(bl, i), NULL, MUTEX_DEFAULT, NULL);
+}
+
+static void
+bench_layout_fini(bench_layout_t *bl)
+{
+	for (uint64_t i = 0; i <= bl->bl_lock_mask; i++)
+		mutex_destroy(BENCH_LOCK(bl, i));
+	umem_free(bl->bl_locks, (bl->bl_lock_mask + 1) * bl->bl_stride);
+}
+
+static void *
+bench_thread(void *arg)
+{
+	bench_thread_t *bt = arg;
+	bench_layout_t *bl = bt->bt_layout;
+	uint64_t x = bt->bt_seed;
+	uintptr_t sum = 0;
+
+	(void) pthread_barrier_wait(&bench_barrier);
+	for (uint64_t i = 0; i < bench_ops; i++) {
+		/* xorshift64 */
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		uint64_t idx = x & (bench_hsize - 1);
+		kmutex_t *lock = BENCH_LOCK(bl, idx);
+
+		if (!mutex_tryenter(lock)) {
+			bt->bt_contended++;
+			mutex_enter(lock);
+		}
+		sum += bench_table[idx];
+		mutex_exit(lock);
+	}
+	return ((void *)sum);
+}
+
+static void
+bench_run(bench_layout_t *bl, int nthreads)
+{
+	bench_thread_t *bts = umem_zalloc(nthreads * sizeof (bench_thread_t),
+	    UMEM_NOFAIL);
+	uint64_t contended = 0;
+
+	VERIFY0(pthread_barrier_init(&bench_barrier, NULL, nthreads + 1));
+	for (int t = 0; t < nthreads; t++) {
+		bts[t].bt_layout = bl;
+		bts[t].bt_seed = 0x9e3779b97f4a7c15ULL * (t + 1);
+		VERIFY0(pthread_create(&bts[t].bt_thread, NULL, bench_thread,
+		    &bts[t]));
+	}
+
+	hrtime_t start = gethrtime();
+	(void) pthread_barrier_wait(&bench_barrier);
+	for (int t = 0; t < nthreads; t++) {
+		VERIFY0(pthread_join(bts[t].bt_thread, NULL));
+		contended += bts[t].bt_contended;
+	}
+	hrtime_t elapsed = MAX(gethrtime() - start, 1);
+	VERIFY0(pthread_barrier_destroy(&bench_barrier));
+
+	uint64_t total = bench_ops * nthreads;
+	(void) printf("%-8s locks %7llu  %12llu lookups/s  %7.3f%% contended\n",
+	    bl->bl_name, (u_longlong_t)(bl->bl_lock_mask + 1),
+	    (u_longlong_t)(total * NANOSEC / elapsed),
+	    100.0 * contended / total);
+
+	umem_free(bts, nthreads * sizeof (bench_thread_t));
+}
+
+int
+main(int argc, char *argv[])
+{
+	long online = sysconf(_SC_NPROCESSORS_ONLN);
+	int ncpus = MAX(online, 1);
+	int nthreads = ncpus;
+	bench_layout_t layouts[3];
+	int c;
+
+	while ((c = getopt(argc, argv, "c:hn:t:")) != -1) {
+		switch (c) {
+		case 'c':
+			ncpus = atoi(optarg);
+			break;
+		case 'n':
+			bench_ops = strtoull(optarg, NULL, 0);
+			break;
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'h':
+			usage(0);
+			break;
+		default:
+			usage(1);
+			break;
+		}
+	}
+	if (ncpus < 1 || nthreads < 1 || bench_ops == 0)
+		usage(1);
+
+	uint64_t nlocks = BUF_LOCKS_MIN;
+	while (nlocks < (uint64_t)ncpus * BUF_LOCKS_PER_CPU)
+		nlocks <<= 1;
+	nlocks = MIN(nlocks, bench_hsize);
+
+	bench_table = umem_zalloc(bench_hsize * sizeof (uintptr_t),
+	    UMEM_NOFAIL);
+	bench_layout_init(&layouts[0], "packed", BUF_LOCKS_MIN,
+	    sizeof (kmutex_t));
+	bench_layout_init(&layouts[1], "padded", BUF_LOCKS_MIN,
+	    sizeof (buf_hash_lock_t));
+	bench_layout_init(&layouts[2], "scaled", nlocks,
+	    sizeof (buf_hash_lock_t));
+
+	(void) printf("%d threads, %llu lookups each, scaled for %d CPUs\n",
+	    nthreads, (u_longlong_t)bench_ops, ncpus);
+	for (int i = 0; i < 3; i++) {
+		bench_run(&layouts[i], nthreads);
+		bench_layout_fini(&layouts[i]);
+	}
+	umem_free(bench_table, bench_hsize * sizeof (uintptr_t));
+
+	return (0);
+}